@@ -0,0 +1,478 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ *      bake.c
+ *
+ *      Copyright 2009 Romuald Rousseau <romualdrousseau@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <globals.h>
+#include <string.h>
+
+#define BAKE_MANIFEST "bake.manifest"
+
+/* --- types --- */
+typedef struct _BakeJob BakeJob;
+
+enum
+{
+    BAKE_NONE,
+    BAKE_MESH,
+    BAKE_MESHGROUP,
+    BAKE_IMAGE
+};
+
+/* --- structures --- */
+struct _BakeJob
+{
+    gchar*          name;
+    gchar*          file_name;
+    guint           kind;
+    gboolean        world;
+    const gchar*    status;
+};
+
+/* --- variables --- */
+static gint jobs_count = 0;
+static gboolean force = FALSE;
+static gchar** meshgroup_names = NULL;
+static gchar** world_names = NULL;
+static gchar* manifest_name = NULL;
+static gchar* pak_name = NULL;
+
+static GOptionEntry entries[] =
+{
+    {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs_count, "Number of parallel jobs, one per CPU by default", "N"},
+    {"force", 'f', 0, G_OPTION_ARG_NONE, &force, "Bake files whose cache is up to date", NULL},
+    {"group", 'g', 0, G_OPTION_ARG_STRING_ARRAY, &meshgroup_names, "Bake FILE as a mesh group", "FILE"},
+    {"world", 'w', 0, G_OPTION_ARG_STRING_ARRAY, &world_names, "Bake FILE as a mesh group and its world graph", "FILE"},
+    {"manifest", 'm', 0, G_OPTION_ARG_FILENAME, &manifest_name, "Write the manifest to FILE, DATADIR/" BAKE_MANIFEST " by default", "FILE"},
+    {"pack", 'p', 0, G_OPTION_ARG_FILENAME, &pak_name, "Pack the baked data into the archive FILE", "FILE"},
+    {NULL}
+};
+
+/* --- functions --- */
+/*
+ * _bake_is_listed:
+ *
+ */
+static gboolean
+_bake_is_listed(
+    gchar**         names,
+    const gchar*    name
+    )
+{
+    guint i;
+
+    for(i = 0; names != NULL && names[i] != NULL; i++)
+    {
+        if(g_str_equal(names[i], name))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * _bake_get_kind:
+ *
+ * Returns how @name is baked, BAKE_NONE if it is packed as it is.
+ */
+static guint
+_bake_get_kind(
+    const gchar*    name
+    )
+{
+    gchar* name_down;
+    guint result;
+
+    name_down = g_ascii_strdown(name, -1);
+    if(g_str_has_suffix(name_down, ".obj") || g_str_has_suffix(name_down, ".md2"))
+    {
+        result = (_bake_is_listed(meshgroup_names, name) || _bake_is_listed(world_names, name)) ? BAKE_MESHGROUP : BAKE_MESH;
+    }
+    else if(g_str_has_suffix(name_down, ".tga"))
+    {
+        result = BAKE_IMAGE;
+    }
+    else
+    {
+        result = BAKE_NONE;
+    }
+    g_free(name_down);
+    return result;
+}
+
+/*
+ * _bake_collect:
+ *
+ * Recursively queues every mesh and image of @data_dir/@sub_dir.
+ */
+static void
+_bake_collect(
+    const gchar*    data_dir,
+    const gchar*    sub_dir,
+    GPtrArray*      jobs
+    )
+{
+    GDir* dir;
+    BakeJob* job;
+    const gchar* entry;
+    gchar* dir_name;
+    gchar* name;
+    gchar* file_name;
+    guint kind;
+
+    dir_name = g_build_filename(data_dir, sub_dir, NULL);
+    dir = g_dir_open(dir_name, 0, NULL);
+    g_free(dir_name);
+    if(dir == NULL)
+    {
+        return;
+    }
+
+    while((entry = g_dir_read_name(dir)) != NULL)
+    {
+        name = (sub_dir[0] != '\0') ? g_build_filename(sub_dir, entry, NULL) : g_strdup(entry);
+        file_name = g_build_filename(data_dir, name, NULL);
+        if(g_file_test(file_name, G_FILE_TEST_IS_DIR))
+        {
+            _bake_collect(data_dir, name, jobs);
+        }
+        else if((kind = _bake_get_kind(name)) != BAKE_NONE)
+        {
+            job = g_slice_new0(BakeJob);
+            job->name = name;
+            job->file_name = file_name;
+            job->kind = kind;
+            job->world = _bake_is_listed(world_names, name);
+            g_ptr_array_add(jobs, job);
+            continue;
+        }
+        g_free(file_name);
+        g_free(name);
+    }
+    g_dir_close(dir);
+}
+
+/*
+ * _bake_collect_pak:
+ *
+ * Recursively lists the files of @data_dir/@sub_dir to pack, leaving out
+ * the archives, the manifest and the sources replaced by their cache.
+ */
+static void
+_bake_collect_pak(
+    const gchar*    data_dir,
+    const gchar*    sub_dir,
+    GHashTable*     baked,
+    GPtrArray*      names
+    )
+{
+    GDir* dir;
+    const gchar* entry;
+    gchar* dir_name;
+    gchar* name;
+    gchar* file_name;
+
+    dir_name = g_build_filename(data_dir, sub_dir, NULL);
+    dir = g_dir_open(dir_name, 0, NULL);
+    g_free(dir_name);
+    if(dir == NULL)
+    {
+        return;
+    }
+
+    while((entry = g_dir_read_name(dir)) != NULL)
+    {
+        name = (sub_dir[0] != '\0') ? g_build_filename(sub_dir, entry, NULL) : g_strdup(entry);
+        file_name = g_build_filename(data_dir, name, NULL);
+        if(g_file_test(file_name, G_FILE_TEST_IS_DIR))
+        {
+            _bake_collect_pak(data_dir, name, baked, names);
+        }
+        else if(!g_str_has_suffix(name, ".rpak") &&
+            !g_str_has_suffix(name, ".tmp") &&
+            !g_str_equal(name, BAKE_MANIFEST) &&
+            g_hash_table_lookup(baked, name) == NULL)
+        {
+            g_ptr_array_add(names, name);
+            name = NULL;
+        }
+        g_free(file_name);
+        g_free(name);
+    }
+    g_dir_close(dir);
+}
+
+/*
+ * _bake_compare_names:
+ *
+ */
+static gint
+_bake_compare_names(
+    gconstpointer   a,
+    gconstpointer   b
+    )
+{
+    return strcmp(*(gchar**) a, *(gchar**) b);
+}
+
+/*
+ * _bake_write_pak:
+ *
+ */
+static gboolean
+_bake_write_pak(
+    const gchar*    data_dir,
+    GPtrArray*      jobs
+    )
+{
+    GHashTable* baked;
+    GPtrArray* names;
+    BakeJob* job;
+    gboolean result;
+    guint i;
+
+    baked = g_hash_table_new(g_str_hash, g_str_equal);
+    for(i = 0; i < jobs->len; i++)
+    {
+        job = g_ptr_array_index(jobs, i);
+        if(!g_str_equal(job->status, "failed"))
+        {
+            g_hash_table_insert(baked, job->name, job);
+        }
+    }
+
+    names = g_ptr_array_new();
+    _bake_collect_pak(data_dir, "", baked, names);
+    g_ptr_array_sort(names, _bake_compare_names);
+    g_ptr_array_add(names, NULL);
+
+    result = r_pak_build(pak_name, data_dir, (const gchar**) names->pdata);
+    g_message("Packing %d files into %s: %s", names->len - 1, pak_name, result ? "done" : "failed");
+
+    g_ptr_array_free(names, TRUE);
+    g_hash_table_destroy(baked);
+    return result;
+}
+
+/*
+ * _bake_compare:
+ *
+ */
+static gint
+_bake_compare(
+    gconstpointer   a,
+    gconstpointer   b
+    )
+{
+    return strcmp((*(BakeJob**) a)->name, (*(BakeJob**) b)->name);
+}
+
+/*
+ * _bake_is_fresh:
+ *
+ */
+static gboolean
+_bake_is_fresh(
+    BakeJob*        job
+    )
+{
+    if(job->kind == BAKE_IMAGE)
+    {
+        return r_image_bake_is_fresh(job->file_name);
+    }
+    return r_mesh_bake_is_fresh(job->file_name, job->kind == BAKE_MESHGROUP) &&
+        (!job->world || world_bake_is_fresh(job->file_name));
+}
+
+/*
+ * _bake_run:
+ *
+ * The world graph is built from the mesh cache, baked first.
+ */
+static gboolean
+_bake_run(
+    BakeJob*        job
+    )
+{
+    if(job->kind == BAKE_IMAGE)
+    {
+        return r_image_bake(job->file_name);
+    }
+    return r_mesh_bake(job->file_name, job->kind == BAKE_MESHGROUP) &&
+        (!job->world || world_bake(job->file_name));
+}
+
+/*
+ * _bake_job:
+ *
+ * Runs on the thread pool.
+ */
+static void
+_bake_job(
+    gpointer        data,
+    gpointer        user_data
+    )
+{
+    BakeJob* job = data;
+
+    if(!force && _bake_is_fresh(job))
+    {
+        job->status = "up-to-date";
+    }
+    else if(_bake_run(job))
+    {
+        job->status = "baked";
+    }
+    else
+    {
+        job->status = "failed";
+    }
+    g_message("%s: %s", job->name, job->status);
+}
+
+/*
+ * _bake_write_manifest:
+ *
+ */
+static gboolean
+_bake_write_manifest(
+    const gchar*    file_name,
+    GPtrArray*      jobs
+    )
+{
+    static const gchar* kinds[] = {NULL, "mesh", "meshgroup", "image"};
+    GKeyFile* manifest;
+    BakeJob* job;
+    gchar* cache_name;
+    gchar* data;
+    gsize length;
+    gboolean result;
+    guint i;
+
+    manifest = g_key_file_new();
+    for(i = 0; i < jobs->len; i++)
+    {
+        job = g_ptr_array_index(jobs, i);
+        cache_name = g_strconcat(job->name, (job->kind == BAKE_IMAGE) ? ".rimage" : ".rmesh", NULL);
+        g_key_file_set_string(manifest, job->name, "kind", kinds[job->kind]);
+        g_key_file_set_string(manifest, job->name, "cache", cache_name);
+        g_free(cache_name);
+        if(job->world)
+        {
+            cache_name = g_strconcat(job->name, ".rworld", NULL);
+            g_key_file_set_string(manifest, job->name, "world", cache_name);
+            g_free(cache_name);
+        }
+        g_key_file_set_string(manifest, job->name, "status", job->status);
+    }
+
+    data = g_key_file_to_data(manifest, &length, NULL);
+    result = g_file_set_contents(file_name, data, length, NULL);
+    g_free(data);
+    g_key_file_free(manifest);
+    return result;
+}
+
+/**
+ * main:
+ * @argc:
+ * @argv:
+ *
+ * Entry point of rpg-bake: bakes the meshes, the images and the world
+ * graphs of a data directory into their .rmesh, .rimage and .rworld
+ * caches, in parallel and skipping the ones already up to date.
+ *
+ * Return value: 0 if every file was baked
+ **/
+int
+main(
+    gint        argc,
+    gchar**     argv
+    )
+{
+    GOptionContext* context;
+    GThreadPool* pool;
+    GPtrArray* jobs;
+    GError* error = NULL;
+    BakeJob* job;
+    const gchar* data_dir;
+    gchar* file_name;
+    gint result;
+    guint i;
+
+    context = g_option_context_new("[DATADIR] - bake the game data for fast loading");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    data_dir = (argc > 1) ? argv[1] : PACKAGE_DATADIR;
+    if(jobs_count <= 0)
+    {
+        jobs_count = MAX(r_thread_get_cpu_count(), 1);
+    }
+
+    jobs = g_ptr_array_new();
+    _bake_collect(data_dir, "", jobs);
+    g_ptr_array_sort(jobs, _bake_compare);
+    g_message("Baking %d files from %s with %d jobs...", jobs->len, data_dir, jobs_count);
+
+    pool = g_thread_pool_new(_bake_job, NULL, jobs_count, TRUE, NULL);
+    for(i = 0; i < jobs->len; i++)
+    {
+        g_thread_pool_push(pool, g_ptr_array_index(jobs, i), NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    result = 0;
+    file_name = (manifest_name != NULL) ? g_strdup(manifest_name) : g_build_filename(data_dir, BAKE_MANIFEST, NULL);
+    if(!_bake_write_manifest(file_name, jobs))
+    {
+        g_printerr("Unable to write %s\n", file_name);
+        result = 1;
+    }
+    g_free(file_name);
+
+    if(pak_name != NULL && !_bake_write_pak(data_dir, jobs))
+    {
+        result = 1;
+    }
+
+    for(i = 0; i < jobs->len; i++)
+    {
+        job = g_ptr_array_index(jobs, i);
+        if(g_str_equal(job->status, "failed"))
+        {
+            result = 1;
+        }
+        g_free(job->file_name);
+        g_free(job->name);
+        g_slice_free(BakeJob, job);
+    }
+    g_ptr_array_free(jobs, TRUE);
+
+    return result;
+}
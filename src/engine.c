@@ -22,18 +22,9 @@
 
 #include <globals.h>
 
-/* --- types --- */
-typedef struct __ResourceProgressBar _ResourceProgressBar;
-
-/* --- structures --- */
-struct __ResourceProgressBar
-{
-    guint   max;
-    guint   current;
-};
-
 /* --- variables --- */
-static _ResourceProgressBar progress_bar;
+static RResourceRequest* loading_requests[4] = {NULL};
+static const gchar* loading_keys[4];
 
 /* --- functions --- */
 static void
@@ -74,6 +65,95 @@ _list(
     }
 }
 
+static void
+_res(
+    gchar** args
+    )
+{
+    RResourceManagerStats stats;
+    RResourceManagerInfo* info;
+    GArray* infos;
+    guint sort = R_RESOURCE_SORT_SIZE;
+    guint count = 16;
+    guint i;
+
+    if(args[1] != NULL && g_str_equal(args[1], "time"))
+    {
+        sort = R_RESOURCE_SORT_LOAD_TIME;
+    }
+    else if(args[1] != NULL && g_str_equal(args[1], "name"))
+    {
+        sort = R_RESOURCE_SORT_NAME;
+    }
+    else if(args[1] != NULL && !g_str_equal(args[1], "size"))
+    {
+        r_console_print("usage: res [size|time|name] [count]\n");
+        return;
+    }
+    if(args[1] != NULL && args[2] != NULL)
+    {
+        count = g_ascii_strtoull(args[2], NULL, 10);
+    }
+
+    r_resource_manager_get_stats(&stats);
+    r_console_printf(
+        "cpu %luK/%luK gpu %luK/%luK hits %u misses %u evictions %u\n",
+        (gulong) (stats.cpu_size >> 10),
+        (gulong) (stats.cpu_budget >> 10),
+        (gulong) (stats.gpu_size >> 10),
+        (gulong) (stats.gpu_budget >> 10),
+        stats.hits,
+        stats.misses,
+        stats.evictions
+        );
+
+    infos = r_resource_manager_get_infos(sort);
+    r_console_print("   cpu KB    gpu KB  load ms  hits  frame name\n");
+    for(i = 0; i < MIN(infos->len, count); i++)
+    {
+        info = &g_array_index(infos, RResourceManagerInfo, i);
+        r_console_printf(
+            "%9.1f %9.1f %8.2f %5u %6u %s%s\n",
+            info->cpu_size / 1024.0f,
+            info->gpu_size / 1024.0f,
+            info->load_time / 1000.0f,
+            info->hits,
+            info->last_access,
+            info->name,
+            (info->state == R_RESOURCE_STATE_FAILED) ? " (failed)" : ""
+            );
+    }
+    if(infos->len > count)
+    {
+        r_console_printf("%u more\n", infos->len - count);
+    }
+    r_resource_manager_free_infos(infos);
+}
+
+static void
+_tick(
+    gchar** args
+    )
+{
+    guint rate;
+
+    if(args[1] != NULL)
+    {
+        rate = g_ascii_strtoull(args[1], NULL, 10);
+        if(rate == 0 || rate > 1000)
+        {
+            r_console_print("usage: tick [rate 1-1000] [catch up]\n");
+            return;
+        }
+        kernel->tick_rate = rate;
+        if(args[2] != NULL)
+        {
+            kernel->tick_catch_up = MAX(g_ascii_strtoull(args[2], NULL, 10), 1);
+        }
+    }
+    r_console_printf("%u ticks per second, %u at most per frame\n", kernel->tick_rate, kernel->tick_catch_up);
+}
+
 static void
 _configure()
 {
@@ -89,6 +169,14 @@ _configure()
         "console_change",
         (RGameCallback) _change
         );
+    r_game_signal_connect(
+        "console_res",
+        (RGameCallback) _res
+        );
+    r_game_signal_connect(
+        "console_tick",
+        (RGameCallback) _tick
+        );
     
     kernel->actions[ACTION_QUIT] = r_game_action_register(XK_Escape);
     kernel->actions[ACTION_FULLSCREEN_TOGGLE] = r_game_action_register(XK_F1);
@@ -104,39 +192,73 @@ _configure()
     kernel->actions[ACTION_HERO_BACKWARD] = r_game_action_register(XK_Down);
 }
 
-static void
-_load()
-{
-    resources_progress_bar_start(4);
-    console->hud = r_resource_ref("console.hud");
-    resources_progress_bar_stepit();
-    console->font = r_resource_ref("console.font");
-    resources_progress_bar_stepit();
-    manor = r_resource_ref("meshes.manor");
-    resources_progress_bar_stepit();
-    hero_spawn();
-    resources_progress_bar_stepit();
-}
-
-void
-resources_progress_bar_start(
-    guint       max
+static gboolean
+_load(
+    gboolean*       failed
     )
 {
-    progress_bar.max = max;
-    progress_bar.current = 0;
-}
+    guint i;
 
-void
-resources_progress_bar_stepit()
-{
-    progress_bar.current++;
+    /* the loaders run in the background while the progress bar is drawn */
+    if(loading_requests[0] == NULL)
+    {
+        loading_keys[0] = "console.hud";
+        loading_keys[1] = "console.font";
+        loading_keys[2] = "meshes.manor";
+        loading_keys[3] = HeroNames[kernel->selected_hero];
+        for(i = 0; i < G_N_ELEMENTS(loading_requests); i++)
+        {
+            loading_requests[i] = r_resource_ref_async(loading_keys[i], NULL, NULL);
+        }
+    }
+    *failed = FALSE;
+    for(i = 0; i < G_N_ELEMENTS(loading_requests); i++)
+    {
+        if(r_resource_request_has_failed(loading_requests[i]))
+        {
+            *failed = TRUE;
+        }
+        else if(!r_resource_request_is_ready(loading_requests[i]))
+        {
+            return FALSE;
+        }
+    }
+
+    if(*failed)
+    {
+        for(i = 0; i < G_N_ELEMENTS(loading_requests); i++)
+        {
+            if(r_resource_request_has_failed(loading_requests[i]))
+            {
+                r_console_printf("unable to load %s\n", loading_keys[i]);
+            }
+            else
+            {
+                r_resource_unref(loading_keys[i]);
+            }
+            r_resource_request_free(loading_requests[i]);
+            loading_requests[i] = NULL;
+        }
+        return TRUE;
+    }
+
+    console->hud = r_resource_request_get_data(loading_requests[0]);
+    console->font = r_resource_request_get_data(loading_requests[1]);
+    manor = r_resource_request_get_data(loading_requests[2]);
+    hero_spawn();
+    r_resource_unref(loading_keys[3]); /* hero_spawn holds its own */
+    for(i = 0; i < G_N_ELEMENTS(loading_requests); i++)
+    {
+        r_resource_request_free(loading_requests[i]);
+        loading_requests[i] = NULL;
+    }
+    return TRUE;
 }
 
 gfloat
 resources_progress_bar_get()
 {
-    return (gfloat) progress_bar.current / (gfloat) progress_bar.max;
+    return r_resource_manager_get_progress();
 }
 
 gboolean
@@ -144,6 +266,8 @@ engine(
     gpointer        data
     )
 {
+    gboolean failed;
+
     switch(kernel->state)
     {
         case GAME_INIT:
@@ -152,8 +276,10 @@ engine(
             break;
 
         case GAME_LOADING:
-            _load();
-            kernel->state = GAME_SCENE;
+            if(_load(&failed))
+            {
+                kernel->state = failed ? GAME_DESTROY : GAME_SCENE;
+            }
             break;
 
         case GAME_SCENE:
@@ -0,0 +1,192 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ *      frame.c
+ *
+ *      Copyright 2009 Romuald Rousseau <romualdrousseau@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <globals.h>
+
+#define FRAME_FRESH     4
+
+/* --- variables --- */
+/*
+ * A triple buffer: the simulation fills one frame, the renderer draws
+ * another and the last one published waits in between, flagged as fresh
+ * until the renderer swaps it with the one it is done with.
+ */
+static Frame frames[3];
+static gint frame_writing = 0;
+static gint frame_reading = 1;
+static volatile gint frame_latest = 2;
+
+/* --- functions --- */
+/*
+ * _frame_exchange:
+ *
+ */
+static gint
+_frame_exchange(
+    volatile gint*  atomic,
+    gint            value
+    )
+{
+    gint old_value;
+
+    do
+    {
+        old_value = g_atomic_int_get(atomic);
+    }
+    while(!g_atomic_int_compare_and_exchange(atomic, old_value, value));
+    return old_value;
+}
+
+/*
+ * _frame_capture:
+ *
+ */
+static void
+_frame_capture(
+    Frame*          frame
+    )
+{
+    float4x4 view;
+    float4x4 projection;
+    RFrustum frustum;
+    float3 p1 = {0.0f, 1.0f, 0.0f};
+    float3 p2 = {-hero->position.x, -hero->position.y, -hero->position.z};
+    float3 p3 = {0.0f, -0.4f, -2.0f};
+
+    frame->state = kernel->state;
+    frame->progress = resources_progress_bar_get();
+    frame->time = kernel->tick_time;
+    frame->tick_length = G_USEC_PER_SEC / kernel->tick_rate;
+    g_ptr_array_set_size(frame->visible, 0);
+    if(frame->state != GAME_SCENE)
+    {
+        return;
+    }
+
+    /* culled from the last tick, the camera drawn lags it by less than one */
+    r_matrix_identity_set(&view);
+    r_matrix_translate(&view, &p3);
+    r_matrix_rotate(&view, -hero->rotation, &p1);
+    r_matrix_translate(&view, &p2);
+    if(hero->world_node != NULL)
+    {
+        r_frustum_set(&frustum, &view, r_renderer_get_projection(&projection));
+        world_node_collect(&frustum, manor, hero->world_node, frame->visible);
+    }
+
+    frame->hero_position = hero->position;
+    frame->hero_last_position = hero->last_position;
+    frame->hero_rotation = hero->rotation;
+    frame->hero_last_rotation = hero->last_rotation;
+    frame->hero_mesh = hero->mesh_handle;
+    frame->hero_action = hero->action;
+    frame->hero_anim_time = hero->anim_time;
+    frame->hero_last_anim_time = hero->last_anim_time;
+    frame->hud = console->hud;
+    frame->font = console->font;
+    frame->console_mode = console->mode;
+}
+
+/**
+ * frame_init:
+ *
+ **/
+void
+frame_init()
+{
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(frames); i++)
+    {
+        frames[i].state = GAME_INIT;
+        frames[i].visible = g_ptr_array_new();
+        frames[i].hero_mesh = R_RESOURCE_HANDLE_NONE;
+    }
+}
+
+/**
+ * frame_destroy:
+ *
+ * The renderer must be stopped.
+ **/
+void
+frame_destroy()
+{
+    guint i;
+
+    for(i = 0; i < G_N_ELEMENTS(frames); i++)
+    {
+        g_ptr_array_free(frames[i].visible, TRUE);
+        frames[i].visible = NULL;
+    }
+}
+
+/**
+ * frame_publish:
+ *
+ * Captures the state of the simulation in a new frame and hands it over
+ * to the renderer. Only called by the simulation.
+ **/
+void
+frame_publish()
+{
+    _frame_capture(&frames[frame_writing]);
+    frame_writing = _frame_exchange(&frame_latest, frame_writing | FRAME_FRESH) & ~FRAME_FRESH;
+}
+
+/**
+ * frame_get:
+ *
+ * Returns the last frame published, which stays valid until the next
+ * call. Only called by the renderer.
+ **/
+const Frame*
+frame_get()
+{
+    if(g_atomic_int_get(&frame_latest) & FRAME_FRESH)
+    {
+        frame_reading = _frame_exchange(&frame_latest, frame_reading) & ~FRAME_FRESH;
+    }
+    return &frames[frame_reading];
+}
+
+/**
+ * frame_get_alpha:
+ *
+ * Returns how far between the tick before @frame and @frame itself the
+ * scene must be drawn now, from 0 to 1. Drawing one tick late keeps the
+ * motion smooth whatever the rates of the simulation and of the display.
+ **/
+gfloat
+frame_get_alpha(
+    const Frame*    frame
+    )
+{
+    gfloat alpha;
+
+    if(frame->tick_length == 0)
+    {
+        return 1.0f;
+    }
+    alpha = (gfloat) (g_get_monotonic_time() - frame->time) / (gfloat) frame->tick_length;
+    return CLAMP(alpha, 0.0f, 1.0f);
+}
@@ -33,6 +33,12 @@
 #define WIDTH               1024
 #define HEIGHT              768
 
+#define WORLD_PREFETCH_HOPS 2
+
+#define TICK_RATE           100
+#define TICK_CATCH_UP       5
+#define ENGINE_RATE         50
+
 /* --- types --- */
 enum
 {
@@ -83,6 +89,10 @@ struct _Kernel
     guint        selected_hero;
     guint        desired_hero;
     gshort*      actions[16];
+    guint        tick_rate;
+    guint        tick_catch_up;
+    gint64       tick_time;
+    gint64       engine_time;
 };
 typedef struct _Kernel Kernel;
 
@@ -115,6 +125,9 @@ union _WorldNode
         float3              bbox[2];
         GList*              portals;
         GList*              scultures;
+        guint               scultures_count;
+        float3*             scultures_bbox;
+        gboolean*           scultures_visibility;
     }
     room;
 
@@ -149,6 +162,7 @@ struct _World
     gfloat      camera_rotation;
     GArray*     nodes;
     RMeshGroup* groups;
+    WorldNode*  prefetch_node;
 };
 typedef struct _World World;
 
@@ -158,16 +172,57 @@ struct _Entity
     gfloat      rotation;
     float3      velocity;
     gboolean    animating;
+    gfloat      anim_time;
+    float3      last_position;
+    gfloat      last_rotation;
+    gfloat      last_anim_time;
     guint       action;
     guint       last_action;
     RMesh*      mesh;
+    RResourceHandle mesh_handle;
     float3      bbox[2];
     WorldNode*  world_node;
 };
 typedef struct _Entity Entity;
 
+struct _EntityAnimation
+{
+    guint       frame_first;
+    guint       frame_last;
+    guint       frame_fps;
+    gboolean    repeat_mode;
+};
+typedef struct _EntityAnimation EntityAnimation;
+
+/*
+ * What the simulation hands over to the renderer, never changed once
+ * published. The last_ fields hold the state one tick before time, the
+ * renderer blends both by frame_get_alpha.
+ */
+struct _Frame
+{
+    guint       state;
+    gfloat      progress;
+    gint64      time;
+    gint64      tick_length;
+    GPtrArray*  visible;
+    float3      hero_position;
+    float3      hero_last_position;
+    gfloat      hero_rotation;
+    gfloat      hero_last_rotation;
+    RResourceHandle hero_mesh;
+    guint       hero_action;
+    gfloat      hero_anim_time;
+    gfloat      hero_last_anim_time;
+    RSurface*   hud;
+    RFont*      font;
+    gboolean    console_mode;
+};
+typedef struct _Frame Frame;
+
 /* --- variables --- */
 extern const gchar* HeroNames[];
+extern const EntityAnimation HeroAnimations[];
 
 extern Kernel* kernel;
 extern Console* console;
@@ -182,11 +237,24 @@ extern void
 hero_kill();
 
 extern void
-hero_physic();
+hero_physic(
+    gfloat                  dt
+    );
 
 extern World*
 world_new(
-    RMeshGroup*             groups
+    RMeshGroup*             groups,
+    const gchar*            file_name
+    );
+
+extern gboolean
+world_bake(
+    const gchar*            file_name
+    );
+
+extern gboolean
+world_bake_is_fresh(
+    const gchar*            file_name
     );
 
 extern void
@@ -208,22 +276,46 @@ world_node_collide(
     );
     
 extern void
-world_node_draw(
-    float4x4*               view,
+world_node_collect(
+    RFrustum*               frustum,
     World*                  world,
-    WorldNode*              node_to_draw
+    WorldNode*              node_to_collect,
+    GPtrArray*              meshes
     );
-    
+
 extern void
-resources_progress_bar_start(
-    guint                   max
+world_prefetch(
+    World*                  world,
+    WorldNode*              node,
+    float3*                 position,
+    float3*                 velocity
     );
     
+extern gfloat
+resources_progress_bar_get();
+
+extern void
+frame_init();
+
 extern void
-resources_progress_bar_stepit();
+frame_destroy();
+
+extern void
+frame_publish();
+
+extern const Frame*
+frame_get();
 
 extern gfloat
-resources_progress_bar_get();
+frame_get_alpha(
+    const Frame*            frame
+    );
+
+extern void
+resources_init();
+
+extern void
+resources_destroy();
 
 extern void
 resources_load(
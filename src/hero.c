@@ -33,25 +33,77 @@ const gchar* HeroNames[] =
     "meshes.hero7"
 };
 
+const EntityAnimation HeroAnimations[] =
+{
+    {0,     39,     9,      TRUE},  /* ENTITY_ACTION_NONE */
+    {40,    45,     10,     TRUE},  /* ENTITY_ACTION_RUNNING */
+    {66,    71,     7,      FALSE}, /* ENTITY_ACTION_JUMPING */
+    {54,    57,     7,      FALSE}  /* ENTITY_ACTION_FALLING */
+};
+
 /* --- variables --- */
 static Entity _hero = {
     {0.0f, 4.0f, 0.0f},
     0.0f,
     {0.0f, 0.0f, 0.0f},
     TRUE,
+    0.0f,
+    {0.0f, 4.0f, 0.0f},
+    0.0f,
+    0.0f,
     ENTITY_ACTION_NONE,
     ENTITY_ACTION_NONE,
     NULL,
+    R_RESOURCE_HANDLE_NONE,
     {{0.0f}, {0.0f}},
     NULL
 };
 Entity* hero = &_hero;
 
 /* --- functions --- */
+/*
+ * _hero_animate:
+ *
+ * Moves the animation clock of the current action by one tick, the
+ * renderer only draws the frame it is at.
+ */
+static void
+_hero_animate(
+    gfloat          dt
+    )
+{
+    const EntityAnimation* animation;
+    guint frame_range;
+
+    if(hero->action != hero->last_action)
+    {
+        hero->anim_time = 0.0f;
+        hero->last_action = hero->action;
+    }
+
+    animation = &HeroAnimations[hero->action];
+    frame_range = animation->frame_last - animation->frame_first;
+    hero->anim_time += animation->frame_fps * dt;
+    hero->animating = TRUE;
+    if(animation->repeat_mode)
+    {
+        if((guint) hero->anim_time > frame_range)
+        {
+            hero->anim_time = 0.0f;
+        }
+    }
+    else if((guint) hero->anim_time >= frame_range)
+    {
+        hero->anim_time = frame_range;
+        hero->animating = FALSE;
+    }
+}
+
 void
 hero_spawn()
 {
-    hero->mesh = r_resource_ref(HeroNames[kernel->selected_hero]);
+    hero->mesh_handle = r_resource_ref_handle(HeroNames[kernel->selected_hero]);
+    hero->mesh = r_resource_handle_get(hero->mesh_handle);
     r_mesh_compute_bbox(hero->mesh, 0, hero->bbox);
     hero->bbox[1].x *= 2.0f;
     hero->bbox[1].z *= 2.0f;
@@ -61,20 +113,32 @@ hero_spawn()
 void
 hero_kill()
 {
-    r_resource_unref(HeroNames[kernel->selected_hero]);
+    r_resource_handle_unref(hero->mesh_handle);
+    hero->mesh_handle = R_RESOURCE_HANDLE_NONE;
 }
 
+/*
+ * hero_physic:
+ *
+ * Moves the hero by one tick of @dt seconds, speeds are per second.
+ */
 void
-hero_physic()
+hero_physic(
+    gfloat          dt
+    )
 {
     float3 bbox[2];
     float3 reaction;
     gboolean do_something = FALSE;
     
+    hero->last_position = hero->position;
+    hero->last_rotation = hero->rotation;
+    hero->last_anim_time = hero->anim_time;
+    
     hero->velocity.x = 0.0f;
     if(hero->velocity.y > 0.0f)
     {
-        hero->velocity.y += -0.0004f;
+        hero->velocity.y += -4.0f * dt;
     } 
     hero->velocity.z = 0.0f;
     
@@ -88,7 +152,7 @@ hero_physic()
                 {
                     hero->action = ENTITY_ACTION_RUNNING;
                 }
-                hero->rotation += 0.8f;
+                hero->rotation += 80.0f * dt;
                 do_something = TRUE;
             }
             if(*kernel->actions[ACTION_HERO_RIGHT])
@@ -97,7 +161,7 @@ hero_physic()
                 {
                     hero->action = ENTITY_ACTION_RUNNING;
                 }
-                hero->rotation -= 0.8f;
+                hero->rotation -= 80.0f * dt;
                 do_something = TRUE;
             }
             if(*kernel->actions[ACTION_HERO_FORWARD])
@@ -106,8 +170,8 @@ hero_physic()
                 {
                     hero->action = ENTITY_ACTION_RUNNING;
                 }
-                hero->velocity.x = -0.04f * sin(hero->rotation * DEG2RAD);
-                hero->velocity.z = -0.04f * cos(hero->rotation * DEG2RAD);
+                hero->velocity.x = -4.0f * sin(hero->rotation * DEG2RAD);
+                hero->velocity.z = -4.0f * cos(hero->rotation * DEG2RAD);
                 do_something = TRUE;
             }
             if(*kernel->actions[ACTION_HERO_BACKWARD])
@@ -116,8 +180,8 @@ hero_physic()
                 {
                     hero->action = ENTITY_ACTION_RUNNING;
                 }
-                hero->velocity.x = +0.04f * sin(hero->rotation * DEG2RAD);
-                hero->velocity.z = +0.04f * cos(hero->rotation * DEG2RAD);
+                hero->velocity.x = +4.0f * sin(hero->rotation * DEG2RAD);
+                hero->velocity.z = +4.0f * cos(hero->rotation * DEG2RAD);
                 do_something = TRUE;
             }
             if(*kernel->actions[ACTION_HERO_JUMP])
@@ -128,7 +192,7 @@ hero_physic()
                 }
                 if((hero->velocity.y == 0.0f))
                 {
-                    hero->velocity.y = +0.15f;
+                    hero->velocity.y = +15.0f;
                 }
                 do_something = TRUE;
             }
@@ -155,11 +219,12 @@ hero_physic()
         }
     }
     
-    hero->position.x += hero->velocity.x;
-    hero->position.y += hero->velocity.y - 0.0981f;
-    hero->position.z += hero->velocity.z;
+    hero->position.x += hero->velocity.x * dt;
+    hero->position.y += (hero->velocity.y - 9.81f) * dt;
+    hero->position.z += hero->velocity.z * dt;
     
     hero->world_node = world_node_get(manor, r_bbox_translate(hero->bbox, &hero->position, bbox));
+    world_prefetch(manor, hero->world_node, &hero->position, &hero->velocity);
     if(world_node_collide(hero->world_node, bbox, &reaction))
     {
         hero->position.x += reaction.x;
@@ -169,7 +234,8 @@ hero_physic()
         {
             if(reaction.y < 0.0f)
             {
-                hero->velocity.y = -EPSILON;
+                /* EPSILON per tick at the 100 Hz the speeds were tuned for */
+                hero->velocity.y = -EPSILON * 100.0f;
             }
             if(reaction.y > 0.0f)
             {
@@ -178,4 +244,6 @@ hero_physic()
             }
         }
     }
+
+    _hero_animate(dt);
 }
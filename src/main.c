@@ -24,7 +24,7 @@
 #include <errno.h>
 
 /* --- variables --- */
-static Kernel _kernel = {GAME_INIT, 0, FALSE, FALSE, 0};
+static Kernel _kernel = {GAME_INIT, 0, FALSE, FALSE, 0, 0, {NULL}, TICK_RATE, TICK_CATCH_UP, 0, 0};
 Kernel* kernel = &_kernel;
 
 static Console _console = {NULL, NULL, FALSE};
@@ -46,6 +46,56 @@ _nice(
     return TRUE;
 }
 
+/*
+ * _simulate:
+ *
+ * Runs the simulation by fixed ticks, as many as the time elapsed holds
+ * up to tick_catch_up, and hands the last one over to the renderer. So
+ * the game goes at the same pace whatever the frame rate. engine and ai
+ * keep their ENGINE_RATE, they run on the first tick of each of their
+ * periods.
+ */
+static gboolean
+_simulate(
+    gpointer        data
+    )
+{
+    gint64 current_time;
+    gint64 tick_length;
+    guint ticks;
+
+    current_time = g_get_monotonic_time();
+    tick_length = G_USEC_PER_SEC / kernel->tick_rate;
+    if(kernel->tick_time == 0)
+    {
+        kernel->tick_time = current_time - tick_length;
+    }
+
+    for(ticks = 0; kernel->tick_time + tick_length <= current_time; ticks++)
+    {
+        if(ticks == kernel->tick_catch_up)
+        {
+            /* too late, the time left is dropped instead of caught up */
+            kernel->tick_time = current_time - (current_time - kernel->tick_time) % tick_length;
+            break;
+        }
+        if(kernel->tick_time >= kernel->engine_time)
+        {
+            engine(NULL);
+            ai(NULL);
+            kernel->engine_time = MAX(kernel->engine_time + G_USEC_PER_SEC / ENGINE_RATE, kernel->tick_time);
+        }
+        physic(NULL);
+        kernel->tick_time += tick_length;
+    }
+
+    if(ticks > 0)
+    {
+        frame_publish();
+    }
+    return TRUE;
+}
+
 static gboolean
 _benchmark(
     gpointer        data
@@ -91,6 +141,8 @@ _game_init()
         "console_quit",
         (RGameCallback) _quit
         );
+    resources_init();
+    frame_init();
     r_game_signal_connect(
         "resource_manager_load",
         (RGameCallback) resources_load
@@ -104,10 +156,7 @@ _game_init()
         (RGameCallback) renderer_scene_render
         );
 
-    g_timeout_add(20, engine, NULL);
-    g_timeout_add(20, ai, NULL);
-    g_timeout_add(10, physic, NULL);
-
+    g_idle_add(_simulate, NULL);
     g_idle_add(_nice, NULL);
 
     _benchmark(NULL);
@@ -133,6 +182,8 @@ main(
     r_game_init(argc, argv);
     _game_init();
     r_game_main();
+    frame_destroy();
+    resources_destroy();
     g_message("Shutdown.");
     return 0;
 }
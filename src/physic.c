@@ -31,7 +31,7 @@ physic(
     switch(kernel->state)
     {
         case GAME_SCENE:
-            hero_physic();
+            hero_physic(1.0f / kernel->tick_rate);
             break;
     }
     return TRUE;
@@ -64,72 +64,86 @@ renderer_scene_setup()
 void
 renderer_scene_render()
 {
+    const Frame* frame;
+    const EntityAnimation* animation;
     float4x4 matrix;
+    RMesh* mesh;
+    gfloat alpha;
+    gfloat rotation;
+    gfloat anim_time;
     float3 p1 = {0.0f, 1.0f, 0.0f};
-    float3 p2 = {-hero->position.x, -hero->position.y, -hero->position.z};
+    float3 p2;
     float3 p3 = {0.0f, -0.4f, -2.0f};
+    guint i;
+
+    /* only the frame is read, the simulation goes on meanwhile */
+    frame = frame_get();
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    switch(kernel->state)
+    switch(frame->state)
     {
         case GAME_LOADING:
             r_renderer_begin_2D();
             glBegin(GL_QUADS);
             glVertex2i(50, 220);
-            glVertex2i(900 * resources_progress_bar_get() + 50, 220);
-            glVertex2i(900 * resources_progress_bar_get() + 50, 250);
+            glVertex2i(900 * frame->progress + 50, 220);
+            glVertex2i(900 * frame->progress + 50, 250);
             glVertex2i(50, 250);
             glEnd();
             r_renderer_end_2D();
             break;
 
         case GAME_SCENE:
-            if(hero->action != hero->last_action)
+            /* in between the last two ticks, an animation restarted is not blended */
+            alpha = frame_get_alpha(frame);
+            p2.x = -_LERP(frame->hero_last_position.x, frame->hero_position.x, alpha);
+            p2.y = -_LERP(frame->hero_last_position.y, frame->hero_position.y, alpha);
+            p2.z = -_LERP(frame->hero_last_position.z, frame->hero_position.z, alpha);
+            rotation = _LERP(frame->hero_last_rotation, frame->hero_rotation, alpha);
+            anim_time = frame->hero_anim_time;
+            if(frame->hero_last_anim_time <= anim_time)
             {
-                hero->mesh->anim_time = 0.0f;
-                hero->last_action = hero->action;
+                anim_time = _LERP(frame->hero_last_anim_time, anim_time, alpha);
             }
-            
-            glEnable(GL_LIGHTING);
 
-            if(hero->world_node != NULL)
-            {
-                r_matrix_identity_set(&matrix);
-                r_matrix_translate(&matrix, &p3);
-                r_matrix_rotate(&matrix, -hero->rotation, &p1);
-                r_matrix_translate(&matrix, &p2);
-                world_node_draw(&matrix, manor, hero->world_node);
-            }
+            glEnable(GL_LIGHTING);
 
             r_matrix_identity_set(&matrix);
             r_matrix_translate(&matrix, &p3);
-            r_matrix_rotate(&matrix, -90.0f, &p1);
-            if(hero->action == ENTITY_ACTION_NONE)
+            r_matrix_rotate(&matrix, -rotation, &p1);
+            r_matrix_translate(&matrix, &p2);
+            glLoadMatrixf((GLfloat*) &matrix);
+            for(i = 0; i < frame->visible->len; i++)
             {
-                hero->animating = r_mesh_draw_full(&matrix, hero->mesh, 0, 39, 9, TRUE);
+                r_mesh_draw(NULL, g_ptr_array_index(frame->visible, i));
             }
-            else if(hero->action == ENTITY_ACTION_RUNNING)
-            {
-                hero->animating = r_mesh_draw_full(&matrix, hero->mesh, 40, 45, 10, TRUE);
-            }
-            else if(hero->action == ENTITY_ACTION_JUMPING)
-            {
-                hero->animating = r_mesh_draw_full(&matrix, hero->mesh, 66, 71, 7, FALSE);
-            }
-            else if(hero->action == ENTITY_ACTION_FALLING)
+
+            /* the hero may have been changed since the frame was published */
+            mesh = r_resource_handle_get(frame->hero_mesh);
+            if(mesh != NULL)
             {
-                hero->animating = r_mesh_draw_full(&matrix, hero->mesh, 54,  57,  7, FALSE);
+                animation = &HeroAnimations[frame->hero_action];
+                r_matrix_identity_set(&matrix);
+                r_matrix_translate(&matrix, &p3);
+                r_matrix_rotate(&matrix, -90.0f, &p1);
+                r_mesh_draw_frame(
+                    &matrix,
+                    mesh,
+                    animation->frame_first,
+                    animation->frame_last,
+                    anim_time
+                    );
             }
             glDisable(GL_LIGHTING);
             
             r_renderer_begin_2D();
-            r_surface_draw(console->hud, 0, 0, 1000, 1000);
-            r_font_draw_string(console->font, 16, 992-16*4, 992-16, "DEMO");
-            if(console->mode)
+            r_surface_draw(frame->hud, 0, 0, 1000, 1000);
+            r_font_draw_string(frame->font, 16, 992-16*4, 992-16, "DEMO");
+            if(frame->console_mode)
             {
                 glColor4f(0.0f, 0.0f, 0.0f, 1.0f);
-                r_console_draw(console->font, 0, 0, 1000, 1000);
+                r_console_draw(frame->font, 0, 0, 1000, 1000);
                 glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
             }
             r_renderer_end_2D();
@@ -22,293 +22,306 @@
 
 #include <globals.h>
 
-    const gchar* hero1_file_names[32] = 
-    {
-        // stand
-        PACKAGE_DATADIR "/alien/alien_000000.obj",
-        PACKAGE_DATADIR "/alien/alien_000004.obj",
-        PACKAGE_DATADIR "/alien/alien_000009.obj",
-        PACKAGE_DATADIR "/alien/alien_000014.obj",
-        PACKAGE_DATADIR "/alien/alien_000019.obj",
-        PACKAGE_DATADIR "/alien/alien_000024.obj",
-        PACKAGE_DATADIR "/alien/alien_000029.obj",
-        PACKAGE_DATADIR "/alien/alien_000034.obj",
-        PACKAGE_DATADIR "/alien/alien_000039.obj",
-        PACKAGE_DATADIR "/alien/alien_000044.obj",
-        PACKAGE_DATADIR "/alien/alien_000049.obj",
-        PACKAGE_DATADIR "/alien/alien_000054.obj",
-        PACKAGE_DATADIR "/alien/alien_000059.obj",
-        PACKAGE_DATADIR "/alien/alien_000064.obj",
-        PACKAGE_DATADIR "/alien/alien_000069.obj",
-        PACKAGE_DATADIR "/alien/alien_000074.obj",
-        PACKAGE_DATADIR "/alien/alien_000078.obj",
-        // run
-        PACKAGE_DATADIR "/alien/alien_000079.obj",
-        PACKAGE_DATADIR "/alien/alien_000084.obj",
-        PACKAGE_DATADIR "/alien/alien_000089.obj",
-        PACKAGE_DATADIR "/alien/alien_000094.obj",
-        PACKAGE_DATADIR "/alien/alien_000097.obj",
-        // jump
-        PACKAGE_DATADIR "/alien/alien_000098.obj",
-        PACKAGE_DATADIR "/alien/alien_000103.obj",
-        PACKAGE_DATADIR "/alien/alien_000108.obj",
-        PACKAGE_DATADIR "/alien/alien_000113.obj",
-        PACKAGE_DATADIR "/alien/alien_000118.obj",
-        PACKAGE_DATADIR "/alien/alien_000123.obj",
-        PACKAGE_DATADIR "/alien/alien_000128.obj",
-        PACKAGE_DATADIR "/alien/alien_000133.obj",
-        PACKAGE_DATADIR "/alien/alien_000136.obj",
-        NULL
-    };
+#define RESOURCES_MANIFEST  PACKAGE_DATADIR "/resources.manifest"
+
+/* --- types --- */
+typedef struct _ResourceEntry ResourceEntry;
+
+typedef void (*ResourceLoader)(RResourceManagerValue* value, ResourceEntry* entry);
+
+/* --- structures --- */
+struct _ResourceEntry
+{
+    ResourceLoader  loader;
+    gchar**         files;
+    gchar*          skin;
+    gchar*          data;
+    gchar*          link;
+    gdouble*        params;
+    gsize           params_count;
+};
+
+/* --- variables --- */
+static GHashTable* entries = NULL;
 
 /* --- functions --- */
-void
-resources_load_manor(
-    RResourceManagerValue* value
+static void
+_load_material(
+    RResourceManagerValue* value,
+    ResourceEntry* entry
     )
 {
-    if(g_str_equal(value->name, "meshes.manor"))
-    {
-        value->type = R_RESOURCE_CUSTOM;
-        value->data  = world_new(r_resource_ref("meshes.manor.data"));
-        value->custom_free_func = (GDestroyNotify)world_free;
-    } 
-    else if(g_str_equal(value->name, "meshes.manor.data"))
-    {
-        r_resource_meshgroup_load(
-            value,
-            PACKAGE_DATADIR "/manor.obj",
-            NULL
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.none"))
-    {
-        r_resource_material_load(
-            value,
-            NULL
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.ceramic"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/ceramic.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.stone"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/stone.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.wood"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/wood.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.wall"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/wall.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.brick"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/brick.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.roof"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/roof.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
-    else if(g_str_equal(value->name, "meshes.manor.concreate"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/concreate.tga"
-            );
-        r_resource_link(value, "meshes.manor");
-    }
+    r_resource_material_load(
+        value,
+        (entry->files != NULL) ? entry->files[0] : NULL
+        );
 }
 
-void
-resources_load_heroes(
-    RResourceManagerValue* value
+static void
+_load_mesh(
+    RResourceManagerValue* value,
+    ResourceEntry* entry
     )
 {
-    if(g_str_equal(value->name, "meshes.hero1"))
+    RMaterial* skin;
+
+    skin = (entry->skin != NULL) ? r_resource_ref(entry->skin) : NULL;
+    if(entry->files[0] != NULL && entry->files[1] != NULL)
     {
-        r_resource_mesh_load(
-            value,
-            PACKAGE_DATADIR "/blade.md2",
-            r_resource_ref("meshes.hero1.skin")
-            );
-/*
         r_resource_mesh_load_multiple(
             value,
-            hero1_file_names,
-            r_resource_ref("meshes.hero1.skin")
+            (const gchar**) entry->files,
+            skin
             );
-*/
     }
-    else if(g_str_equal(value->name, "meshes.hero1.skin"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/blade.tga"
-            );
-/*
-        r_resource_material_load(
-            value,
-            NULL
-            );
-        r_resource_link(value, "meshes.hero1");
-*/
-    }
-    else if(g_str_equal(value->name, "meshes.hero2"))
+    else
     {
         r_resource_mesh_load(
             value,
-            PACKAGE_DATADIR "/ladydeath.md2",
-            r_resource_ref("meshes.hero2.skin")
+            entry->files[0],
+            skin
             );
     }
-    else if(g_str_equal(value->name, "meshes.hero2.skin"))
-    {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/ladydeath.tga"
-            );
-        r_resource_link(value, "meshes.hero2");
-    }
-    else if(g_str_equal(value->name, "meshes.hero3"))
+}
+
+static void
+_load_meshgroup(
+    RResourceManagerValue* value,
+    ResourceEntry* entry
+    )
+{
+    r_resource_meshgroup_load(
+        value,
+        entry->files[0],
+        (entry->skin != NULL) ? r_resource_ref(entry->skin) : NULL
+        );
+}
+
+static void
+_load_surface(
+    RResourceManagerValue* value,
+    ResourceEntry* entry
+    )
+{
+    r_resource_surface_load(
+        value,
+        entry->files[0],
+        entry->params[0], entry->params[1], entry->params[2], entry->params[3]
+        );
+}
+
+static void
+_load_font(
+    RResourceManagerValue* value,
+    ResourceEntry* entry
+    )
+{
+    r_resource_font_load(
+        value,
+        entry->files[0],
+        (guint) entry->params[0], (guint) entry->params[1]
+        );
+}
+
+static void
+_load_world(
+    RResourceManagerValue* value,
+    ResourceEntry* entry
+    )
+{
+    ResourceEntry* data_entry;
+
+    /* the graph is baked next to the file of the mesh group */
+    data_entry = g_hash_table_lookup(entries, entry->data);
+    value->type = R_RESOURCE_CUSTOM;
+    value->data  = world_new(
+        r_resource_ref(entry->data),
+        (data_entry != NULL && data_entry->files != NULL) ? data_entry->files[0] : NULL
+        );
+    value->custom_free_func = (GDestroyNotify)world_free;
+}
+
+static void
+_entry_free(
+    gpointer data
+    )
+{
+    ResourceEntry* entry = data;
+
+    g_strfreev(entry->files);
+    g_free(entry->skin);
+    g_free(entry->data);
+    g_free(entry->link);
+    g_free(entry->params);
+    g_slice_free(ResourceEntry, entry);
+}
+
+/*
+ * _entry_new:
+ *
+ * Returns NULL if @group of @manifest misses a field needed by its type.
+ */
+static ResourceEntry*
+_entry_new(
+    GKeyFile* manifest,
+    const gchar* group
+    )
+{
+    static const struct
     {
-        r_resource_mesh_load(
-            value,
-            PACKAGE_DATADIR "/warrior.md2",
-            r_resource_ref("meshes.hero3.skin")
-            );
+        const gchar*    name;
+        ResourceLoader  loader;
+        gboolean        needs_file;
+        const gchar*    params;
+        gsize           params_count;
     }
-    else if(g_str_equal(value->name, "meshes.hero3.skin"))
+    types[] =
     {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/warrior.tga"
-            );
-        r_resource_link(value, "meshes.hero3");
-    }
-    else if(g_str_equal(value->name, "meshes.hero4"))
+        {"material",    _load_material,     FALSE,  NULL,           0},
+        {"mesh",        _load_mesh,         TRUE,   NULL,           0},
+        {"meshgroup",   _load_meshgroup,    TRUE,   NULL,           0},
+        {"surface",     _load_surface,      TRUE,   "rect",         4},
+        {"font",        _load_font,         TRUE,   "char_size",    2},
+        {"world",       _load_world,        FALSE,  NULL,           0}
+    };
+    ResourceEntry* entry;
+    gchar* type;
+    gchar* file_name;
+    guint i;
+
+    type = g_key_file_get_string(manifest, group, "type", NULL);
+    for(i = 0; i < G_N_ELEMENTS(types) && (type == NULL || !g_str_equal(type, types[i].name)); i++);
+    g_free(type);
+    if(i == G_N_ELEMENTS(types))
     {
-        r_resource_mesh_load(
-            value,
-            PACKAGE_DATADIR "/yoko.md2",
-            r_resource_ref("meshes.hero4.skin")
-            );
+        return NULL;
     }
-    else if(g_str_equal(value->name, "meshes.hero4.skin"))
+
+    entry = g_slice_new0(ResourceEntry);
+    entry->loader = types[i].loader;
+    entry->files = g_key_file_get_string_list(manifest, group, "file", NULL, NULL);
+    entry->skin = g_key_file_get_string(manifest, group, "skin", NULL);
+    entry->data = g_key_file_get_string(manifest, group, "data", NULL);
+    entry->link = g_key_file_get_string(manifest, group, "link", NULL);
+    if(types[i].params != NULL)
     {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/yoko.tga"
-            );
-        r_resource_link(value, "meshes.hero4");
+        entry->params = g_key_file_get_double_list(manifest, group, types[i].params, &entry->params_count, NULL);
     }
-    else if(g_str_equal(value->name, "meshes.hero5"))
+
+    if((types[i].needs_file && (entry->files == NULL || entry->files[0] == NULL)) ||
+        (entry->loader == _load_world && entry->data == NULL) ||
+        (entry->params_count < types[i].params_count))
     {
-        r_resource_mesh_load(
-            value,
-            PACKAGE_DATADIR "/hueteotl.md2",
-            r_resource_ref("meshes.hero5.skin")
-            );
+        _entry_free(entry);
+        return NULL;
     }
-    else if(g_str_equal(value->name, "meshes.hero5.skin"))
+
+    /* the files are relative to the data directory */
+    for(i = 0; entry->files != NULL && entry->files[i] != NULL; i++)
     {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/hueteotl.tga"
-            );
-        r_resource_link(value, "meshes.hero5");
+        file_name = g_build_filename(PACKAGE_DATADIR, entry->files[i], NULL);
+        g_free(entry->files[i]);
+        entry->files[i] = file_name;
     }
-    else if(g_str_equal(value->name, "meshes.hero6"))
+    return entry;
+}
+
+/**
+ * resources_init:
+ *
+ * Reads the resource manifest, from the mounted paks or the data
+ * directory, and declares to the resource manager what each resource
+ * loads so that its dependencies can be queued ahead. A missing or
+ * unreadable manifest is fatal.
+ **/
+void
+resources_init()
+{
+    GKeyFile* manifest;
+    ResourceEntry* entry;
+    GError* error = NULL;
+    gconstpointer data;
+    gsize length;
+    gchar** groups;
+    guint i;
+
+    entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _entry_free);
+
+    manifest = g_key_file_new();
+    if(r_pak_lookup(RESOURCES_MANIFEST, &data, &length, NULL))
     {
-        r_resource_mesh_load(
-            value,
-            PACKAGE_DATADIR "/slith.md2",
-            r_resource_ref("meshes.hero6.skin")
-            );
+        g_key_file_load_from_data(manifest, data, length, G_KEY_FILE_NONE, &error);
     }
-    else if(g_str_equal(value->name, "meshes.hero6.skin"))
+    else
     {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/slith.tga"
-            );
-        r_resource_link(value, "meshes.hero6");
+        g_key_file_load_from_file(manifest, RESOURCES_MANIFEST, G_KEY_FILE_NONE, &error);
     }
-    else if(g_str_equal(value->name, "meshes.hero7"))
+    if(error != NULL)
     {
-        r_resource_mesh_load(
-            value,
-            PACKAGE_DATADIR "/rhino.md2",
-            r_resource_ref("meshes.hero7.skin")
-            );
+        /* every resource is declared there, nothing would ever load */
+        g_error("%s: %s", RESOURCES_MANIFEST, error->message);
     }
-    else if(g_str_equal(value->name, "meshes.hero7.skin"))
+
+    groups = g_key_file_get_groups(manifest, NULL);
+    for(i = 0; groups[i] != NULL; i++)
     {
-        r_resource_material_load(
-            value,
-            PACKAGE_DATADIR "/rhino.tga"
-            );
-        r_resource_link(value, "meshes.hero7");
+        entry = _entry_new(manifest, groups[i]);
+        if(entry == NULL)
+        {
+            g_warning("%s: %s: invalid resource", RESOURCES_MANIFEST, groups[i]);
+            continue;
+        }
+        g_hash_table_insert(entries, g_strdup(groups[i]), entry);
+
+        if(entry->skin != NULL)
+        {
+            r_resource_depend(groups[i], entry->skin);
+        }
+        if(entry->data != NULL)
+        {
+            r_resource_depend(groups[i], entry->data);
+        }
+        if(entry->link != NULL)
+        {
+            r_resource_depend(entry->link, groups[i]);
+        }
     }
+    g_strfreev(groups);
+    g_key_file_free(manifest);
 }
 
+/**
+ * resources_destroy:
+ *
+ **/
 void
-resources_load_console(
-    RResourceManagerValue* value
-    )
+resources_destroy()
 {
-    if(g_str_equal(value->name, "console.hud"))
-    {
-        r_resource_surface_load(
-            value,
-            PACKAGE_DATADIR "/hud.tga",
-            0.0f/256.0f, 0.0f/256.0f, 256.0f/256.0f, 256.0f/256.0f
-            );
-    }
-    else if(g_str_equal(value->name, "console.font"))
-    {
-        r_resource_font_load(
-            value,
-            PACKAGE_DATADIR "/megatron.tga",
-            512.0f / 32.0f, 256.0f / 42.0f
-            );
-    }
+    g_hash_table_destroy(entries);
+    entries = NULL;
 }
 
+/**
+ * resources_load:
+ *
+ * Loads @value as described by its entry in the manifest. It may run on
+ * the loader threads, the entries are only read once parsed.
+ **/
 void
 resources_load(
     RResourceManagerValue* value
     )
 {
-    resources_load_manor(value);
-    resources_load_heroes(value);
-    resources_load_console(value);
+    ResourceEntry* entry;
+
+    entry = g_hash_table_lookup(entries, value->name);
+    if(entry == NULL)
+    {
+        return;
+    }
+    entry->loader(value, entry);
+    if(entry->link != NULL)
+    {
+        r_resource_link(value, entry->link);
+    }
 }
@@ -47,18 +47,20 @@ r_font_new_from_file(
     const gchar*            file_name
     )
 {
-    RImage* image;
     RFont* font;
+    GLuint texture;
+    gsize texture_size;
     
     g_assert(file_name != NULL);
     
-    image = r_image_new_from_file(file_name);
-    if(image == NULL)
+    texture = r_texture_new_from_file(file_name, GL_LINEAR, GL_LINEAR, FALSE, &texture_size);
+    if(texture == R_TEXTURE_NONE)
     {
         return NULL;
     }
     font = r_font_new();
-    font->texture = r_texture_new(image, GL_LINEAR, GL_LINEAR, FALSE, TRUE);
+    font->texture_size = texture_size;
+    font->texture = texture;
     return font;
 }
 
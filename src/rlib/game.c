@@ -29,6 +29,7 @@ struct __RGame
     Display*            display;
     XVisualInfo*        visual;
     guint               frame_time;
+    guint               frame_number;
 /* private */
     gboolean            mainloop_suspended;
     GMainLoop*          mainloop;
@@ -39,7 +40,7 @@ struct __RGame
 typedef struct __RGame _RGame;
 
 /* --- variables --- */
-static _RGame           self = {NULL, NULL, 0, TRUE, NULL, {0}, NULL, FALSE};
+static _RGame           self = {NULL, NULL, 0, 0, TRUE, NULL, {0}, NULL, FALSE};
 const RGame             game = (RGame)&self;
 static gshort           keyboard_keymap[256];
 const gint              visual_attributes[][16] =
@@ -21,8 +21,316 @@
  */
 
 #include <rlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+/* --- types --- */
+typedef struct __ImageCacheHeader _ImageCacheHeader;
+
+#define R_IMAGE_CACHE_MAGIC     0x474D4952
+#define R_IMAGE_CACHE_VERSION   3
+#define R_IMAGE_CACHE_SUFFIX    ".rimage"
+
+/* --- structures --- */
+struct __ImageCacheHeader
+{
+    guint32             magic;
+    guint32             version;
+    guint32             width;
+    guint32             height;
+    guint32             bytes_per_pixel;
+    guint32             levels_count;
+    guint64             source_mtime;
+    guint64             source_size;
+    guint8              digest[R_DIGEST_LENGTH];
+    guint32             reserved;
+};
 
 /* --- functions --- */
+/*
+ * _image_level_size:
+ *
+ */
+static gsize
+_image_level_size(
+    guint               width,
+    guint               height,
+    guint               bytes_per_pixel,
+    guint               level
+    )
+{
+    return (gsize) MAX(width >> level, 1) * MAX(height >> level, 1) * bytes_per_pixel;
+}
+
+/*
+ * _image_levels_count:
+ *
+ * Returns the number of levels of a full mipmap chain, down to 1x1.
+ */
+static guint
+_image_levels_count(
+    guint               width,
+    guint               height
+    )
+{
+    guint size;
+    guint result;
+
+    result = 1;
+    for(size = MAX(width, height); size > 1; size >>= 1)
+    {
+        result++;
+    }
+    return result;
+}
+
+/*
+ * _image_mipmap:
+ *
+ * Appends to the pixels of @image its whole mipmap chain, each level a
+ * box filter of the previous one. Odd sizes clamp the last column or row.
+ */
+static void
+_image_mipmap(
+    RImage*             image
+    )
+{
+    const guint8* src;
+    guint8* dst;
+    guint src_width, src_height;
+    guint width, height;
+    guint x0, x1, y0, y1;
+    guint levels_count;
+    guint bpp;
+    gsize size;
+    guint level, x, y, c;
+
+    bpp = image->bytes_per_pixel;
+    levels_count = _image_levels_count(image->width, image->height);
+    size = 0;
+    for(level = 0; level < levels_count; level++)
+    {
+        size += _image_level_size(image->width, image->height, bpp, level);
+    }
+    image->pixel_data = g_realloc(image->pixel_data, size);
+    image->levels_count = levels_count;
+
+    src = image->pixel_data;
+    src_width = image->width;
+    src_height = image->height;
+    for(level = 1; level < levels_count; level++)
+    {
+        dst = (guint8*) src + (gsize) src_width * src_height * bpp;
+        width = MAX(src_width >> 1, 1);
+        height = MAX(src_height >> 1, 1);
+        for(y = 0; y < height; y++)
+        {
+            y0 = MIN(y * 2, src_height - 1) * src_width;
+            y1 = MIN(y * 2 + 1, src_height - 1) * src_width;
+            for(x = 0; x < width; x++)
+            {
+                x0 = MIN(x * 2, src_width - 1);
+                x1 = MIN(x * 2 + 1, src_width - 1);
+                for(c = 0; c < bpp; c++)
+                {
+                    dst[(y * width + x) * bpp + c] = (
+                        src[(y0 + x0) * bpp + c] +
+                        src[(y0 + x1) * bpp + c] +
+                        src[(y1 + x0) * bpp + c] +
+                        src[(y1 + x1) * bpp + c] + 2) >> 2;
+                }
+            }
+        }
+        src = dst;
+        src_width = width;
+        src_height = height;
+    }
+}
+
+/*
+ * _image_cache_save:
+ *
+ * Writes @image, decoded from @file_name, to "<file_name>.rimage". The
+ * pixels are stored as they are uploaded, already flipped and in RGB(A)
+ * order, followed by their mipmaps.
+ */
+static gboolean
+_image_cache_save(
+    const gchar*        file_name,
+    RImage*             image
+    )
+{
+    _ImageCacheHeader header;
+    GByteArray* buffer;
+    struct stat st;
+    gchar* cache_name;
+    gsize size;
+    gboolean result;
+    guint i;
+
+    if(g_stat(file_name, &st) != 0)
+    {
+        return FALSE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = R_IMAGE_CACHE_MAGIC;
+    header.version = R_IMAGE_CACHE_VERSION;
+    header.width = image->width;
+    header.height = image->height;
+    header.bytes_per_pixel = image->bytes_per_pixel;
+    header.levels_count = image->levels_count;
+    header.source_mtime = st.st_mtime;
+    header.source_size = st.st_size;
+
+    size = 0;
+    for(i = 0; i < image->levels_count; i++)
+    {
+        size += r_image_get_level_size(image, i);
+    }
+    r_digest_data(image->pixel_data, size, header.digest);
+    buffer = g_byte_array_sized_new(sizeof(header) + size);
+    g_byte_array_append(buffer, (guint8*) &header, sizeof(header));
+    g_byte_array_append(buffer, image->pixel_data, size);
+
+    cache_name = g_strconcat(file_name, R_IMAGE_CACHE_SUFFIX, NULL);
+    result = g_file_set_contents(cache_name, (gchar*) buffer->data, buffer->len, NULL);
+#ifdef DEBUG
+    if(!result)
+    {
+        g_debug("Unable to write image cache %s", cache_name);
+    }
+#endif
+    g_free(cache_name);
+    g_byte_array_free(buffer, TRUE);
+    return result;
+}
+
+/*
+ * _image_cache_get_header:
+ *
+ * Reads only the header of the cache of @file_name, from the mounted paks
+ * or the file system, and returns TRUE when it is up to date. A cache
+ * whose source is not shipped is taken as it is.
+ */
+static gboolean
+_image_cache_get_header(
+    const gchar*        file_name,
+    _ImageCacheHeader*  header
+    )
+{
+    gconstpointer data;
+    gsize length;
+    struct stat st;
+    gchar* cache_name;
+    FILE* stream;
+    gboolean result;
+
+    cache_name = g_strconcat(file_name, R_IMAGE_CACHE_SUFFIX, NULL);
+    if(r_pak_lookup(cache_name, &data, &length, NULL))
+    {
+        result = length >= sizeof(_ImageCacheHeader);
+        if(result)
+        {
+            memcpy(header, data, sizeof(_ImageCacheHeader));
+        }
+    }
+    else
+    {
+        stream = fopen(cache_name, "rb");
+        result = stream != NULL && fread(header, sizeof(_ImageCacheHeader), 1, stream) == 1;
+        if(stream != NULL)
+        {
+            fclose(stream);
+        }
+    }
+    g_free(cache_name);
+
+    return result &&
+        header->magic == R_IMAGE_CACHE_MAGIC &&
+        header->version == R_IMAGE_CACHE_VERSION &&
+        (g_stat(file_name, &st) != 0 || (header->source_mtime == (guint64) st.st_mtime && header->source_size == (guint64) st.st_size));
+}
+
+/*
+ * _image_cache_load:
+ *
+ * Reads "<file_name>.rimage", from the mounted paks or the file system,
+ * or returns NULL when it is missing, from another version, or older than
+ * its source.
+ */
+static RImage*
+_image_cache_load(
+    const gchar*        file_name
+    )
+{
+    _ImageCacheHeader header;
+    GMappedFile* mapping;
+    gconstpointer data;
+    gsize length;
+    struct stat st;
+    gchar* cache_name;
+    RImage* image;
+    gsize size;
+    guint i;
+
+    cache_name = g_strconcat(file_name, R_IMAGE_CACHE_SUFFIX, NULL);
+    if(r_pak_lookup(cache_name, &data, &length, &mapping))
+    {
+        g_mapped_file_ref(mapping);
+    }
+    else
+    {
+        mapping = g_mapped_file_new(cache_name, FALSE, NULL);
+        if(mapping != NULL)
+        {
+            data = g_mapped_file_get_contents(mapping);
+            length = g_mapped_file_get_length(mapping);
+        }
+    }
+    g_free(cache_name);
+    if(mapping == NULL)
+    {
+        return NULL;
+    }
+
+    size = 0;
+    if(length >= sizeof(header))
+    {
+        memcpy(&header, data, sizeof(header));
+        if(header.magic == R_IMAGE_CACHE_MAGIC &&
+            header.version == R_IMAGE_CACHE_VERSION &&
+            header.width > 0 && header.height > 0 &&
+            (header.bytes_per_pixel == 3 || header.bytes_per_pixel == 4) &&
+            header.levels_count > 0 &&
+            header.levels_count <= _image_levels_count(header.width, header.height) &&
+            (g_stat(file_name, &st) != 0 || (header.source_mtime == (guint64) st.st_mtime && header.source_size == (guint64) st.st_size)))
+        {
+            for(i = 0; i < header.levels_count; i++)
+            {
+                size += _image_level_size(header.width, header.height, header.bytes_per_pixel, i);
+            }
+        }
+    }
+    if(size == 0 || size != length - sizeof(header))
+    {
+        g_mapped_file_unref(mapping);
+        return NULL;
+    }
+
+    image = g_slice_new0(RImage);
+    image->width = header.width;
+    image->height = header.height;
+    image->bytes_per_pixel = header.bytes_per_pixel;
+    image->levels_count = header.levels_count;
+    image->pixel_data = g_malloc(size);
+    memcpy(image->pixel_data, (const guint8*) data + sizeof(header), size);
+    g_mapped_file_unref(mapping);
+    return image;
+}
+
 /**
  * r_image_new
  * 
@@ -40,6 +348,7 @@ r_image_new(
     image->width = width;
     image->height = height;
     image->bytes_per_pixel = bytes_per_pixel;
+    image->levels_count = 1;
     image->pixel_data = g_new0(guint8, width * height * bytes_per_pixel); 
     return image;
 }
@@ -47,15 +356,24 @@ r_image_new(
 /**
  * r_image_new_from_file:
  *
+ * Reads the image baked by r_image_bake() when it is up to date, then
+ * @file_name through its module.
  **/
 RImage*
 r_image_new_from_file(
     const gchar*      file_name
     )
 {
+    RImage* image;
+
     g_assert(file_name != NULL);
 
-    return (RImage*) r_modules_lookup(file_name)->load_from_file(file_name);
+    image = _image_cache_load(file_name);
+    if(image == NULL)
+    {
+        image = (RImage*) r_modules_load(file_name);
+    }
+    return image;
 }
 
 /**
@@ -72,3 +390,93 @@ r_image_free(
     g_free(image->pixel_data);
     g_slice_free(RImage, image);
 }
+
+/**
+ * r_image_fingerprint:
+ *
+ * Feeds to @checksum what identifies the pixels of the image @file_name:
+ * the digest stored in its up to date .rimage cache, else the contents of
+ * the source. Returns FALSE if neither is found.
+ **/
+gboolean
+r_image_fingerprint(
+    const gchar*    file_name,
+    GChecksum*      checksum
+    )
+{
+    _ImageCacheHeader header;
+
+    g_assert(file_name != NULL);
+    g_assert(checksum != NULL);
+
+    if(_image_cache_get_header(file_name, &header))
+    {
+        g_checksum_update(checksum, header.digest, sizeof(header.digest));
+        g_checksum_update(checksum, (const guchar*) &header.width, 4 * sizeof(guint32));
+        return TRUE;
+    }
+    return r_pak_checksum(file_name, checksum);
+}
+
+/**
+ * r_image_get_level_size:
+ *
+ * Returns the size in bytes of the mipmap @level of @image.
+ **/
+gsize
+r_image_get_level_size(
+    RImage*     image,
+    guint       level
+    )
+{
+    g_assert(image != NULL);
+
+    return _image_level_size(image->width, image->height, image->bytes_per_pixel, level);
+}
+
+/**
+ * r_image_bake:
+ *
+ * Decodes @file_name through its module, builds its mipmaps and writes its
+ * .rimage cache, ready to be uploaded as it is. Neither GL nor the
+ * resource manager is touched. Returns FALSE if the source can't be loaded
+ * or the cache can't be written.
+ **/
+gboolean
+r_image_bake(
+    const gchar*    file_name
+    )
+{
+    RImage* image;
+    gboolean result;
+
+    g_assert(file_name != NULL);
+
+    image = r_modules_lookup(file_name)->load_from_file(file_name);
+    if(image == NULL)
+    {
+        return FALSE;
+    }
+    _image_mipmap(image);
+    result = _image_cache_save(file_name, image);
+    r_image_free(image);
+    return result;
+}
+
+/**
+ * r_image_bake_is_fresh:
+ *
+ * Returns TRUE when the .rimage cache of @file_name is up to date.
+ **/
+gboolean
+r_image_bake_is_fresh(
+    const gchar*    file_name
+    )
+{
+    _ImageCacheHeader header;
+    struct stat st;
+
+    g_assert(file_name != NULL);
+
+    return g_stat(file_name, &st) == 0 && _image_cache_get_header(file_name, &header);
+}
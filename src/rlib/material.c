@@ -52,17 +52,19 @@ r_material_new_from_file(
     )
 {
     RMaterial* material;
-    RImage* image;
+    GLuint texture;
+    gsize texture_size;
     
     g_assert(file_name != NULL);
     
-    image = r_image_new_from_file(file_name);
-    if(image == NULL)
+    texture = r_texture_new_from_file(file_name, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, TRUE, &texture_size);
+    if(texture == R_TEXTURE_NONE)
     {
         return NULL;
     }
     material = r_material_new();
-    material->texture = r_texture_new(image, GL_LINEAR, GL_LINEAR, TRUE, TRUE);
+    material->texture_size = texture_size;
+    material->texture = texture;
     return material;
 }
 
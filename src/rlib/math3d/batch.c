@@ -0,0 +1,139 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ *      batch.c
+ *
+ *      Copyright 2008 Romuald Rousseau <romualdrousseau@msn.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <rlib.h>
+
+/* --- functions --- */
+/**
+ * r_math_transform_points:
+ *
+ * Transforms count points by the matrix m, 4 points per iteration. The SSE
+ * path loads 4 packed float3 as 3 vectors, transposes them to x/y/z lanes,
+ * transforms and transposes back. result may alias points.
+ **/
+void
+r_math_transform_points(
+    float4x4*       m,
+    const float3*   points,
+    float3*         result,
+    guint           count
+    )
+{
+    guint i = 0;
+#if defined(__SSE__)
+    __m128 m00, m01, m02, m10, m11, m12, m20, m21, m22, m30, m31, m32;
+    __m128 a, b, c, x, y, z, rx, ry, rz, t0, t1;
+
+    g_assert(m != NULL);
+
+    m00 = _mm_set1_ps(m->m00); m01 = _mm_set1_ps(m->m01); m02 = _mm_set1_ps(m->m02);
+    m10 = _mm_set1_ps(m->m10); m11 = _mm_set1_ps(m->m11); m12 = _mm_set1_ps(m->m12);
+    m20 = _mm_set1_ps(m->m20); m21 = _mm_set1_ps(m->m21); m22 = _mm_set1_ps(m->m22);
+    m30 = _mm_set1_ps(m->m30); m31 = _mm_set1_ps(m->m31); m32 = _mm_set1_ps(m->m32);
+
+    for(; i + 4 <= count; i += 4)
+    {
+        /* (x0 y0 z0 x1) (y1 z1 x2 y2) (z2 x3 y3 z3) */
+        a = _mm_loadu_ps(&points[i].x);
+        b = _mm_loadu_ps(&points[i].x + 4);
+        c = _mm_loadu_ps(&points[i].x + 8);
+
+        t0 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+        x = _mm_shuffle_ps(a, t0, _MM_SHUFFLE(2, 0, 3, 0));
+        t0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+        t1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+        y = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+        t0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+        t1 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+        z = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+
+        rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_mul_ps(z, m20)), m30);
+        ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_mul_ps(z, m21)), m31);
+        rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_mul_ps(z, m22)), m32);
+
+        t0 = _mm_shuffle_ps(rx, ry, _MM_SHUFFLE(0, 0, 0, 0));
+        t1 = _mm_shuffle_ps(rz, rx, _MM_SHUFFLE(1, 1, 0, 0));
+        a = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+        t0 = _mm_shuffle_ps(ry, rz, _MM_SHUFFLE(1, 1, 1, 1));
+        t1 = _mm_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 2, 2, 2));
+        b = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+        t0 = _mm_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 3, 2, 2));
+        t1 = _mm_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 3, 3, 3));
+        c = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+
+        _mm_storeu_ps(&result[i].x, a);
+        _mm_storeu_ps(&result[i].x + 4, b);
+        _mm_storeu_ps(&result[i].x + 8, c);
+    }
+#else
+    g_assert(m != NULL);
+#endif
+
+    for(; i < count; i++)
+    {
+        float3 p = points[i];
+        mul3(&p, m, &result[i]);
+    }
+}
+
+/**
+ * r_math_lerp_array:
+ *
+ * Linear interpolation of count floats, 8 (AVX) or 4 (SSE) lanes at a time.
+ * Uses a + (b - a) * t so components equal in a and b are kept exactly.
+ **/
+void
+r_math_lerp_array(
+    const float*    a,
+    const float*    b,
+    float           t,
+    float*          result,
+    guint           count
+    )
+{
+    guint i = 0;
+#if defined(__AVX__)
+    __m256 t8 = _mm256_set1_ps(t);
+    __m256 a8;
+
+    for(; i + 8 <= count; i += 8)
+    {
+        a8 = _mm256_loadu_ps(&a[i]);
+        _mm256_storeu_ps(&result[i], _mm256_add_ps(a8, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&b[i]), a8), t8)));
+    }
+#endif
+#if defined(__SSE__)
+    __m128 t4 = _mm_set1_ps(t);
+    __m128 a4;
+
+    for(; i + 4 <= count; i += 4)
+    {
+        a4 = _mm_loadu_ps(&a[i]);
+        _mm_storeu_ps(&result[i], _mm_add_ps(a4, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&b[i]), a4), t4)));
+    }
+#endif
+
+    for(; i < count; i++)
+    {
+        result[i] = a[i] + (b[i] - a[i]) * t;
+    }
+}
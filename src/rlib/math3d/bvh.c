@@ -0,0 +1,249 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ *      bvh.c
+ *
+ *      Copyright 2008 Romuald Rousseau <romualdrousseau@msn.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <rlib.h>
+
+#define BVH_LEAF_SIZE   4
+#define BVH_STACK_SIZE  64
+
+/* --- types --- */
+typedef struct __BVHBuilder _BVHBuilder;
+
+/* --- structures --- */
+struct __BVHBuilder
+{
+    float3*     bboxes;
+    GArray*     nodes;
+    guint*      indices;
+    gint        axis;
+};
+
+/* --- functions --- */
+/*
+ * _bvh_compare_centers:
+ *
+ */
+static gint
+_bvh_compare_centers(
+    gconstpointer   a,
+    gconstpointer   b,
+    gpointer        user_data
+    )
+{
+    _BVHBuilder* builder = user_data;
+    const float* c1 = &builder->bboxes[*(const guint*) a * 2].x;
+    const float* c2 = &builder->bboxes[*(const guint*) b * 2].x;
+
+    return (c1[builder->axis] > c2[builder->axis]) ? +1 : ((c1[builder->axis] < c2[builder->axis]) ? -1 : 0);
+}
+
+/*
+ * _bvh_build:
+ *
+ * Builds the subtree of indices[first..first+count[ depth first; the left
+ * child of a node is always the next node, offset is the right child of an
+ * internal node or the first index of a leaf.
+ */
+static guint
+_bvh_build(
+    _BVHBuilder*    builder,
+    guint           first,
+    guint           count
+    )
+{
+    RBVHNode node;
+    float3 min, max;
+    float3 cmin, cmax;
+    float3* b;
+    guint node_index;
+    guint i;
+
+    b = &builder->bboxes[builder->indices[first] * 2];
+    min.x = b[0].x - b[1].x; max.x = b[0].x + b[1].x;
+    min.y = b[0].y - b[1].y; max.y = b[0].y + b[1].y;
+    min.z = b[0].z - b[1].z; max.z = b[0].z + b[1].z;
+    cmin = cmax = b[0];
+    for(i = first + 1; i < first + count; i++)
+    {
+        b = &builder->bboxes[builder->indices[i] * 2];
+        min.x = MIN(min.x, b[0].x - b[1].x); max.x = MAX(max.x, b[0].x + b[1].x);
+        min.y = MIN(min.y, b[0].y - b[1].y); max.y = MAX(max.y, b[0].y + b[1].y);
+        min.z = MIN(min.z, b[0].z - b[1].z); max.z = MAX(max.z, b[0].z + b[1].z);
+        cmin.x = MIN(cmin.x, b[0].x); cmax.x = MAX(cmax.x, b[0].x);
+        cmin.y = MIN(cmin.y, b[0].y); cmax.y = MAX(cmax.y, b[0].y);
+        cmin.z = MIN(cmin.z, b[0].z); cmax.z = MAX(cmax.z, b[0].z);
+    }
+
+    node.bbox[0].x = (max.x + min.x) * 0.5f;
+    node.bbox[0].y = (max.y + min.y) * 0.5f;
+    node.bbox[0].z = (max.z + min.z) * 0.5f;
+    /* padded so the center/extent rounding never shrinks the bounds */
+    node.bbox[1].x = (max.x - min.x) * 0.5f + EPSILON;
+    node.bbox[1].y = (max.y - min.y) * 0.5f + EPSILON;
+    node.bbox[1].z = (max.z - min.z) * 0.5f + EPSILON;
+    node.offset = first;
+    node.count = count;
+
+    node_index = builder->nodes->len;
+    g_array_append_val(builder->nodes, node);
+
+    if(count <= BVH_LEAF_SIZE)
+    {
+        return node_index;
+    }
+
+    /* split at the median center along the longest axis of the centers */
+    cmax.x -= cmin.x;
+    cmax.y -= cmin.y;
+    cmax.z -= cmin.z;
+    if(cmax.x >= cmax.y && cmax.x >= cmax.z)
+    {
+        builder->axis = 0;
+    }
+    else if(cmax.y >= cmax.z)
+    {
+        builder->axis = 1;
+    }
+    else
+    {
+        builder->axis = 2;
+    }
+    g_qsort_with_data(&builder->indices[first], count, sizeof(guint), _bvh_compare_centers, builder);
+
+    _bvh_build(builder, first, count / 2);
+    i = _bvh_build(builder, first + count / 2, count - count / 2);
+
+    g_array_index(builder->nodes, RBVHNode, node_index).offset = i;
+    g_array_index(builder->nodes, RBVHNode, node_index).count = 0;
+    return node_index;
+}
+
+/**
+ * r_bvh_new:
+ *
+ * Builds an AABB tree over count bboxes (center/extent pairs). Queries
+ * report the position of the bboxes in that array.
+ **/
+RBVH*
+r_bvh_new(
+    float3*     bboxes,
+    guint       count
+    )
+{
+    _BVHBuilder builder;
+    RBVH* bvh;
+    guint i;
+
+    g_assert(bboxes != NULL || count == 0);
+
+    bvh = g_slice_new0(RBVH);
+    bvh->indices_count = count;
+    bvh->indices = g_new(guint, count);
+    for(i = 0; i < count; i++)
+    {
+        bvh->indices[i] = i;
+    }
+
+    if(count > 0)
+    {
+        builder.bboxes = bboxes;
+        builder.nodes = g_array_sized_new(FALSE, FALSE, sizeof(RBVHNode), 2 * (count / BVH_LEAF_SIZE) + 1);
+        builder.indices = bvh->indices;
+        builder.axis = 0;
+        _bvh_build(&builder, 0, count);
+
+        bvh->nodes_count = builder.nodes->len;
+        bvh->nodes = (RBVHNode*) g_array_free(builder.nodes, FALSE);
+    }
+
+    return bvh;
+}
+
+/**
+ * r_bvh_free:
+ *
+ **/
+void
+r_bvh_free(
+    RBVH*       bvh
+    )
+{
+    if(bvh != NULL)
+    {
+        g_free(bvh->nodes);
+        g_free(bvh->indices);
+        g_slice_free(RBVH, bvh);
+    }
+}
+
+/**
+ * r_bvh_query:
+ *
+ * Calls callback for every bbox stored in a leaf overlapping bbox; this is
+ * a superset of the bboxes overlapping it, callers do the exact test.
+ **/
+void
+r_bvh_query(
+    RBVH*       bvh,
+    float3*     bbox,
+    RBVHCallback callback,
+    gpointer    user_data
+    )
+{
+    guint stack[BVH_STACK_SIZE];
+    guint top = 0;
+    RBVHNode* node;
+    guint i;
+
+    g_assert(bvh != NULL);
+    g_assert(bbox != NULL);
+    g_assert(callback != NULL);
+
+    if(bvh->nodes_count == 0)
+    {
+        return;
+    }
+
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        node = &bvh->nodes[stack[--top]];
+        if(!r_bbox_overlap(node->bbox, bbox))
+        {
+            continue;
+        }
+
+        if(node->count > 0)
+        {
+            for(i = node->offset; i < node->offset + node->count; i++)
+            {
+                callback(bvh->indices[i], user_data);
+            }
+        }
+        else
+        {
+            g_assert(top + 2 <= BVH_STACK_SIZE);
+            stack[top++] = node->offset;
+            stack[top++] = (node - bvh->nodes) + 1;
+        }
+    }
+}
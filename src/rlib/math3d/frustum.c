@@ -22,48 +22,70 @@
 
 #include <rlib.h>
 
-/* --- variables --- */
-static float frustum[6][4];
-
 /* --- functions --- */
+/*
+ * _frustum_plane_set:
+ *
+ * Builds the plane column3 + sign * column and normalizes it so distances
+ * are euclidean (required by the bounding sphere test).
+ */
+static inline void
+_frustum_plane_set(
+    float4*     plane,
+    float4x4*   m,
+    gint        column,
+    float       sign
+    )
+{
+    const float* c = &m->m00 + column;
+    float l;
+
+    plane->x = m->m03 + sign * c[0];
+    plane->y = m->m13 + sign * c[4];
+    plane->z = m->m23 + sign * c[8];
+    plane->w = m->m33 + sign * c[12];
+
+    l = _INV_SQRT(_SQR(plane->x) + _SQR(plane->y) + _SQR(plane->z));
+    plane->x *= l;
+    plane->y *= l;
+    plane->z *= l;
+    plane->w *= l;
+}
+
 /**
- * frustum_update_projection:
+ * r_frustum_set:
  *
+ * Extracts the world space planes of view x projection. The frustum is a
+ * plain value so each view (or thread) can own its own.
  **/
-void
-r_frustum_update_projection(
+RFrustum*
+r_frustum_set(
+    RFrustum*   frustum,
+    float4x4*   view,
     float4x4*   projection
     )
 {
-    frustum[0][0] = projection->m03 - projection->m00;
-    frustum[0][1] = projection->m13 - projection->m10;
-    frustum[0][2] = projection->m23 - projection->m20;
-    frustum[0][3] = projection->m33 - projection->m30;
-    
-    frustum[1][0] = projection->m03 + projection->m00;
-    frustum[1][1] = projection->m13 + projection->m10;
-    frustum[1][2] = projection->m23 + projection->m20;
-    frustum[1][3] = projection->m33 + projection->m30;
-    
-    frustum[2][0] = projection->m03 + projection->m01;
-    frustum[2][1] = projection->m13 + projection->m11;
-    frustum[2][2] = projection->m23 + projection->m21;
-    frustum[2][3] = projection->m33 + projection->m31;
-    
-    frustum[3][0] = projection->m03 - projection->m01;
-    frustum[3][1] = projection->m13 - projection->m11;
-    frustum[3][2] = projection->m23 - projection->m21;
-    frustum[3][3] = projection->m33 - projection->m31;
-    
-    frustum[4][0] = projection->m03 - projection->m02;
-    frustum[4][1] = projection->m13 - projection->m12;
-    frustum[4][2] = projection->m23 - projection->m22;
-    frustum[4][3] = projection->m33 - projection->m32;
-    
-    frustum[4][0] = projection->m03 + projection->m02;
-    frustum[5][1] = projection->m13 + projection->m12;
-    frustum[5][2] = projection->m23 + projection->m22;
-    frustum[5][3] = projection->m33 + projection->m32;
+    float4x4 m;
+
+    g_assert(frustum != NULL);
+    g_assert(projection != NULL);
+
+    if(view != NULL)
+    {
+        mul4x4(view, projection, &m);
+    }
+    else
+    {
+        m = *projection;
+    }
+
+    _frustum_plane_set(&frustum->planes[R_FRUSTUM_RIGHT], &m, 0, -1.0f);
+    _frustum_plane_set(&frustum->planes[R_FRUSTUM_LEFT], &m, 0, +1.0f);
+    _frustum_plane_set(&frustum->planes[R_FRUSTUM_BOTTOM], &m, 1, +1.0f);
+    _frustum_plane_set(&frustum->planes[R_FRUSTUM_TOP], &m, 1, -1.0f);
+    _frustum_plane_set(&frustum->planes[R_FRUSTUM_FAR], &m, 2, -1.0f);
+    _frustum_plane_set(&frustum->planes[R_FRUSTUM_NEAR], &m, 2, +1.0f);
+    return frustum;
 }
 
 /**
@@ -72,89 +94,187 @@ r_frustum_update_projection(
  **/
 gboolean
 r_frustum_test_point(
-    float4x4*   view,
+    RFrustum*   frustum,
     float3*     point
     )
 {
-    // Not implemented
-    return FALSE;
+    float4* plane;
+
+    g_assert(frustum != NULL);
+    g_assert(point != NULL);
+
+    for(plane = &frustum->planes[0]; plane < &frustum->planes[6]; plane++)
+    {
+        if(dot3(point, (float3*) plane) + plane->w < 0.0f)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
 /**
  * r_frustum_test_bsphere:
  *
+ * bsphere is the center in xyz and the radius in w.
  **/
 gboolean
 r_frustum_test_bsphere(
-    float4x4*   view,
-    float3*     bshere
+    RFrustum*   frustum,
+    float4*     bsphere
     )
 {
-    // Not implemented
-    return FALSE;
+    float4* plane;
+
+    g_assert(frustum != NULL);
+    g_assert(bsphere != NULL);
+
+    for(plane = &frustum->planes[0]; plane < &frustum->planes[6]; plane++)
+    {
+        if(dot3((float3*) bsphere, (float3*) plane) + plane->w < -bsphere->w)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
 /**
- * frustum_test_bbox:
+ * r_frustum_test_bbox:
  *
  **/
 gboolean
 r_frustum_test_bbox(
-    float4x4*   view,
+    RFrustum*   frustum,
     float3*     bbox
     )
 {
-    float3 p;
-    float3 rbbox[8];
-    int i, j;
-    int r = 0;
-    float* plane;
-    
-    p.x = bbox[0].x - bbox[1].x;
-    p.y = bbox[0].y + bbox[1].y;
-    p.z = bbox[0].z + bbox[1].z;
-    mul3(&p, view, &rbbox[0]);
-    p.x = bbox[0].x + bbox[1].x;
-    p.y = bbox[0].y + bbox[1].y;
-    p.z = bbox[0].z + bbox[1].z;
-    mul3(&p, view, &rbbox[1]);
-    p.x = bbox[0].x + bbox[1].x;
-    p.y = bbox[0].y - bbox[1].y;
-    p.z = bbox[0].z + bbox[1].z;
-    mul3(&p, view, &rbbox[2]);
-    p.x = bbox[0].x - bbox[1].x;
-    p.y = bbox[0].y - bbox[1].y;
-    p.z = bbox[0].z + bbox[1].z;
-    mul3(&p, view, &rbbox[3]);
-    p.x = bbox[0].x - bbox[1].x;
-    p.y = bbox[0].y + bbox[1].y;
-    p.z = bbox[0].z - bbox[1].z;
-    mul3(&p, view, &rbbox[4]);
-    p.x = bbox[0].x + bbox[1].x;
-    p.y = bbox[0].y + bbox[1].y;
-    p.z = bbox[0].z - bbox[1].z;
-    mul3(&p, view, &rbbox[5]);
-    p.x = bbox[0].x + bbox[1].x;
-    p.y = bbox[0].y - bbox[1].y;
-    p.z = bbox[0].z - bbox[1].z;
-    mul3(&p, view, &rbbox[6]);
-    p.x = bbox[0].x - bbox[1].x;
-    p.y = bbox[0].y - bbox[1].y;
-    p.z = bbox[0].z - bbox[1].z;
-    mul3(&p, view, &rbbox[7]);
+    guint plane_mask = R_FRUSTUM_ALL_PLANES;
+
+    return r_frustum_test_bbox_masked(frustum, bbox, &plane_mask);
+}
+
+/**
+ * r_frustum_test_bbox_masked:
+ *
+ * Center/extent test of the bbox against the planes set in plane_mask. On
+ * return plane_mask only keeps the planes the bbox straddles, so a bbox
+ * nested in this one can start from it; 0 means fully inside.
+ **/
+gboolean
+r_frustum_test_bbox_masked(
+    RFrustum*   frustum,
+    float3*     bbox,
+    guint*      plane_mask
+    )
+{
+    float4* plane;
+    float d;
+    float r;
+    guint i;
+
+    g_assert(frustum != NULL);
+    g_assert(bbox != NULL);
+    g_assert(plane_mask != NULL);
 
     for(i = 0; i < 6; i++)
     {
-        plane = frustum[i];
-        for(j = 0; j < 8; j++)
+        if(!(*plane_mask & (1 << i)))
+        {
+            continue;
+        }
+
+        plane = &frustum->planes[i];
+        d = dot3(&bbox[0], (float3*) plane) + plane->w;
+        r = bbox[1].x * _ABS(plane->x) + bbox[1].y * _ABS(plane->y) + bbox[1].z * _ABS(plane->z);
+        if(d + r < 0.0f)
         {
-            if(plane[0] * rbbox[j].x + plane[1] * rbbox[j].y + plane[2] * rbbox[j].z + plane[3] > 0.0f)
+            return FALSE;
+        }
+        if(d - r >= 0.0f)
+        {
+            *plane_mask &= ~(1 << i);
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * r_frustum_cull_bboxes:
+ *
+ * Tests count bboxes (center/extent pairs) against the planes set in
+ * plane_mask, 4 at a time with SSE. Fills visibility and returns the number
+ * of visible bboxes.
+ **/
+guint
+r_frustum_cull_bboxes(
+    RFrustum*   frustum,
+    float3*     bboxes,
+    guint       count,
+    guint       plane_mask,
+    gboolean*   visibility
+    )
+{
+    guint visible = 0;
+    guint mask;
+    guint i = 0;
+#if defined(__SSE__)
+    const __m128 zero = _mm_setzero_ps();
+    __m128 cx, cy, cz, ex, ey, ez, d, r, outside;
+    float4* plane;
+    float3* b;
+    gint k;
+    guint j;
+#endif
+
+    g_assert(frustum != NULL);
+    g_assert(bboxes != NULL || count == 0);
+    g_assert(visibility != NULL || count == 0);
+
+#if defined(__SSE__)
+    for(; i + 4 <= count; i += 4)
+    {
+        b = &bboxes[i * 2];
+        cx = _mm_setr_ps(b[0].x, b[2].x, b[4].x, b[6].x);
+        cy = _mm_setr_ps(b[0].y, b[2].y, b[4].y, b[6].y);
+        cz = _mm_setr_ps(b[0].z, b[2].z, b[4].z, b[6].z);
+        ex = _mm_setr_ps(b[1].x, b[3].x, b[5].x, b[7].x);
+        ey = _mm_setr_ps(b[1].y, b[3].y, b[5].y, b[7].y);
+        ez = _mm_setr_ps(b[1].z, b[3].z, b[5].z, b[7].z);
+
+        outside = zero;
+        for(j = 0; j < 6; j++)
+        {
+            if(!(plane_mask & (1 << j)))
             {
-                r |= (1 << i);
-                break;
+                continue;
             }
+
+            plane = &frustum->planes[j];
+            d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane->x)), _mm_mul_ps(cy, _mm_set1_ps(plane->y))),
+                _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane->z)), _mm_set1_ps(plane->w)));
+            r = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(_ABS(plane->x))), _mm_mul_ps(ey, _mm_set1_ps(_ABS(plane->y)))),
+                _mm_mul_ps(ez, _mm_set1_ps(_ABS(plane->z))));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+        }
+
+        k = _mm_movemask_ps(outside);
+        for(j = 0; j < 4; j++)
+        {
+            visibility[i + j] = (k & (1 << j)) ? FALSE : TRUE;
+            visible += visibility[i + j];
         }
     }
-    
-    return ((r & 0x3F) == 0x3F) ? TRUE : FALSE;
+#endif
+
+    for(; i < count; i++)
+    {
+        mask = plane_mask;
+        visibility[i] = r_frustum_test_bbox_masked(frustum, &bboxes[i * 2], &mask);
+        visible += visibility[i];
+    }
+
+    return visible;
 }
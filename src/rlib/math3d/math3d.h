@@ -31,6 +31,12 @@
 #include <math.h>
 #include <glib.h>
 
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE__)
+# include <xmmintrin.h>
+#endif
+
 #define EPSILON 0.0001f
 #define DEG2RAD (M_PI / 180.0f)
 #define RAD2DEG (180.0f / M_PI)
@@ -46,6 +52,8 @@
 #endif
 # define _SGN(x)            ((x < -EPSILON) ? -1 : ((x > EPSILON) ? 1 : 0))
 # define _SQR(x)            ((x) * (x))
+# define _LERP(a, b, t)     ((a) + ((b) - (a)) * (t))
+# define _ALIGN(n)          __attribute__((aligned(n)))
 
 /* --- structures --- */
 typedef struct
@@ -108,7 +116,7 @@ typedef struct
     float   m32;
     float   m33;
 }
-float4x4;
+_ALIGN(16) float4x4;
     
 /* --- functions --- */
 /*
@@ -434,6 +442,7 @@ mul4(
 
 /*
  * Multiply 2 matrices.
+ * r may alias a or b, every row is loaded before the first store.
  */
 static inline float4x4*
 mul4x4(
@@ -442,6 +451,46 @@ mul4x4(
     float4x4*   r
     )
 {
+#if defined(__AVX__)
+    __m256 a01, a23, b0, b1, b2, b3, r01, r23;
+
+    a01 = _mm256_loadu_ps(&a->m00);
+    a23 = _mm256_loadu_ps(&a->m20);
+    b0 = _mm256_broadcast_ps((const __m128*) &b->m00);
+    b1 = _mm256_broadcast_ps((const __m128*) &b->m10);
+    b2 = _mm256_broadcast_ps((const __m128*) &b->m20);
+    b3 = _mm256_broadcast_ps((const __m128*) &b->m30);
+    r01 = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(a01, 0x00), b0), _mm256_mul_ps(_mm256_permute_ps(a01, 0x55), b1)),
+        _mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(a01, 0xAA), b2), _mm256_mul_ps(_mm256_permute_ps(a01, 0xFF), b3)));
+    r23 = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(a23, 0x00), b0), _mm256_mul_ps(_mm256_permute_ps(a23, 0x55), b1)),
+        _mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(a23, 0xAA), b2), _mm256_mul_ps(_mm256_permute_ps(a23, 0xFF), b3)));
+    _mm256_storeu_ps(&r->m00, r01);
+    _mm256_storeu_ps(&r->m20, r23);
+    return r;
+#elif defined(__SSE__)
+    __m128 a0, a1, a2, a3, b0, b1, b2, b3;
+
+    a0 = _mm_loadu_ps(&a->m00);
+    a1 = _mm_loadu_ps(&a->m10);
+    a2 = _mm_loadu_ps(&a->m20);
+    a3 = _mm_loadu_ps(&a->m30);
+    b0 = _mm_loadu_ps(&b->m00);
+    b1 = _mm_loadu_ps(&b->m10);
+    b2 = _mm_loadu_ps(&b->m20);
+    b3 = _mm_loadu_ps(&b->m30);
+#define _MUL4X4_ROW(ai) \
+    _mm_add_ps( \
+        _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(ai, ai, 0x00), b0), _mm_mul_ps(_mm_shuffle_ps(ai, ai, 0x55), b1)), \
+        _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(ai, ai, 0xAA), b2), _mm_mul_ps(_mm_shuffle_ps(ai, ai, 0xFF), b3)))
+    _mm_storeu_ps(&r->m00, _MUL4X4_ROW(a0));
+    _mm_storeu_ps(&r->m10, _MUL4X4_ROW(a1));
+    _mm_storeu_ps(&r->m20, _MUL4X4_ROW(a2));
+    _mm_storeu_ps(&r->m30, _MUL4X4_ROW(a3));
+#undef _MUL4X4_ROW
+    return r;
+#else
     float bi0, bi1, bi2, bi3;
     
     bi0 = b->m00; bi1 = b->m10; bi2 = b->m20; bi3 = b->m30; 
@@ -465,6 +514,7 @@ mul4x4(
     r->m23 = bi0 * a->m20 + bi1 * a->m21 + bi2 * a->m22 + bi3 * a->m23;
     r->m33 = bi0 * a->m30 + bi1 * a->m31 + bi2 * a->m32 + bi3 * a->m33;
     return r;
+#endif
 }
 
 /*
@@ -535,6 +585,25 @@ lerp4(
     return r;
 }
 
+/* Batches */
+
+extern void
+r_math_transform_points(
+    float4x4*       m,
+    const float3*   points,
+    float3*         result,
+    guint           count
+    );
+
+extern void
+r_math_lerp_array(
+    const float*    a,
+    const float*    b,
+    float           t,
+    float*          result,
+    guint           count
+    );
+
 /* Matrices */
 
 static inline float4x4*
@@ -591,29 +660,65 @@ r_matrix_print(
 
 /* Frustum */
 
-extern void
-r_frustum_update_projection(
+enum
+{
+    R_FRUSTUM_RIGHT     = 0,
+    R_FRUSTUM_LEFT      = 1,
+    R_FRUSTUM_BOTTOM    = 2,
+    R_FRUSTUM_TOP       = 3,
+    R_FRUSTUM_FAR       = 4,
+    R_FRUSTUM_NEAR      = 5
+};
+
+#define R_FRUSTUM_ALL_PLANES 0x3F
+
+typedef struct
+{
+    float4      planes[6];
+}
+RFrustum;
+
+extern RFrustum*
+r_frustum_set(
+    RFrustum*   frustum,
+    float4x4*   view,
     float4x4*   projection
     );
 
 extern gboolean
 r_frustum_test_point(
-    float4x4*   view,
+    RFrustum*   frustum,
     float3*     point
     );
     
 extern gboolean
 r_frustum_test_bsphere(
-    float4x4*   view,
-    float3*     bshere
+    RFrustum*   frustum,
+    float4*     bsphere
     );
     
 extern gboolean
 r_frustum_test_bbox(
-    float4x4*   view,
+    RFrustum*   frustum,
     float3*     bbox
     );
 
+extern gboolean
+r_frustum_test_bbox_masked(
+    RFrustum*   frustum,
+    float3*     bbox,
+    guint*      plane_mask
+    );
+
+extern guint
+r_frustum_cull_bboxes(
+    RFrustum*   frustum,
+    float3*     bboxes,
+    guint       count,
+    guint       plane_mask,
+    gboolean*   visibility
+    );
+
 /* Collision */
 
 extern gboolean
@@ -641,4 +746,44 @@ r_bbox_overlap(
     float3*     bbox2
     );
 
+/* Bounding Volume Hierarchy */
+
+typedef struct
+{
+    float3      bbox[2];
+    guint       offset;
+    guint       count;
+}
+RBVHNode;
+
+typedef struct
+{
+    guint       nodes_count;
+    guint       indices_count;
+    RBVHNode*   nodes;
+    guint*      indices;
+}
+RBVH;
+
+typedef void (*RBVHCallback)(guint index, gpointer user_data);
+
+extern RBVH*
+r_bvh_new(
+    float3*     bboxes,
+    guint       count
+    );
+
+extern void
+r_bvh_free(
+    RBVH*       bvh
+    );
+
+extern void
+r_bvh_query(
+    RBVH*       bvh,
+    float3*     bbox,
+    RBVHCallback callback,
+    gpointer    user_data
+    );
+
 #endif /* __MATH3D_H__ */
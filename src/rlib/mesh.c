@@ -21,7 +21,10 @@
  */
 
 #include <rlib.h>
+#include <stdio.h>
 #include <memory.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #define SELF(m) ((_RMesh*) (m))
 #define VBO_OFFSET0(s) (gconstpointer) ((guint*)NULL + (s))
@@ -30,6 +33,30 @@
 /* --- types --- */
 typedef struct __RMesh _RMesh;
 
+typedef struct __MeshCollisionTriangle _MeshCollisionTriangle;
+
+typedef struct __MeshCollision _MeshCollision;
+
+typedef struct __MeshCollideContext _MeshCollideContext;
+
+typedef struct __MeshCacheHeader _MeshCacheHeader;
+
+typedef struct __SharedMesh _SharedMesh;
+
+typedef struct __MeshCache _MeshCache;
+
+#define _MESH_ELEMENT_FLOATS (sizeof(RMeshElement) / sizeof(gfloat))
+
+#define R_MESH_CACHE_MAGIC      0x48534D52
+#define R_MESH_CACHE_VERSION    2
+#define R_MESH_CACHE_SUFFIX     ".rmesh"
+
+enum
+{
+    R_MESH_CACHE_MESH,
+    R_MESH_CACHE_MESHGROUP
+};
+
 /* --- structures --- */
 struct __RMesh
 {
@@ -45,31 +72,94 @@ struct __RMesh
 /* private */
     GLuint                  vertice_vbo;
     GLuint                  triangles_vbo;
+    _MeshCollision**        collisions;
+    GMappedFile*            mapping;
+};
+
+struct _RMeshWelder
+{
+    RMeshElement*           elements;
+    gdouble                 scale;
+    guint                   mask;
+    guint*                  buckets;
+    guint*                  hashes;
+};
+
+struct __MeshCollisionTriangle
+{
+    float4                  plane;
+    float3                  origin;
+    float3                  edge_u;
+    float3                  edge_v;
+};
+
+struct __MeshCollision
+{
+    guint                   triangles_count;
+    _MeshCollisionTriangle* triangles;
+    RBVH*                   bvh;
+};
+
+struct __MeshCollideContext
+{
+    _MeshCollisionTriangle* triangles;
+    float3*                 bbox;
+    float3                  r;
+    gboolean                result;
+};
+
+struct __MeshCacheHeader
+{
+    guint32                 magic;
+    guint32                 version;
+    guint32                 kind;
+    guint32                 meshes_count;
+    guint64                 source_mtime;
+    guint64                 source_size;
+    guint8                  digest[R_DIGEST_LENGTH];
+    guint32                 reserved;
+};
+
+struct __SharedMesh
+{
+    gpointer                mesh;
+    guint                   ref;
+    gchar*                  digest;
+};
+
+/*
+ * The meshes and mesh groups loaded from files, found by the digest of
+ * their files and skin, or by their address to release them.
+ */
+struct __MeshCache
+{
+    GMutex                  lock;
+    GHashTable*             digests;
+    GHashTable*             meshes;
 };
 
+/* --- variables --- */
+static _MeshCache mesh_cache = {{0}, NULL, NULL};
+
 /* --- functions --- */
 /*
- * _r_mesh_frame_lerp:
+ * _r_mesh_frame_advance:
  *
+ * Moves the animation clock of @self by the time of the last frame and
+ * returns FALSE once a non repeated animation reached its last frame.
  */
 static inline gboolean
-_mesh_frame_lerp(
+_mesh_frame_advance(
     _RMesh*         self,
     guint           frame_first,
     guint           frame_last,
     guint           frame_fps,
-    gboolean        repeat_mode,
-    RMeshElement*   result
+    gboolean        repeat_mode
     )
 {
     gboolean animating = TRUE;
     guint frame_current;
     guint frame_range;
-    RMeshElement* v1;
-    RMeshElement* v2;
-    RMeshElement* v3;
-    guint i;
-    gfloat t;
     
     self->anim_time += 0.000001f * frame_fps * game->frame_time;
     
@@ -81,7 +171,6 @@ _mesh_frame_lerp(
         if(frame_current > frame_range)
         {
             self->anim_time = 0.0f;
-            frame_current = 0;
         }
     }
     else
@@ -89,29 +178,113 @@ _mesh_frame_lerp(
         if(frame_current >= frame_range)
         {
             self->anim_time = frame_range;
-            frame_current = frame_range;
             animating = FALSE;
         }
     }
     
-    t = self->anim_time - (gfloat) frame_current;
+    return animating;
+}
+
+/*
+ * _r_mesh_frame_lerp:
+ *
+ */
+static inline void
+_mesh_frame_lerp(
+    _RMesh*         self,
+    guint           frame_first,
+    guint           frame_last,
+    gfloat          frame,
+    RMeshElement*   result
+    )
+{
+    guint frame_current;
+    guint frame_range;
+    RMeshElement* v1;
+    RMeshElement* v2;
+    gfloat t;
+    
+    frame_range = frame_last - frame_first;
+    frame_current = MIN((guint) frame, frame_range);
+    
+    t = frame - (gfloat) frame_current;
     if(t > 1.0f)
     {
         t = 1.0f;
     }
     
+    /* texcoords are the same in every frame so the whole element is lerped */
     v1 = self->frames[frame_first + frame_current];
     v2 = self->frames[frame_first + (frame_current + 1) % (frame_range + 1)];
-    v3 = result;
-    for(i = 0; i < self->vertice_count; i++, v1++, v2++, v3++)
+    r_math_lerp_array(
+        (gfloat*) v1,
+        (gfloat*) v2,
+        t,
+        (gfloat*) result,
+        self->vertice_count * (sizeof(RMeshElement) / sizeof(gfloat))
+        );
+}
+
+/*
+ * _mesh_draw_frame:
+ *
+ */
+static void
+_mesh_draw_frame(
+    float4x4*       view,
+    _RMesh*         self,
+    guint           frame_first,
+    guint           frame_last,
+    gfloat          frame
+    )
+{
+    RMeshPart* part;
+
+    if(view != NULL)
+    {
+        glLoadMatrixf((GLfloat*) view);
+    }
+    
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, self->vertice_vbo);
+    if(self->frames_count > 1)
     {
-        lerp3(&v1->point, &v2->point, t, &v3->point);
-        lerp3(&v1->normal, &v2->normal, t, &v3->normal);
-        v3->texcoord.x = v1->texcoord.x;
-        v3->texcoord.y = v1->texcoord.y;
+        RMeshElement* buffer = (RMeshElement*) glMapBufferARB(GL_ARRAY_BUFFER_ARB, GL_READ_WRITE_ARB);
+        _mesh_frame_lerp(self, frame_first, frame_last, frame, buffer);
+        glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
     }
     
-    return animating;
+    glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, self->triangles_vbo);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(RMeshElement), VBO_OFFSET(RMeshElement, point));
+
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glNormalPointer(GL_FLOAT, sizeof(RMeshElement), VBO_OFFSET(RMeshElement, normal));
+
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(RMeshElement), VBO_OFFSET(RMeshElement, texcoord));
+    
+    for(part = &self->parts[0]; part < (const RMeshPart*) &self->parts[self->parts_count]; part++)
+    {
+        if(part->skin->texture != R_TEXTURE_NONE)
+        {
+            glBindTexture(GL_TEXTURE_2D, part->skin->texture);
+            glEnable(GL_TEXTURE_2D);
+        }
+        else
+        {
+            glMaterialfv(GL_FRONT, GL_DIFFUSE, (gfloat*) &part->skin->color);
+            glDisable(GL_TEXTURE_2D);
+        }
+        glDrawElements(GL_TRIANGLES, part->count, GL_UNSIGNED_INT, VBO_OFFSET0(part->offset));
+    }
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    glDisable(GL_TEXTURE_2D);
 }
 
 /*
@@ -123,39 +296,288 @@ _r_mesh_free(
     _RMesh*         self
     )
 {
-    g_free(self->triangles);
+    guint i;
+
+    if(self->collisions != NULL)
+    {
+        for(i = 0; i < self->frames_count; i++)
+        {
+            if(self->collisions[i] != NULL)
+            {
+                r_bvh_free(self->collisions[i]->bvh);
+                g_free(self->collisions[i]->triangles);
+                g_slice_free(_MeshCollision, self->collisions[i]);
+            }
+        }
+        g_free(self->collisions);
+    }
+    for(i = 0; i < self->parts_count; i++)
+    {
+        g_free(self->parts[i].skin_name);
+    }
+    if(self->mapping != NULL)
+    {
+        g_mapped_file_unref(self->mapping);
+    }
+    else
+    {
+        g_free(self->triangles);
+        g_free(self->frames[0]);
+    }
     g_free(self->parts);
-    g_free(self->frames[0]);
     g_free(self->frames);
     g_slice_free(_RMesh, self);
 }
 
 /*
- * _r_mesh_concat:
+ * _mesh_unmap:
  *
+ * Moves the frames and triangles of a mesh loaded from a cache file out of
+ * the read only mapping so that they can be modified.
  */
 static void
-_r_mesh_concat(
-    _RMesh*              mesh1,
-    _RMesh*              mesh2
+_mesh_unmap(
+    _RMesh*              self
     )
 {
+    RMeshElement* frames;
     guint i;
 
-    g_assert(mesh1 != NULL);
-    g_assert(mesh2 != NULL);
-    g_assert(mesh1->vertice_count == mesh2->vertice_count);
-    
-    mesh1->frames_count++;
-    mesh1->frames = g_renew(RMeshElement*, mesh1->frames, mesh1->frames_count);
-    mesh1->frames[0] =  g_renew(RMeshElement, mesh1->frames[0], mesh1->frames_count * mesh1->vertice_count);
-    
-    for(i = 1; i < mesh1->frames_count; i++)
+    if(self->mapping == NULL)
     {
-        mesh1->frames[i] = &mesh1->frames[i - 1][mesh1->vertice_count];
+        return;
     }
-    
-    memcpy(mesh1->frames[mesh1->frames_count - 1], mesh2->frames[0], mesh1->vertice_count * sizeof(RMeshElement));
+
+    frames = g_memdup(self->frames[0], self->frames_count * self->vertice_count * sizeof(RMeshElement));
+    for(i = 0; i < self->frames_count; i++)
+    {
+        self->frames[i] = &frames[i * self->vertice_count];
+    }
+    self->triangles = g_memdup(self->triangles, self->triangles_count * 3 * sizeof(guint));
+    g_mapped_file_unref(self->mapping);
+    self->mapping = NULL;
+}
+
+/*
+ * _mesh_gather_frames:
+ *
+ * Turns @self into an animation of @frames_count keyframes, @meshes[i]
+ * giving the frame i. The frames block is allocated once and the points
+ * and normals of every keyframe are gathered through the corners of the
+ * first one, so only the topology of the keyframes has to match, not the
+ * way they were welded.
+ */
+static gboolean
+_mesh_gather_frames(
+    _RMesh*             self,
+    _RMesh**            meshes,
+    guint               frames_count
+    )
+{
+    RMeshElement* frames;
+    RMeshElement* elements;
+    const RMeshElement* element;
+    guint* corners;
+    guint i, j;
+
+    g_assert(self == meshes[0]);
+    g_assert(self->collisions == NULL);
+
+    if(frames_count == 1)
+    {
+        return TRUE;
+    }
+    for(i = 0; i < frames_count; i++)
+    {
+        if(meshes[i]->triangles_count != self->triangles_count || meshes[i]->frames_count != 1)
+        {
+            return FALSE;
+        }
+    }
+
+    corners = g_new(guint, self->vertice_count);
+    for(j = 0; j < self->triangles_count * 3; j++)
+    {
+        corners[self->triangles[j]] = j;
+    }
+
+    frames = g_new(RMeshElement, frames_count * self->vertice_count);
+    memcpy(frames, self->frames[0], self->vertice_count * sizeof(RMeshElement));
+    for(i = 1; i < frames_count; i++)
+    {
+        elements = &frames[i * self->vertice_count];
+        for(j = 0; j < self->vertice_count; j++)
+        {
+            element = &meshes[i]->frames[0][meshes[i]->triangles[corners[j]]];
+            elements[j].point = element->point;
+            elements[j].normal = element->normal;
+            elements[j].texcoord = frames[j].texcoord;
+        }
+    }
+    g_free(corners);
+
+    _mesh_unmap(self);
+    g_free(self->frames[0]);
+    self->frames_count = frames_count;
+    self->frames = g_renew(RMeshElement*, self->frames, frames_count);
+    for(i = 0; i < frames_count; i++)
+    {
+        self->frames[i] = &frames[i * self->vertice_count];
+    }
+    return TRUE;
+}
+
+/*
+ * _mesh_collision_get:
+ *
+ * Returns the collision data of a frame: the world space plane of every
+ * non degenerated triangle, its barycentric edge vectors and an AABB tree
+ * over them. Static meshes get it at load time, animated ones on their
+ * first collision test.
+ */
+static _MeshCollision*
+_mesh_collision_get(
+    _RMesh*         self,
+    guint           frame
+    )
+{
+    _MeshCollision* collision;
+    _MeshCollisionTriangle* triangle;
+    RMeshElement* elements;
+    float3* bboxes;
+    float3* a;
+    float3* b;
+    float3* c;
+    float3 v0, v1;
+    float3 min, max;
+    float dot00, dot01, dot11;
+    float k;
+    guint i;
+
+    if(self->collisions == NULL)
+    {
+        self->collisions = g_new0(_MeshCollision*, self->frames_count);
+    }
+
+    if(self->collisions[frame] == NULL)
+    {
+        collision = g_slice_new0(_MeshCollision);
+        collision->triangles = g_new(_MeshCollisionTriangle, self->triangles_count);
+        elements = self->frames[frame];
+        bboxes = g_new(float3, self->triangles_count * 2);
+
+        for(i = 0; i < self->triangles_count; i++)
+        {
+            a = &elements[self->triangles[i * 3 + 0]].point;
+            b = &elements[self->triangles[i * 3 + 1]].point;
+            c = &elements[self->triangles[i * 3 + 2]].point;
+
+            v0.x = c->x - a->x; v0.y = c->y - a->y; v0.z = c->z - a->z;
+            v1.x = b->x - a->x; v1.y = b->y - a->y; v1.z = b->z - a->z;
+            dot00 = dot3(&v0, &v0);
+            dot01 = dot3(&v0, &v1);
+            dot11 = dot3(&v1, &v1);
+            k = dot00 * dot11 - dot01 * dot01;
+            if(k <= EPSILON * EPSILON * EPSILON)
+            {
+                continue;
+            }
+            k = 1.0f / k;
+
+            triangle = &collision->triangles[collision->triangles_count];
+            norm3(cross3(&v1, &v0, (float3*) &triangle->plane));
+            triangle->plane.w = -dot3(a, (float3*) &triangle->plane);
+            triangle->origin = *a;
+            triangle->edge_u.x = (dot11 * v0.x - dot01 * v1.x) * k;
+            triangle->edge_u.y = (dot11 * v0.y - dot01 * v1.y) * k;
+            triangle->edge_u.z = (dot11 * v0.z - dot01 * v1.z) * k;
+            triangle->edge_v.x = (dot00 * v1.x - dot01 * v0.x) * k;
+            triangle->edge_v.y = (dot00 * v1.y - dot01 * v0.y) * k;
+            triangle->edge_v.z = (dot00 * v1.z - dot01 * v0.z) * k;
+
+            min.x = MIN(a->x, MIN(b->x, c->x)); max.x = MAX(a->x, MAX(b->x, c->x));
+            min.y = MIN(a->y, MIN(b->y, c->y)); max.y = MAX(a->y, MAX(b->y, c->y));
+            min.z = MIN(a->z, MIN(b->z, c->z)); max.z = MAX(a->z, MAX(b->z, c->z));
+            bboxes[collision->triangles_count * 2 + 0].x = (max.x + min.x) * 0.5f;
+            bboxes[collision->triangles_count * 2 + 0].y = (max.y + min.y) * 0.5f;
+            bboxes[collision->triangles_count * 2 + 0].z = (max.z + min.z) * 0.5f;
+            bboxes[collision->triangles_count * 2 + 1].x = (max.x - min.x) * 0.5f;
+            bboxes[collision->triangles_count * 2 + 1].y = (max.y - min.y) * 0.5f;
+            bboxes[collision->triangles_count * 2 + 1].z = (max.z - min.z) * 0.5f;
+
+            collision->triangles_count++;
+        }
+
+        collision->triangles = g_renew(_MeshCollisionTriangle, collision->triangles, MAX(collision->triangles_count, 1));
+        collision->bvh = r_bvh_new(bboxes, collision->triangles_count);
+        g_free(bboxes);
+
+        self->collisions[frame] = collision;
+    }
+
+    return self->collisions[frame];
+}
+
+/*
+ * _mesh_collide_triangle:
+ *
+ * Collides one triangle with the ellipsoid of context->bbox. The stored
+ * world plane is scaled to the unit sphere space of the ellipsoid: the
+ * normal becomes normalize(n * extent) and the distance to the center
+ * (n.center + d) / |n * extent|. Barycentric coordinates are affine
+ * invariant so the contact point is tested back in world space.
+ */
+static void
+_mesh_collide_triangle(
+    guint           index,
+    gpointer        user_data
+    )
+{
+    _MeshCollideContext* context = user_data;
+    _MeshCollisionTriangle* triangle = &context->triangles[index];
+    float3* center = &context->bbox[0];
+    float3* extent = &context->bbox[1];
+    float3 n;
+    float3 p;
+    float k;
+    float w;
+    float u;
+    float v;
+
+    w = dot3(center, (float3*) &triangle->plane) + triangle->plane.w;
+    if(w < 0.0f)
+    {
+        return;
+    }
+
+    n.x = triangle->plane.x * extent->x;
+    n.y = triangle->plane.y * extent->y;
+    n.z = triangle->plane.z * extent->z;
+    k = _INV_SQRT(length_sqr3(&n));
+    w *= k;
+    if(w > 1.0f)
+    {
+        return;
+    }
+    n.x *= k;
+    n.y *= k;
+    n.z *= k;
+
+    p.x = center->x - n.x * w * extent->x - triangle->origin.x;
+    p.y = center->y - n.y * w * extent->y - triangle->origin.y;
+    p.z = center->z - n.z * w * extent->z - triangle->origin.z;
+    u = dot3(&p, &triangle->edge_u);
+    v = dot3(&p, &triangle->edge_v);
+    if((u < 0.0f) || (v < 0.0f) || (u + v >= 1.0f))
+    {
+        return;
+    }
+
+    w = 1.0f - w;
+    context->r.x += w * n.x;
+    context->r.y += w * n.y;
+    context->r.z += w * n.z;
+    context->result = TRUE;
 }
 
 /*
@@ -202,62 +624,149 @@ _mesh_free_delegate(
     return NULL;
 }
 
-/**
- * r_mesh_element_equals:
+/*
+ * _mesh_welder_key:
  *
- **/
-gboolean
-r_mesh_element_equals(
-    RMeshElement* e1,
-    RMeshElement* e2
+ */
+static void
+_mesh_welder_key(
+    RMeshWelder*        self,
+    RMeshElement*       element,
+    gint64*             key
     )
 {
-    if(memcmp(e1, e2, sizeof(RMeshElement)) == 0)
-    {
-        return TRUE;
-    }
-    else
+    const gfloat* values;
+    guint32 bits;
+    guint i;
+
+    values = (const gfloat*) element;
+    for(i = 0; i < _MESH_ELEMENT_FLOATS; i++)
     {
-        return FALSE;
+        if(self->scale > 0.0)
+        {
+            key[i] = (gint64) floor(values[i] * self->scale + 0.5);
+        }
+        else
+        {
+            memcpy(&bits, &values[i], sizeof(bits));
+            key[i] = bits;
+        }
     }
 }
 
-/**
- * r_mesh_element_insert:
+/*
+ * _mesh_welder_hash:
  *
- **/
-gboolean
-r_mesh_element_insert(
-    RMeshElement*       elements,
-    guint               index,
-    RMeshElement*       element,
-    guint*              result_index
+ */
+static guint
+_mesh_welder_hash(
+    const gint64*       key
     )
 {
-    gushort i;
-    
-    memcpy(&elements[index], element, sizeof(RMeshElement));
-    for(i = 0; !r_mesh_element_equals(&elements[i], element); i++);
-    *result_index = i;
-    return (index == i);
+    guint64 hash;
+    guint i;
+
+    hash = 14695981039346656037ULL;
+    for(i = 0; i < _MESH_ELEMENT_FLOATS; i++)
+    {
+        hash = (hash ^ (guint64) key[i]) * 1099511628211ULL;
+    }
+    return (guint) (hash ^ (hash >> 32));
 }
 
 /**
- * r_mesh_element_replace:
+ * r_mesh_welder_new:
  *
+ * Creates a welder that deduplicates elements appended to @elements, which
+ * must have room for @capacity entries. With @epsilon > 0 every component is
+ * snapped to a grid of that size before comparison, otherwise elements are
+ * welded only when bitwise equal.
  **/
-void
-r_mesh_element_replace(
+RMeshWelder*
+r_mesh_welder_new(
     RMeshElement*       elements,
-    guint               index,
-    RMeshElement*       element
+    guint               capacity,
+    gfloat              epsilon
     )
 {
-    memcpy(&elements[index], element, sizeof(RMeshElement));
+    RMeshWelder* self;
+    guint size;
+
+    g_assert(elements != NULL);
+    g_assert(epsilon >= 0.0f);
+
+    for(size = 16; size < capacity * 2; size <<= 1);
+
+    self = g_slice_new0(RMeshWelder);
+    self->elements = elements;
+    self->scale = (epsilon > 0.0f) ? 1.0 / epsilon : 0.0;
+    self->mask = size - 1;
+    self->buckets = g_new0(guint, size);
+    self->hashes = g_new(guint, size);
+    return self;
 }
 
 /**
- * r_mesh_new:
+ * r_mesh_welder_insert:
+ *
+ * Stores @element at @index unless an equivalent element was inserted
+ * before, and returns TRUE when @index was consumed. @result_index is set
+ * to the index of the element kept.
+ **/
+gboolean
+r_mesh_welder_insert(
+    RMeshWelder*        self,
+    guint               index,
+    RMeshElement*       element,
+    guint*              result_index
+    )
+{
+    gint64 key[_MESH_ELEMENT_FLOATS];
+    gint64 other[_MESH_ELEMENT_FLOATS];
+    guint hash;
+    guint i;
+
+    _mesh_welder_key(self, element, key);
+    hash = _mesh_welder_hash(key);
+
+    for(i = hash & self->mask; self->buckets[i] != 0; i = (i + 1) & self->mask)
+    {
+        if(self->hashes[i] != hash)
+        {
+            continue;
+        }
+        _mesh_welder_key(self, &self->elements[self->buckets[i] - 1], other);
+        if(memcmp(key, other, sizeof(key)) == 0)
+        {
+            *result_index = self->buckets[i] - 1;
+            return FALSE;
+        }
+    }
+
+    g_assert((index + 1) * 2 <= self->mask + 1);
+    memcpy(&self->elements[index], element, sizeof(RMeshElement));
+    self->buckets[i] = index + 1;
+    self->hashes[i] = hash;
+    *result_index = index;
+    return TRUE;
+}
+
+/**
+ * r_mesh_welder_free:
+ *
+ **/
+void
+r_mesh_welder_free(
+    RMeshWelder*        self
+    )
+{
+    g_free(self->buckets);
+    g_free(self->hashes);
+    g_slice_free(RMeshWelder, self);
+}
+
+/**
+ * r_mesh_new:
  *
  **/
 RMesh*
@@ -291,15 +800,927 @@ r_mesh_new(
     
     for(i = 1; i < self->frames_count; i++)
     {
-        self->frames[i] = &self->frames[i - 1][vertice_count];
+        self->frames[i] = &self->frames[i - 1][vertice_count];
+    }
+    
+    return (RMesh*) self;
+}
+
+/**
+ * r_mesh_shrink:
+ *
+ * Trims the frames storage, allocated by r_mesh_new for the worst case, down
+ * to the current vertice_count. Must be called before the mesh is uploaded.
+ **/
+void
+r_mesh_shrink(
+    RMesh*                  mesh
+    )
+{
+    _RMesh* self;
+    RMeshElement* frames;
+    guint stride;
+    guint i;
+
+    self = SELF(mesh);
+    g_assert(self->vertice_vbo == 0);
+    g_assert(self->collisions == NULL);
+    g_assert(self->mapping == NULL);
+    g_assert(self->vertice_count > 0);
+
+    if(self->frames_count == 1)
+    {
+        self->frames[0] = g_renew(RMeshElement, self->frames[0], self->vertice_count);
+        return;
+    }
+
+    stride = self->frames[1] - self->frames[0];
+    if(stride == self->vertice_count)
+    {
+        return;
+    }
+
+    frames = g_new(RMeshElement, self->frames_count * self->vertice_count);
+    for(i = 0; i < self->frames_count; i++)
+    {
+        memcpy(&frames[i * self->vertice_count], self->frames[i], self->vertice_count * sizeof(RMeshElement));
+    }
+    g_free(self->frames[0]);
+    for(i = 0; i < self->frames_count; i++)
+    {
+        self->frames[i] = &frames[i * self->vertice_count];
+    }
+}
+
+/*
+ * _mesh_cache_write_string:
+ *
+ */
+static void
+_mesh_cache_write_string(
+    GByteArray*         buffer,
+    const gchar*        string
+    )
+{
+    static const guint8 padding[4] = {0, 0, 0, 0};
+    guint32 length;
+
+    length = (string != NULL) ? strlen(string) : 0;
+    g_byte_array_append(buffer, (guint8*) &length, sizeof(length));
+    g_byte_array_append(buffer, (guint8*) string, length);
+    g_byte_array_append(buffer, padding, (4 - length % 4) % 4);
+}
+
+/*
+ * _mesh_cache_write_mesh:
+ *
+ */
+static void
+_mesh_cache_write_mesh(
+    GByteArray*         buffer,
+    const gchar*        name,
+    _RMesh*             self
+    )
+{
+    guint32 values[4];
+    guint i;
+
+    _mesh_cache_write_string(buffer, name);
+    values[0] = self->vertice_count;
+    values[1] = self->frames_count;
+    values[2] = self->parts_count;
+    values[3] = self->triangles_count;
+    g_byte_array_append(buffer, (guint8*) values, sizeof(values));
+
+    for(i = 0; i < self->parts_count; i++)
+    {
+        values[0] = self->parts[i].offset;
+        values[1] = self->parts[i].count;
+        g_byte_array_append(buffer, (guint8*) values, 2 * sizeof(guint32));
+        _mesh_cache_write_string(buffer, self->parts[i].skin_name);
+    }
+
+    for(i = 0; i < self->frames_count; i++)
+    {
+        g_byte_array_append(buffer, (guint8*) self->frames[i], self->vertice_count * sizeof(RMeshElement));
+    }
+    g_byte_array_append(buffer, (guint8*) self->triangles, self->triangles_count * 3 * sizeof(guint32));
+}
+
+/*
+ * _mesh_cache_get_name:
+ *
+ * Returns the name of the cache of @file_name, "<file_name>.rmesh" next to
+ * its source where the baked caches live, or a file of the user cache
+ * directory named after the digest of its full path when @user is TRUE.
+ */
+static gchar*
+_mesh_cache_get_name(
+    const gchar*        file_name,
+    gboolean            user
+    )
+{
+    gchar* path;
+    gchar* digest;
+    gchar* base_name;
+    gchar* result;
+
+    if(!user)
+    {
+        return g_strconcat(file_name, R_MESH_CACHE_SUFFIX, NULL);
+    }
+
+    if(g_path_is_absolute(file_name))
+    {
+        path = g_strdup(file_name);
+    }
+    else
+    {
+        base_name = g_get_current_dir();
+        path = g_build_filename(base_name, file_name, NULL);
+        g_free(base_name);
+    }
+    digest = g_compute_checksum_for_string(G_CHECKSUM_SHA1, path, -1);
+    base_name = g_strconcat(digest, R_MESH_CACHE_SUFFIX, NULL);
+    result = g_build_filename(g_get_user_cache_dir(), PACKAGE, base_name, NULL);
+    g_free(base_name);
+    g_free(digest);
+    g_free(path);
+    return result;
+}
+
+/*
+ * _mesh_cache_save:
+ *
+ * Writes @data, a RMesh or a RMeshGroup freshly loaded from @file_name, to
+ * @cache_name. The file mirrors the in-memory layout so that it can be
+ * mapped back without any decoding. Failures are reported but not fatal,
+ * the source will simply be parsed again next time.
+ */
+static gboolean
+_mesh_cache_save(
+    const gchar*        file_name,
+    const gchar*        cache_name,
+    guint               kind,
+    gpointer            data
+    )
+{
+    _MeshCacheHeader header;
+    GByteArray* buffer;
+    GHashTableIter iter;
+    struct stat st;
+    GError* error = NULL;
+    gchar* dir_name;
+    gchar* name;
+    RMesh* mesh;
+    gboolean result;
+
+    if(g_stat(file_name, &st) != 0)
+    {
+        return FALSE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = R_MESH_CACHE_MAGIC;
+    header.version = R_MESH_CACHE_VERSION;
+    header.kind = kind;
+    header.source_mtime = st.st_mtime;
+    header.source_size = st.st_size;
+
+    buffer = g_byte_array_new();
+    g_byte_array_append(buffer, (guint8*) &header, sizeof(header));
+    if(kind == R_MESH_CACHE_MESH)
+    {
+        header.meshes_count = 1;
+        _mesh_cache_write_mesh(buffer, NULL, SELF(data));
+    }
+    else
+    {
+        header.meshes_count = g_hash_table_size(((RMeshGroup*) data)->groups);
+        g_hash_table_iter_init(&iter, ((RMeshGroup*) data)->groups);
+        while(g_hash_table_iter_next(&iter, (gpointer) &name, (gpointer) &mesh))
+        {
+            _mesh_cache_write_mesh(buffer, name, SELF(mesh));
+        }
+    }
+    r_digest_data(buffer->data + sizeof(header), buffer->len - sizeof(header), header.digest);
+    memcpy(buffer->data, &header, sizeof(header));
+
+    dir_name = g_path_get_dirname(cache_name);
+    g_mkdir_with_parents(dir_name, 0755);
+    g_free(dir_name);
+    result = g_file_set_contents(cache_name, (gchar*) buffer->data, buffer->len, &error);
+    if(!result)
+    {
+        g_warning("%s: unable to write the mesh cache: %s", file_name, error->message);
+        g_error_free(error);
+    }
+    g_byte_array_free(buffer, TRUE);
+    return result;
+}
+
+/*
+ * _mesh_cache_read_header:
+ *
+ * Reads only the header of @cache_name, the cache of @file_name, from the
+ * mounted paks or the file system, and returns TRUE when it is up to date.
+ * A cache whose source is not shipped is taken as it is, like
+ * _mesh_cache_load does.
+ */
+static gboolean
+_mesh_cache_read_header(
+    const gchar*        file_name,
+    const gchar*        cache_name,
+    guint               kind,
+    _MeshCacheHeader*   header
+    )
+{
+    gconstpointer data;
+    gsize length;
+    struct stat st;
+    FILE* stream;
+    gboolean result;
+
+    if(r_pak_lookup(cache_name, &data, &length, NULL))
+    {
+        result = length >= sizeof(_MeshCacheHeader);
+        if(result)
+        {
+            memcpy(header, data, sizeof(_MeshCacheHeader));
+        }
+    }
+    else
+    {
+        stream = fopen(cache_name, "rb");
+        result = stream != NULL && fread(header, sizeof(_MeshCacheHeader), 1, stream) == 1;
+        if(stream != NULL)
+        {
+            fclose(stream);
+        }
+    }
+
+    return result &&
+        header->magic == R_MESH_CACHE_MAGIC &&
+        header->version == R_MESH_CACHE_VERSION &&
+        header->kind == kind &&
+        (g_stat(file_name, &st) != 0 || (header->source_mtime == (guint64) st.st_mtime && header->source_size == (guint64) st.st_size));
+}
+
+/*
+ * _mesh_cache_get_header:
+ *
+ * Reads the header of the first up to date cache of @file_name, the baked
+ * one next to its source or the one of the user cache directory.
+ */
+static gboolean
+_mesh_cache_get_header(
+    const gchar*        file_name,
+    guint               kind,
+    _MeshCacheHeader*   header
+    )
+{
+    gchar* cache_name;
+    gboolean result = FALSE;
+    gint i;
+
+    for(i = 0; i < 2 && !result; i++)
+    {
+        cache_name = _mesh_cache_get_name(file_name, i == 1);
+        result = _mesh_cache_read_header(file_name, cache_name, kind, header);
+        g_free(cache_name);
+    }
+    return result;
+}
+
+/*
+ * _mesh_cache_is_fresh:
+ *
+ * Checks only the header of the baked cache of @file_name against its
+ * source.
+ */
+static gboolean
+_mesh_cache_is_fresh(
+    const gchar*        file_name,
+    guint               kind
+    )
+{
+    _MeshCacheHeader header;
+    struct stat st;
+    gchar* cache_name;
+    gboolean result;
+
+    cache_name = _mesh_cache_get_name(file_name, FALSE);
+    result = g_stat(file_name, &st) == 0 && _mesh_cache_read_header(file_name, cache_name, kind, &header);
+    g_free(cache_name);
+    return result;
+}
+
+/*
+ * _mesh_cache_read:
+ *
+ * Returns the next @size bytes of the mapping, or NULL past its end.
+ */
+static const guint8*
+_mesh_cache_read(
+    const guint8**      cursor,
+    const guint8*       end,
+    gsize               size
+    )
+{
+    const guint8* data = *cursor;
+
+    if(size > (gsize) (end - data))
+    {
+        return NULL;
+    }
+    *cursor += size;
+    return data;
+}
+
+/*
+ * _mesh_cache_read_string:
+ *
+ */
+static gboolean
+_mesh_cache_read_string(
+    const guint8**      cursor,
+    const guint8*       end,
+    gchar**             string
+    )
+{
+    const guint32* length;
+    const guint8* data;
+
+    length = (const guint32*) _mesh_cache_read(cursor, end, sizeof(guint32));
+    if(length == NULL)
+    {
+        return FALSE;
+    }
+    data = _mesh_cache_read(cursor, end, *length + (4 - *length % 4) % 4);
+    if(data == NULL)
+    {
+        return FALSE;
+    }
+    *string = (*length > 0) ? g_strndup((const gchar*) data, *length) : NULL;
+    return TRUE;
+}
+
+/*
+ * _mesh_cache_read_mesh:
+ *
+ * Builds a mesh whose frames and triangles point straight into @mapping.
+ */
+static _RMesh*
+_mesh_cache_read_mesh(
+    const guint8**      cursor,
+    const guint8*       end,
+    GMappedFile*        mapping,
+    gchar**             name
+    )
+{
+    _RMesh* self;
+    const guint32* values;
+    RMeshElement* frames;
+    guint i;
+
+    *name = NULL;
+    if(!_mesh_cache_read_string(cursor, end, name) ||
+        (values = (const guint32*) _mesh_cache_read(cursor, end, 4 * sizeof(guint32))) == NULL ||
+        values[0] == 0 || values[1] == 0 || values[3] == 0)
+    {
+        g_free(*name);
+        return NULL;
+    }
+
+    self = g_slice_new0(_RMesh);
+    self->vertice_count = values[0];
+    self->frames_count = values[1];
+    self->parts_count = values[2];
+    self->triangles_count = values[3];
+    self->frames = g_new0(RMeshElement*, self->frames_count);
+    self->parts = g_new0(RMeshPart, self->parts_count);
+    self->mapping = g_mapped_file_ref(mapping);
+
+    for(i = 0; i < self->parts_count; i++)
+    {
+        values = (const guint32*) _mesh_cache_read(cursor, end, 2 * sizeof(guint32));
+        if(values == NULL || !_mesh_cache_read_string(cursor, end, &self->parts[i].skin_name))
+        {
+            break;
+        }
+        self->parts[i].offset = values[0];
+        self->parts[i].count = values[1];
+    }
+
+    frames = (RMeshElement*) _mesh_cache_read(cursor, end, (gsize) self->frames_count * self->vertice_count * sizeof(RMeshElement));
+    self->triangles = (guint*) _mesh_cache_read(cursor, end, (gsize) self->triangles_count * 3 * sizeof(guint32));
+    if(i < self->parts_count || frames == NULL || self->triangles == NULL)
+    {
+        _r_mesh_free(self);
+        g_free(*name);
+        return NULL;
+    }
+
+    for(i = 0; i < self->frames_count; i++)
+    {
+        self->frames[i] = &frames[i * self->vertice_count];
+    }
+    return self;
+}
+
+/*
+ * _mesh_cache_load_from:
+ *
+ * Maps @cache_name, the cache of @file_name, or finds it in the mounted
+ * paks, and returns the RMesh or RMeshGroup it holds, or NULL when the
+ * cache is missing, from another version, or older than its source. Meshes
+ * keep a reference to the mapping, no data is copied.
+ */
+static gpointer
+_mesh_cache_load_from(
+    const gchar*        file_name,
+    const gchar*        cache_name,
+    guint               kind
+    )
+{
+    const _MeshCacheHeader* header;
+    guint8 digest[R_DIGEST_LENGTH];
+    GMappedFile* mapping;
+    const guint8* cursor;
+    const guint8* end;
+    gconstpointer data;
+    gsize length;
+    struct stat st;
+    gchar* name;
+    _RMesh* mesh;
+    gpointer result;
+    guint i;
+
+    if(r_pak_lookup(cache_name, &data, &length, &mapping))
+    {
+        g_mapped_file_ref(mapping);
+    }
+    else
+    {
+        mapping = g_mapped_file_new(cache_name, FALSE, NULL);
+        if(mapping != NULL)
+        {
+            data = g_mapped_file_get_contents(mapping);
+            length = g_mapped_file_get_length(mapping);
+        }
+    }
+    if(mapping == NULL)
+    {
+        return NULL;
+    }
+
+    cursor = (const guint8*) data;
+    end = cursor + length;
+    header = (const _MeshCacheHeader*) _mesh_cache_read(&cursor, end, sizeof(_MeshCacheHeader));
+    if(header == NULL ||
+        header->magic != R_MESH_CACHE_MAGIC ||
+        header->version != R_MESH_CACHE_VERSION ||
+        header->kind != kind ||
+        header->meshes_count == 0 ||
+        (kind == R_MESH_CACHE_MESH && header->meshes_count != 1) ||
+        (g_stat(file_name, &st) == 0 && (header->source_mtime != (guint64) st.st_mtime || header->source_size != (guint64) st.st_size)))
+    {
+        g_mapped_file_unref(mapping);
+        return NULL;
+    }
+    r_digest_data(cursor, end - cursor, digest);
+    if(memcmp(digest, header->digest, R_DIGEST_LENGTH) != 0)
+    {
+        g_mapped_file_unref(mapping);
+        return NULL;
+    }
+
+    result = (kind == R_MESH_CACHE_MESH) ? NULL : r_meshgroup_new();
+    for(i = 0; i < header->meshes_count; i++)
+    {
+        mesh = _mesh_cache_read_mesh(&cursor, end, mapping, &name);
+        if(mesh == NULL)
+        {
+            break;
+        }
+        if(kind == R_MESH_CACHE_MESH)
+        {
+            result = mesh;
+        }
+        else
+        {
+            g_hash_table_insert(((RMeshGroup*) result)->groups, name, mesh);
+        }
+    }
+
+    if(i < header->meshes_count)
+    {
+        if(kind == R_MESH_CACHE_MESHGROUP)
+        {
+            r_meshgroup_free(result);
+        }
+        result = NULL;
+    }
+    g_mapped_file_unref(mapping);
+    return result;
+}
+
+/*
+ * _mesh_cache_load:
+ *
+ * Loads the first up to date cache of @file_name, the baked one next to
+ * its source or the one of the user cache directory.
+ */
+static gpointer
+_mesh_cache_load(
+    const gchar*        file_name,
+    guint               kind
+    )
+{
+    gchar* cache_name;
+    gpointer result = NULL;
+    gint i;
+
+    for(i = 0; i < 2 && result == NULL; i++)
+    {
+        cache_name = _mesh_cache_get_name(file_name, i == 1);
+        result = _mesh_cache_load_from(file_name, cache_name, kind);
+        g_free(cache_name);
+    }
+    return result;
+}
+
+/*
+ * _mesh_skins_ref:
+ *
+ * Resolves the skins of @self by their names, or sets them all to the
+ * default skin @user_data when there is one. The names are then dropped,
+ * the mesh holding no reference on a default skin.
+ */
+static void
+_mesh_skins_ref(
+    _RMesh*             self,
+    gpointer            user_data
+    )
+{
+    RMaterial* default_skin = user_data;
+    guint i;
+
+    for(i = 0; i < self->parts_count; i++)
+    {
+        if(default_skin != NULL)
+        {
+            g_free(self->parts[i].skin_name);
+            self->parts[i].skin_name = NULL;
+            self->parts[i].skin = default_skin;
+        }
+        else if(self->parts[i].skin_name != NULL)
+        {
+            self->parts[i].skin = r_resource_ref(self->parts[i].skin_name);
+        }
+    }
+}
+
+/*
+ * _mesh_skins_unref:
+ *
+ * Releases the skins taken by _mesh_skins_ref().
+ */
+static void
+_mesh_skins_unref(
+    _RMesh*             self
+    )
+{
+    guint i;
+
+    for(i = 0; i < self->parts_count; i++)
+    {
+        if(self->parts[i].skin_name != NULL && self->parts[i].skin != NULL)
+        {
+            r_resource_unref(self->parts[i].skin_name);
+            self->parts[i].skin = NULL;
+        }
+    }
+}
+
+/*
+ * _mesh_optimize:
+ *
+ * Renumbers the vertices in the order the triangles first use them, in
+ * every frame, so that the vertex fetches of a draw walk the VBO forward.
+ */
+static void
+_mesh_optimize(
+    _RMesh*             self,
+    gpointer            user_data
+    )
+{
+    RMeshElement* frames;
+    guint* remap;
+    guint count;
+    guint i, j;
+
+    g_assert(self->mapping == NULL);
+
+    remap = g_new(guint, self->vertice_count);
+    memset(remap, 0xFF, self->vertice_count * sizeof(guint));
+    for(i = 0, count = 0; i < self->triangles_count * 3; i++)
+    {
+        if(remap[self->triangles[i]] == G_MAXUINT)
+        {
+            remap[self->triangles[i]] = count++;
+        }
+        self->triangles[i] = remap[self->triangles[i]];
+    }
+    for(i = 0; i < self->vertice_count; i++)
+    {
+        if(remap[i] == G_MAXUINT)
+        {
+            remap[i] = count++;
+        }
+    }
+
+    frames = g_new(RMeshElement, self->frames_count * self->vertice_count);
+    for(i = 0; i < self->frames_count; i++)
+    {
+        for(j = 0; j < self->vertice_count; j++)
+        {
+            frames[i * self->vertice_count + remap[j]] = self->frames[i][j];
+        }
+    }
+    g_free(self->frames[0]);
+    for(i = 0; i < self->frames_count; i++)
+    {
+        self->frames[i] = &frames[i * self->vertice_count];
+    }
+    g_free(remap);
+}
+
+/*
+ * _mesh_foreach:
+ *
+ */
+static void
+_mesh_foreach(
+    gpointer            data,
+    guint               kind,
+    void                (*func)(_RMesh* self, gpointer user_data),
+    gpointer            user_data
+    )
+{
+    GHashTableIter iter;
+    RMesh* mesh;
+
+    if(kind == R_MESH_CACHE_MESH)
+    {
+        func(SELF(data), user_data);
+    }
+    else
+    {
+        g_hash_table_iter_init(&iter, ((RMeshGroup*) data)->groups);
+        while(g_hash_table_iter_next(&iter, NULL, (gpointer) &mesh))
+        {
+            func(SELF(mesh), user_data);
+        }
+    }
+}
+
+/*
+ * _mesh_read:
+ *
+ * Reads @file_name from its baked cache when it is up to date, otherwise
+ * through its module, refreshing the cache on the way. The skins are left
+ * unresolved so that it can run from any thread.
+ */
+static gpointer
+_mesh_read(
+    const gchar*        file_name,
+    guint               kind
+    )
+{
+    gchar* cache_name;
+    gpointer result;
+
+    result = _mesh_cache_load(file_name, kind);
+    if(result == NULL)
+    {
+        result = r_modules_load(file_name);
+        if(result == NULL)
+        {
+            return NULL;
+        }
+        cache_name = _mesh_cache_get_name(file_name, TRUE);
+        _mesh_cache_save(file_name, cache_name, kind, result);
+        g_free(cache_name);
+    }
+    return result;
+}
+
+/*
+ * _mesh_read_frame:
+ *
+ * Reads the keyframe @file_name from its baked cache when it is up to
+ * date, otherwise through its module without welding it, only its corners
+ * being gathered into the first keyframe.
+ */
+static _RMesh*
+_mesh_read_frame(
+    const gchar*        file_name
+    )
+{
+    gpointer result;
+
+    result = _mesh_cache_load(file_name, R_MESH_CACHE_MESH);
+    if(result == NULL)
+    {
+        result = r_modules_load_frame(file_name);
+    }
+    return SELF(result);
+}
+
+/*
+ * _mesh_load:
+ *
+ */
+static gpointer
+_mesh_load(
+    const gchar*        file_name,
+    guint               kind,
+    RMaterial*          default_skin
+    )
+{
+    gpointer result;
+
+    result = _mesh_read(file_name, kind);
+    if(result != NULL)
+    {
+        _mesh_foreach(result, kind, _mesh_skins_ref, default_skin);
+    }
+    return result;
+}
+
+/*
+ * _mesh_digest:
+ *
+ * Returns the digest of @file_names, NULL terminated, loaded as @kind with
+ * @default_skin, or NULL if a file cannot be found. A file is known by the
+ * payload digest of its up to date cache, read from the header alone, else
+ * by the contents of the source.
+ */
+static gchar*
+_mesh_digest(
+    const gchar**       file_names,
+    guint               kind,
+    RMaterial*          default_skin
+    )
+{
+    _MeshCacheHeader header;
+    GChecksum* checksum;
+    gchar* digest = NULL;
+    gboolean result = TRUE;
+    guint i;
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, (const guchar*) &kind, sizeof(kind));
+    g_checksum_update(checksum, (const guchar*) &default_skin, sizeof(default_skin));
+    for(i = 0; result && file_names[i] != NULL; i++)
+    {
+        if(_mesh_cache_get_header(file_names[i], kind, &header))
+        {
+            g_checksum_update(checksum, header.digest, sizeof(header.digest));
+        }
+        else
+        {
+            result = r_pak_checksum(file_names[i], checksum);
+        }
+    }
+    if(result)
+    {
+        digest = g_strdup(g_checksum_get_string(checksum));
+    }
+    g_checksum_free(checksum);
+    return digest;
+}
+
+/*
+ * _mesh_share:
+ *
+ * Returns a new reference to the mesh loaded with @digest, NULL if none.
+ */
+static gpointer
+_mesh_share(
+    const gchar*        digest
+    )
+{
+    _SharedMesh* shared = NULL;
+
+    if(digest == NULL)
+    {
+        return NULL;
+    }
+    g_mutex_lock(&mesh_cache.lock);
+    if(mesh_cache.digests != NULL)
+    {
+        shared = g_hash_table_lookup(mesh_cache.digests, digest);
+    }
+    if(shared != NULL)
+    {
+        shared->ref++;
+    }
+    g_mutex_unlock(&mesh_cache.lock);
+    return (shared != NULL) ? shared->mesh : NULL;
+}
+
+/*
+ * _mesh_publish:
+ *
+ * Shares @mesh, just loaded, under @digest which it takes. Returns the
+ * mesh to use: another one if it was loaded meanwhile by another thread,
+ * then @mesh is freed.
+ */
+static gpointer
+_mesh_publish(
+    gchar*              digest,
+    gpointer            mesh,
+    guint               kind
+    )
+{
+    _SharedMesh* shared;
+
+    if(digest == NULL)
+    {
+        return mesh;
     }
-    
-    return (RMesh*) self;
+    g_mutex_lock(&mesh_cache.lock);
+    if(mesh_cache.digests == NULL)
+    {
+        mesh_cache.digests = g_hash_table_new(g_str_hash, g_str_equal);
+        mesh_cache.meshes = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    shared = g_hash_table_lookup(mesh_cache.digests, digest);
+    if(shared != NULL)
+    {
+        shared->ref++;
+        g_mutex_unlock(&mesh_cache.lock);
+        g_free(digest);
+        if(kind == R_MESH_CACHE_MESH)
+        {
+            r_mesh_free(mesh);
+        }
+        else
+        {
+            r_meshgroup_free(mesh);
+        }
+        return shared->mesh;
+    }
+    shared = g_slice_new(_SharedMesh);
+    shared->mesh = mesh;
+    shared->ref = 1;
+    shared->digest = digest;
+    g_hash_table_insert(mesh_cache.digests, shared->digest, shared);
+    g_hash_table_insert(mesh_cache.meshes, mesh, shared);
+    g_mutex_unlock(&mesh_cache.lock);
+    return mesh;
+}
+
+/*
+ * _mesh_unshare:
+ *
+ * Returns TRUE if @mesh is not shared anymore and must be freed.
+ */
+static gboolean
+_mesh_unshare(
+    gpointer            mesh
+    )
+{
+    _SharedMesh* shared = NULL;
+
+    g_mutex_lock(&mesh_cache.lock);
+    if(mesh_cache.meshes != NULL)
+    {
+        shared = g_hash_table_lookup(mesh_cache.meshes, mesh);
+    }
+    if(shared != NULL)
+    {
+        if(--shared->ref > 0)
+        {
+            g_mutex_unlock(&mesh_cache.lock);
+            return FALSE;
+        }
+        g_hash_table_remove(mesh_cache.meshes, mesh);
+        g_hash_table_remove(mesh_cache.digests, shared->digest);
+        g_free(shared->digest);
+        g_slice_free(_SharedMesh, shared);
+    }
+    g_mutex_unlock(&mesh_cache.lock);
+    return TRUE;
 }
 
 /**
  * r_mesh_new_from_file:
  *
+ * The meshes loaded from the same file contents with the same skin are
+ * shared, r_mesh_free() releases them once per call.
  **/
 RMesh*
 r_mesh_new_from_file(
@@ -307,24 +1728,27 @@ r_mesh_new_from_file(
     RMaterial*              default_skin
     )
 {
+    const gchar* file_names[2] = {file_name, NULL};
     _RMesh* self;
+    gchar* digest;
     guint   i;
     
     g_assert(GLEW_ARB_vertex_buffer_object);
     g_assert(file_name != NULL);
 
-    self = SELF(r_modules_lookup(file_name)->load_from_file(file_name));
-    if(self == NULL)
+    digest = _mesh_digest(file_names, R_MESH_CACHE_MESH, default_skin);
+    self = SELF(_mesh_share(digest));
+    if(self != NULL)
     {
-        return NULL;
+        g_free(digest);
+        return (RMesh*) self;
     }
-    
-    if(default_skin != NULL)
+
+    self = SELF(_mesh_load(file_name, R_MESH_CACHE_MESH, default_skin));
+    if(self == NULL)
     {
-        for(i = 0; i < self->parts_count; i++)
-        {
-            self->parts[i].skin = default_skin;
-        }
+        g_free(digest);
+        return NULL;
     }
     
     for(i = 0; i < self->parts_count; i++)
@@ -332,9 +1756,14 @@ r_mesh_new_from_file(
         g_assert(self->parts[i].skin != NULL);
     }
 
+    if(self->frames_count == 1)
+    {
+        _mesh_collision_get(self, 0);
+    }
+
     r_renderer_execute((GThreadFunc) _mesh_new_delegate, self);
     
-    return (RMesh*) self;
+    return (RMesh*) _mesh_publish(digest, self, R_MESH_CACHE_MESH);
 }
 
 /**
@@ -347,47 +1776,73 @@ r_mesh_new_from_files(
     RMaterial*              default_skin
     )
 {
+    _RMesh** meshes;
     _RMesh* self;
-    _RMesh* other;
-    guint i;    
+    guint files_count;
+    gboolean result;
+    gchar* digest;
+    guint i;
 
     g_assert(GLEW_ARB_vertex_buffer_object);
     g_assert(file_names != NULL);
     g_assert(file_names[0] != NULL);
-    
-    self = SELF(r_modules_lookup(file_names[0])->load_from_file(file_names[0]));
-    if(self == NULL)
+
+    digest = _mesh_digest(file_names, R_MESH_CACHE_MESH, default_skin);
+    self = SELF(_mesh_share(digest));
+    if(self != NULL)
     {
-        return NULL;
+        g_free(digest);
+        return (RMesh*) self;
     }
-    
-    for(i = 1; file_names[i] != NULL; i++)
+
+    /*
+     * the keyframes are read inline, this already runs in a loader job, the
+     * first one welded and the others only gathered through its corners
+     */
+    files_count = g_strv_length((gchar**) file_names);
+    meshes = g_new0(_RMesh*, files_count);
+    meshes[0] = SELF(_mesh_read(file_names[0], R_MESH_CACHE_MESH));
+    result = meshes[0] != NULL;
+    for(i = 1; result && i < files_count; i++)
     {
-        other = SELF(r_modules_lookup(file_names[i])->load_from_file(file_names[i]));
-        if(other == NULL)
-        {
-            return NULL;
-        }
-        _r_mesh_concat(self, other);
-        _r_mesh_free(other);
+        meshes[i] = _mesh_read_frame(file_names[i]);
+        result = meshes[i] != NULL;
     }
-    
-    if(default_skin != NULL)
+    if(result && !_mesh_gather_frames(meshes[0], meshes, files_count))
+    {
+        g_warning("%s: keyframes don't share the same topology", file_names[0]);
+        result = FALSE;
+    }
+
+    self = result ? meshes[0] : NULL;
+    for(i = 0; i < files_count; i++)
     {
-        for(i = 0; i < self->parts_count; i++)
+        if(meshes[i] != NULL && meshes[i] != self)
         {
-            self->parts[i].skin = default_skin;
+            _r_mesh_free(meshes[i]);
         }
     }
+    g_free(meshes);
+    if(self == NULL)
+    {
+        g_free(digest);
+        return NULL;
+    }
+    _mesh_skins_ref(self, default_skin);
     
     for(i = 0; i < self->parts_count; i++)
     {
         g_assert(self->parts[i].skin != NULL);
     }
 
+    if(self->frames_count == 1)
+    {
+        _mesh_collision_get(self, 0);
+    }
+
     r_renderer_execute((GThreadFunc) _mesh_new_delegate, self);
     
-    return (RMesh*) self;
+    return (RMesh*) _mesh_publish(digest, self, R_MESH_CACHE_MESH);
 }
 
 /**
@@ -399,12 +1854,48 @@ r_mesh_free(
     RMesh*              mesh
     )
 {
-    if(mesh != NULL)
+    if(mesh != NULL && _mesh_unshare(mesh))
     {
+        _mesh_skins_unref(SELF(mesh));
         r_renderer_execute((GThreadFunc) _mesh_free_delegate, SELF(mesh));
     }
 }
 
+/**
+ * r_mesh_get_size:
+ *
+ * Returns the bytes used by @mesh in system and in video memory.
+ **/
+void
+r_mesh_get_size(
+    RMesh*              mesh,
+    gsize*              cpu_size,
+    gsize*              gpu_size
+    )
+{
+    _RMesh* self = SELF(mesh);
+    gsize vertices_size;
+    gsize triangles_size;
+    guint i;
+
+    g_assert(mesh != NULL);
+    g_assert(cpu_size != NULL);
+    g_assert(gpu_size != NULL);
+
+    vertices_size = (gsize) self->vertice_count * sizeof(RMeshElement);
+    triangles_size = (gsize) self->triangles_count * 3 * sizeof(guint);
+
+    *cpu_size = sizeof(_RMesh) + self->frames_count * vertices_size + triangles_size + self->parts_count * sizeof(RMeshPart);
+    for(i = 0; self->collisions != NULL && i < self->frames_count; i++)
+    {
+        if(self->collisions[i] != NULL)
+        {
+            *cpu_size += self->collisions[i]->triangles_count * sizeof(_MeshCollisionTriangle);
+        }
+    }
+    *gpu_size = vertices_size + triangles_size;
+}
+
 /**
  * r_mesh_compute_bbox:
  *
@@ -464,61 +1955,32 @@ r_mesh_collide(
     float3*                 reaction
     )
 {
-    gboolean result = FALSE;
-    guint* i;
-    guint j;
-    float3 r = {0.0f, 0.0f, 0.0f};
-    float3 s = {1.0f / bbox[1].x, 1.0f / bbox[1].y, 1.0f / bbox[1].z};
-    float3 t[3];
-    float3* a;
-    float3 b;
-    float4 p;
-    float l;
+    _MeshCollideContext context;
+    _MeshCollision* collision;
     
     g_assert(mesh != NULL);
     g_assert(frame < mesh->frames_count);
     g_assert(bbox != NULL);
     g_assert(reaction != NULL);
 
-    for(i = &SELF(mesh)->triangles[0]; i < (const guint*) &SELF(mesh)->triangles[mesh->triangles_count * 3];)
-    {
-        for(j = 0; j < 3; j++, i++)
-        {
-            a = &mesh->frames[frame][*i].point;
-            t[j].x = (a->x - bbox[0].x) * s.x;
-            t[j].y = (a->y - bbox[0].y) * s.y;
-            t[j].z = (a->z - bbox[0].z) * s.z;
-        }
-        
-        r_triangle_to_plane(t, &p);
-        if((p.w < 0) || (p.w > 1.0f))
-        {
-            continue;
-        }
+    collision = _mesh_collision_get(SELF(mesh), frame);
+    context.triangles = collision->triangles;
+    context.bbox = bbox;
+    context.r.x = 0.0f;
+    context.r.y = 0.0f;
+    context.r.z = 0.0f;
+    context.result = FALSE;
 
-        b.x = -p.x * p.w;
-        b.y = -p.y * p.w;
-        b.z = -p.z * p.w;
-        if(!r_triangle_contain_point(t, &b))
-        {
-            continue;
-        }
-        
-        l = 1.0f - p.w;
-        r.x += l * p.x;
-        r.y += l * p.y;
-        r.z += l * p.z;
-        result = TRUE;
-    }
+    r_bvh_query(collision->bvh, bbox, _mesh_collide_triangle, &context);
     
-    if(result)
+    if(context.result)
     {
-        reaction->x += r.x * bbox[1].x;
-        reaction->y += r.y * bbox[1].y;
-        reaction->z += r.z * bbox[1].z;
+        reaction->x += context.r.x * bbox[1].x;
+        reaction->y += context.r.y * bbox[1].y;
+        reaction->z += context.r.z * bbox[1].z;
     }
     
-    return result;
+    return context.result;
 }
 
 /**
@@ -583,8 +2045,10 @@ r_mesh_draw(
 }
 
 /**
- * r_mesh_draw_frame:
+ * r_mesh_draw_full:
  *
+ * Draws @mesh animated by its own clock, advanced by the time of the last
+ * frame. Returns FALSE once a non repeated animation is over.
  **/
 gboolean
 r_mesh_draw_full(
@@ -597,60 +2061,40 @@ r_mesh_draw_full(
     )
 {
     gboolean animating = TRUE;
-    RMeshPart* part;
     
     g_assert(mesh != NULL);
     g_assert(frame_first <= frame_last);
     g_assert(frame_last < mesh->frames_count);
     g_assert(frame_fps > 0);
     
-    if(view != NULL)
-    {
-        glLoadMatrixf((GLfloat*) view);
-    }
-    
-    glBindBufferARB(GL_ARRAY_BUFFER_ARB, SELF(mesh)->vertice_vbo);
     if(SELF(mesh)->frames_count > 1)
     {
-        RMeshElement* buffer = (RMeshElement*) glMapBufferARB(GL_ARRAY_BUFFER_ARB, GL_READ_WRITE_ARB);
-        animating = _mesh_frame_lerp(SELF(mesh), frame_first, frame_last, frame_fps, repeat_mode, buffer);
-        glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
-    }
-    
-    glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, SELF(mesh)->triangles_vbo);
-
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glVertexPointer(3, GL_FLOAT, sizeof(RMeshElement), VBO_OFFSET(RMeshElement, point));
-
-    glEnableClientState(GL_NORMAL_ARRAY);
-    glNormalPointer(GL_FLOAT, sizeof(RMeshElement), VBO_OFFSET(RMeshElement, normal));
-
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-    glTexCoordPointer(2, GL_FLOAT, sizeof(RMeshElement), VBO_OFFSET(RMeshElement, texcoord));
-    
-    for(part = &SELF(mesh)->parts[0]; part < (const RMeshPart*) &SELF(mesh)->parts[SELF(mesh)->parts_count]; part++)
-    {
-        if(part->skin->texture != R_TEXTURE_NONE)
-        {
-            glBindTexture(GL_TEXTURE_2D, part->skin->texture);
-            glEnable(GL_TEXTURE_2D);
-        }
-        else
-        {
-            glMaterialfv(GL_FRONT, GL_DIFFUSE, (gfloat*) &part->skin->color);
-            glDisable(GL_TEXTURE_2D);
-        }
-        glDrawElements(GL_TRIANGLES, part->count, GL_UNSIGNED_INT, VBO_OFFSET0(part->offset));
+        animating = _mesh_frame_advance(SELF(mesh), frame_first, frame_last, frame_fps, repeat_mode);
     }
+    _mesh_draw_frame(view, SELF(mesh), frame_first, frame_last, mesh->anim_time);
+    return animating;
+}
 
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
-    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-    glDisable(GL_TEXTURE_2D);
+/**
+ * r_mesh_draw_frame:
+ *
+ * Draws @mesh at the time @frame, counted in frames from @frame_first, of
+ * an animation clocked by the caller. @mesh itself is left untouched.
+ **/
+void
+r_mesh_draw_frame(
+    float4x4*               view,
+    RMesh*                  mesh,
+    guint                   frame_first,
+    guint                   frame_last,
+    gfloat                  frame
+    )
+{
+    g_assert(mesh != NULL);
+    g_assert(frame_first <= frame_last);
+    g_assert(frame_last < mesh->frames_count);
     
-    return animating;
+    _mesh_draw_frame(view, SELF(mesh), frame_first, frame_last, frame);
 }
 
 /**
@@ -677,35 +2121,42 @@ r_meshgroup_new_from_file(
     RMaterial*              default_skin
     )
 {
+    const gchar* file_names[2] = {file_name, NULL};
     RMeshGroup* self;
     RMesh* group;
     GHashTableIter iter;
-    guint   i;
+    gchar* digest;
     
     g_assert(GLEW_ARB_vertex_buffer_object);
     g_assert(file_name != NULL);
 
-    self = (RMeshGroup*)r_modules_lookup(file_name)->load_from_file(file_name);
+    digest = _mesh_digest(file_names, R_MESH_CACHE_MESHGROUP, default_skin);
+    self = _mesh_share(digest);
+    if(self != NULL)
+    {
+        g_free(digest);
+        return self;
+    }
+
+    self = (RMeshGroup*) _mesh_load(file_name, R_MESH_CACHE_MESHGROUP, default_skin);
     if(self == NULL)
     {
+        g_free(digest);
         return NULL;
     }
     
     g_hash_table_iter_init(&iter, self->groups);
     while (g_hash_table_iter_next(&iter, NULL, (gpointer)&group))
     {
-        if(default_skin != NULL)
+        if(group->frames_count == 1)
         {
-            for(i = 0; i < group->parts_count; i++)
-            {
-                group->parts[i].skin = default_skin;
-            }
+            _mesh_collision_get(SELF(group), 0);
         }
         
         r_renderer_execute((GThreadFunc) _mesh_new_delegate, group);
     }
 
-    return self;
+    return _mesh_publish(digest, self, R_MESH_CACHE_MESHGROUP);
 }
 
 /**
@@ -717,7 +2168,40 @@ r_meshgroup_free(
     RMeshGroup*             meshgroup
     )
 {
-    g_hash_table_destroy(meshgroup->groups);
+    if(_mesh_unshare(meshgroup))
+    {
+        g_hash_table_destroy(meshgroup->groups);
+    }
+}
+
+/**
+ * r_meshgroup_get_size:
+ *
+ **/
+void
+r_meshgroup_get_size(
+    RMeshGroup*             meshgroup,
+    gsize*                  cpu_size,
+    gsize*                  gpu_size
+    )
+{
+    GHashTableIter iter;
+    RMesh* group;
+    gsize group_cpu_size, group_gpu_size;
+
+    g_assert(meshgroup != NULL);
+    g_assert(cpu_size != NULL);
+    g_assert(gpu_size != NULL);
+
+    *cpu_size = sizeof(RMeshGroup);
+    *gpu_size = 0;
+    g_hash_table_iter_init(&iter, meshgroup->groups);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer)&group))
+    {
+        r_mesh_get_size(group, &group_cpu_size, &group_gpu_size);
+        *cpu_size += group_cpu_size;
+        *gpu_size += group_gpu_size;
+    }
 }
 
 /**
@@ -732,3 +2216,131 @@ r_meshgroup_get(
 {
     return g_hash_table_lookup(meshgroup->groups, group_name);
 }
+
+/*
+ * _mesh_release:
+ *
+ */
+static void
+_mesh_release(
+    _RMesh*             self,
+    gpointer            user_data
+    )
+{
+    _r_mesh_free(self);
+}
+
+/*
+ * _mesh_bake_free:
+ *
+ * Frees a RMesh or a RMeshGroup which never reached the renderer.
+ */
+static void
+_mesh_bake_free(
+    gpointer            data,
+    guint               kind
+    )
+{
+    GHashTableIter iter;
+    gchar* name;
+
+    _mesh_foreach(data, kind, _mesh_release, NULL);
+    if(kind == R_MESH_CACHE_MESHGROUP)
+    {
+        /* the meshes are gone, only their names are left to free */
+        g_hash_table_iter_init(&iter, ((RMeshGroup*) data)->groups);
+        while(g_hash_table_iter_next(&iter, (gpointer) &name, NULL))
+        {
+            g_hash_table_iter_steal(&iter);
+            g_free(name);
+        }
+        g_hash_table_destroy(((RMeshGroup*) data)->groups);
+        g_slice_free(RMeshGroup, data);
+    }
+}
+
+/**
+ * r_mesh_bake:
+ *
+ * Loads @file_name through its module, optimizes its vertex order and
+ * writes its .rmesh cache. Neither GL nor the resource manager is touched,
+ * so it runs headless and from several threads at once. @meshgroup selects
+ * the form the game will ask for, r_meshgroup_new_from_file or
+ * r_mesh_new_from_file. Returns FALSE if the source can't be loaded or the
+ * cache can't be written.
+ **/
+gboolean
+r_mesh_bake(
+    const gchar*            file_name,
+    gboolean                meshgroup
+    )
+{
+    gpointer data;
+    gchar* cache_name;
+    guint kind;
+    gboolean result;
+
+    g_assert(file_name != NULL);
+
+    data = r_modules_lookup(file_name)->load_from_file(file_name);
+    if(data == NULL)
+    {
+        return FALSE;
+    }
+
+    kind = meshgroup ? R_MESH_CACHE_MESHGROUP : R_MESH_CACHE_MESH;
+    _mesh_foreach(data, kind, _mesh_optimize, NULL);
+    cache_name = _mesh_cache_get_name(file_name, FALSE);
+    result = _mesh_cache_save(file_name, cache_name, kind, data);
+    g_free(cache_name);
+    _mesh_bake_free(data, kind);
+    return result;
+}
+
+/**
+ * r_mesh_bake_is_fresh:
+ *
+ * Returns TRUE when the .rmesh cache of @file_name is up to date.
+ **/
+gboolean
+r_mesh_bake_is_fresh(
+    const gchar*            file_name,
+    gboolean                meshgroup
+    )
+{
+    g_assert(file_name != NULL);
+
+    return _mesh_cache_is_fresh(file_name, meshgroup ? R_MESH_CACHE_MESHGROUP : R_MESH_CACHE_MESH);
+}
+
+/**
+ * r_meshgroup_bake_load:
+ *
+ * Returns the mesh group of @file_name as the game will load it, from its
+ * .rmesh cache when it is up to date, without any GL object or skin, so
+ * that tools can bake data derived from it. Release it with
+ * r_meshgroup_bake_free().
+ **/
+RMeshGroup*
+r_meshgroup_bake_load(
+    const gchar*            file_name
+    )
+{
+    g_assert(file_name != NULL);
+
+    return (RMeshGroup*) _mesh_read(file_name, R_MESH_CACHE_MESHGROUP);
+}
+
+/**
+ * r_meshgroup_bake_free:
+ *
+ **/
+void
+r_meshgroup_bake_free(
+    RMeshGroup*             meshgroup
+    )
+{
+    g_assert(meshgroup != NULL);
+
+    _mesh_bake_free(meshgroup, R_MESH_CACHE_MESHGROUP);
+}
@@ -114,3 +114,62 @@ r_modules_lookup(
     return module_factory->get_instance();
 }
 
+/**
+ * r_modules_load:
+ *
+ * Loads @file_name with its module, from the mounted paks when it is
+ * packed there, from the file system otherwise.
+ **/
+gpointer
+r_modules_load(
+    const gchar*      file_name
+    )
+{
+    RModule* module;
+    gconstpointer data;
+    gsize length;
+
+    module = r_modules_lookup(file_name);
+    if(r_pak_lookup(file_name, &data, &length, NULL))
+    {
+        return module->load_from_data(file_name, data, length);
+    }
+    return module->load_from_file(file_name);
+}
+
+/**
+ * r_modules_load_frame:
+ *
+ * Loads @file_name as a keyframe of an animation, one element per
+ * triangle corner and nothing welded. Modules without keyframes load it
+ * as r_modules_load() does.
+ **/
+gpointer
+r_modules_load_frame(
+    const gchar*      file_name
+    )
+{
+    RModule* module;
+    GMappedFile* file;
+    gconstpointer data;
+    gsize length;
+    gpointer result;
+
+    module = r_modules_lookup(file_name);
+    if(module->load_frame_from_data == NULL)
+    {
+        return r_modules_load(file_name);
+    }
+    if(r_pak_lookup(file_name, &data, &length, NULL))
+    {
+        return module->load_frame_from_data(file_name, data, length);
+    }
+    file = g_mapped_file_new(file_name, FALSE, NULL);
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    result = module->load_frame_from_data(file_name, g_mapped_file_get_contents(file), g_mapped_file_get_length(file));
+    g_mapped_file_unref(file);
+    return result;
+}
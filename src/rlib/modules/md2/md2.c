@@ -20,15 +20,17 @@
  */
 
 #include <rlib.h>
-#include <stdio.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <unistd.h>
 #include <memory.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
 #include "md2_normals.h"
 
 #define MD2_IDENT                (('2'<<24) + ('P'<<16) + ('D'<<8) + 'I')
 #define MD2_VERSION              8
+#define MD2_FRAMES_MIN_COUNT     16
+#define MD2_SCALE                0.02f
 
 struct _MD2Header
 {
@@ -88,92 +90,276 @@ struct _MD2Frame
 };
 typedef struct _MD2Frame MD2Frame;
 
+struct _MD2Decoder
+{
+    const MD2Header*    header;
+    gconstpointer       data;
+    const MD2Triangle*  triangles;
+    const guint*        corners;
+    RMesh*              mesh;
+    guint               first_frame;
+    guint               last_frame;
+};
+typedef struct _MD2Decoder MD2Decoder;
+
+/*
+ * _is_range_valid:
+ *
+ */
+static gboolean
+_is_range_valid(
+    gsize           length,
+    gint32          offset,
+    gint32          count,
+    gsize           size
+    )
+{
+    return offset >= 0 && count >= 0 && (gsize) offset <= length && (gsize) count <= (length - offset) / size;
+}
+
+/*
+ * _decode_point:
+ *
+ * Dequantizes a vertex of @frame, already swapped to the engine axes.
+ */
+static inline void
+_decode_point(
+    const MD2Frame*     frame,
+    guint               k,
+    RMeshElement*       element
+    )
+{
+    const MD2Vertex* vertex = &frame->vertices[k];
+    const gfloat* normal = fast_normals[vertex->normal];
+
+#if defined(__SSE2__)
+    __m128 scale = _mm_setr_ps(-frame->scale[0], frame->scale[2], -frame->scale[1], 0.0f);
+    __m128 translate = _mm_setr_ps(-frame->translate[0], frame->translate[2], -frame->translate[1], 0.0f);
+    __m128 point = _mm_cvtepi32_ps(_mm_setr_epi32(vertex->point[0], vertex->point[2], vertex->point[1], 0));
+
+    /* stores 4 floats, the 4th lands on normal.x which is written below */
+    _mm_storeu_ps(&element->point.x, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(point, scale), translate), _mm_set1_ps(MD2_SCALE)));
+#else
+    element->point.x = ((gfloat) vertex->point[0] * -frame->scale[0] + -frame->translate[0]) * MD2_SCALE;
+    element->point.y = ((gfloat) vertex->point[2] * frame->scale[2] + frame->translate[2]) * MD2_SCALE;
+    element->point.z = ((gfloat) vertex->point[1] * -frame->scale[1] + -frame->translate[1]) * MD2_SCALE;
+#endif
+    element->normal.x = -normal[0];
+    element->normal.y = +normal[2];
+    element->normal.z = -normal[1];
+}
+
+/*
+ * _frame_get_matrix:
+ *
+ * The dequantization of @frame as a matrix, for points read in (x, z, y)
+ * order. Same axes as _decode_point.
+ */
+static float4x4*
+_frame_get_matrix(
+    const MD2Frame*     frame,
+    float4x4*           m
+    )
+{
+    r_matrix_identity_set(m);
+    m->m00 = -frame->scale[0] * MD2_SCALE;
+    m->m11 = frame->scale[2] * MD2_SCALE;
+    m->m22 = -frame->scale[1] * MD2_SCALE;
+    m->m30 = -frame->translate[0] * MD2_SCALE;
+    m->m31 = frame->translate[2] * MD2_SCALE;
+    m->m32 = -frame->translate[1] * MD2_SCALE;
+    return m;
+}
+
+/*
+ * _decode_frames:
+ *
+ * Decodes the frames [first_frame, last_frame[ through the corner remap,
+ * runs in its own thread. The points of a frame are gathered then
+ * dequantized in one batch.
+ */
 static gpointer
-_load_from_file(
-    const gchar*      file_name
+_decode_frames(
+    gpointer            data
+    )
+{
+    MD2Decoder* decoder = data;
+    const MD2Frame* frame;
+    const MD2Vertex* vertex;
+    const gfloat* normal;
+    const guint8* frames;
+    RMeshElement* elements;
+    float3* points;
+    float4x4 m;
+    guint corner;
+    guint i, j;
+
+    points = g_new(float3, decoder->mesh->vertice_count);
+    frames = (const guint8*) decoder->data + decoder->header->ofs_frames;
+    for(i = decoder->first_frame; i < decoder->last_frame; i++)
+    {
+        frame = (const MD2Frame*) (frames + (gsize) i * decoder->header->framesize);
+        elements = decoder->mesh->frames[i];
+        for(j = 0; j < decoder->mesh->vertice_count; j++)
+        {
+            corner = decoder->corners[j];
+            vertex = &frame->vertices[decoder->triangles[corner / 3].index_vertex[corner % 3]];
+            normal = fast_normals[vertex->normal];
+            points[j].x = vertex->point[0];
+            points[j].y = vertex->point[2];
+            points[j].z = vertex->point[1];
+            elements[j].normal.x = -normal[0];
+            elements[j].normal.y = +normal[2];
+            elements[j].normal.z = -normal[1];
+            elements[j].texcoord = decoder->mesh->frames[0][j].texcoord;
+        }
+
+        r_math_transform_points(_frame_get_matrix(frame, &m), points, points, decoder->mesh->vertice_count);
+        for(j = 0; j < decoder->mesh->vertice_count; j++)
+        {
+            elements[j].point = points[j];
+        }
+    }
+    g_free(points);
+    return NULL;
+}
+
+static gpointer
+_load_from_data(
+    const gchar*      file_name,
+    gconstpointer     data,
+    gsize             length
     )
 {
     RMesh* mesh;
-    FILE* stream;
+    RMeshWelder* welder;
+    MD2Decoder* decoders;
+    GThread** threads;
+    RMeshElement* elements;
+    guint* indices;
+    guint* corners;
+    guint vertice_count;
     guint i, j, k;
+    guint decoders_count;
     MD2Header header;
-    MD2Texcoord* texcoords;
-    MD2Triangle* triangles;
-    MD2Frame* frame;
+    const MD2Texcoord* texcoords;
+    const MD2Triangle* triangles;
+    const MD2Frame* frame;
     RMeshElement element;
 
-    stream = fopen(file_name, "rb");
-    if(stream == NULL)
+    if(length < sizeof(MD2Header))
     {
         return NULL;
     }
+    memcpy(&header, data, sizeof(MD2Header));
 
-    fread(&header, sizeof(MD2Header), 1, stream);
-
-    if(header.ident != MD2_IDENT || header.version != MD2_VERSION)
+    if(header.ident != MD2_IDENT || header.version != MD2_VERSION ||
+        header.num_tris <= 0 || header.num_frames <= 0 || header.num_xyz <= 0 ||
+        header.framesize < (gint32) G_STRUCT_OFFSET(MD2Frame, vertices) ||
+        (header.framesize - G_STRUCT_OFFSET(MD2Frame, vertices)) / sizeof(MD2Vertex) < (gsize) header.num_xyz ||
+        !_is_range_valid(length, header.ofs_st, header.num_st, sizeof(MD2Texcoord)) ||
+        !_is_range_valid(length, header.ofs_tris, header.num_tris, sizeof(MD2Triangle)) ||
+        !_is_range_valid(length, header.ofs_frames, header.num_frames, header.framesize))
     {
-        fclose(stream);
         return NULL;
     }
 
-    texcoords = g_new0(MD2Texcoord, header.num_st);
-    fseek(stream, header.ofs_st, SEEK_SET);
-    fread(texcoords, header.num_st * sizeof(MD2Texcoord), 1, stream);
-
-    triangles = g_new0(MD2Triangle, header.num_tris);
-    fseek(stream, header.ofs_tris, SEEK_SET);
-    fread(triangles, header.num_tris * sizeof(MD2Triangle), 1, stream);
-
-    frame = g_new0(MD2Frame, header.framesize);
-    fseek(stream, header.ofs_frames, SEEK_SET);
+    texcoords = (const MD2Texcoord*) ((const guint8*) data + header.ofs_st);
+    triangles = (const MD2Triangle*) ((const guint8*) data + header.ofs_tris);
+    for(j = 0; j < header.num_tris * 3; j++)
+    {
+        if((guint16) triangles[j / 3].index_vertex[j % 3] >= header.num_xyz ||
+            (guint16) triangles[j / 3].index_texcoord[j % 3] >= header.num_st)
+        {
+            g_warning("%s: triangle %d out of range", file_name, j / 3);
+            return NULL;
+        }
+    }
 
-    mesh = r_mesh_new(header.num_frames, header.num_tris * 3, 1, header.num_tris);
-    mesh->vertice_count = 0;
-    
-    for(i = 0; i < header.num_frames; i++)
+    /* weld the corners of the first frame and remember a corner for each vertex */
+    elements = g_new(RMeshElement, header.num_tris * 3);
+    indices = g_new(guint, header.num_tris * 3);
+    corners = g_new(guint, header.num_tris * 3);
+    welder = r_mesh_welder_new(elements, header.num_tris * 3, R_MESH_WELD_EPSILON);
+    vertice_count = 0;
+    frame = (const MD2Frame*) ((const guint8*) data + header.ofs_frames);
+    for(j = 0; j < header.num_tris * 3; j++)
     {
-        fread(frame, header.framesize, 1, stream);
+        _decode_point(frame, triangles[j / 3].index_vertex[j % 3], &element);
+        k = triangles[j / 3].index_texcoord[j % 3];
+        element.texcoord.x = (gfloat) texcoords[k].s / header.skinwidth;
+        element.texcoord.y = (gfloat) texcoords[k].t / header.skinheight;
 
-        for(j = 0; j < header.num_tris * 3; j++)
+        if(r_mesh_welder_insert(welder, vertice_count, &element, &indices[j]))
         {
-            k = triangles[j / 3].index_vertex[j % 3];
-            element.point.x = (-(gfloat) frame->vertices[k].point[0] * frame->scale[0] - frame->translate[0]) * 0.02f;
-            element.point.y = (+(gfloat) frame->vertices[k].point[2] * frame->scale[2] + frame->translate[2]) * 0.02f;
-            element.point.z = (-(gfloat) frame->vertices[k].point[1] * frame->scale[1] - frame->translate[1]) * 0.02f;
-
-            element.normal.x = -fast_normals[frame->vertices[k].normal][0];
-            element.normal.y = +fast_normals[frame->vertices[k].normal][2];
-            element.normal.z = -fast_normals[frame->vertices[k].normal][1];
-
-            k = triangles[j / 3].index_texcoord[j % 3];
-            element.texcoord.x = (gfloat) texcoords[k].s / header.skinwidth;
-            element.texcoord.y = (gfloat) texcoords[k].t / header.skinheight;
-
-            if(i == 0)
-            {
-                if(r_mesh_element_insert(mesh->frames[0], mesh->vertice_count, &element, &mesh->triangles[j]))
-                {
-                    mesh->vertice_count++;
-                }
-            }
-            else
-            {
-                r_mesh_element_replace(mesh->frames[i], mesh->triangles[j], &element);
-            }
+            vertice_count++;
         }
+        corners[indices[j]] = j;
+    }
+    r_mesh_welder_free(welder);
+
+    /* the frames are allocated once the vertice count is known */
+    mesh = r_mesh_new(header.num_frames, vertice_count, 1, header.num_tris);
+    memcpy(mesh->frames[0], elements, vertice_count * sizeof(RMeshElement));
+    memcpy(mesh->triangles, indices, header.num_tris * 3 * sizeof(guint));
+    g_free(indices);
+    g_free(elements);
+
+    /* then the other frames only decode these corners, in parallel */
+    decoders_count = CLAMP((header.num_frames - 1) / MD2_FRAMES_MIN_COUNT, 1, (guint) MAX(r_thread_get_cpu_count(), 1));
+    decoders = g_new(MD2Decoder, decoders_count);
+    threads = g_new0(GThread*, decoders_count);
+    for(i = 0; i < decoders_count; i++)
+    {
+        decoders[i].header = &header;
+        decoders[i].data = data;
+        decoders[i].triangles = triangles;
+        decoders[i].corners = corners;
+        decoders[i].mesh = mesh;
+        decoders[i].first_frame = 1 + (header.num_frames - 1) * i / decoders_count;
+        decoders[i].last_frame = 1 + (header.num_frames - 1) * (i + 1) / decoders_count;
+    }
+    for(i = 1; i < decoders_count; i++)
+    {
+        threads[i] = g_thread_new("md2_frames", _decode_frames, &decoders[i]);
+    }
+    _decode_frames(&decoders[0]);
+    for(i = 1; i < decoders_count; i++)
+    {
+        g_thread_join(threads[i]);
     }
 
-    g_free(frame);
-    g_free(triangles);
-    g_free(texcoords);
-    fclose(stream);
+    g_free(threads);
+    g_free(decoders);
+    g_free(corners);
 
     return mesh;
 }
 
+static gpointer
+_load_from_file(
+    const gchar*      file_name
+    )
+{
+    GMappedFile* file;
+    gpointer result;
+
+    file = g_mapped_file_new(file_name, FALSE, NULL);
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    result = _load_from_data(file_name, g_mapped_file_get_contents(file), g_mapped_file_get_length(file));
+    g_mapped_file_unref(file);
+
+    return result;
+}
+
 static RModule singleton =
 {
-    _load_from_file
+    _load_from_file,
+    _load_from_data,
+    NULL
 };
 
 static RModule*
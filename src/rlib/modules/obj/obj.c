@@ -21,9 +21,7 @@
  */
 
 #include <rlib.h>
-#include <stdio.h>
 #include <string.h>
-#include <errno.h>
 
 enum
 {
@@ -36,9 +34,17 @@ enum
     R_SYMBOL_EOF
 };
 
+enum
+{
+    OBJ_EVENT_OBJECT,
+    OBJ_EVENT_PART
+};
+
+#define OBJ_CHUNK_MIN_SIZE (256 * 1024)
+
 struct _OBJPart
 {
-    RMaterial*      material;
+    gchar*          material_name;
     guint           offset;
     guint           count;
 };
@@ -53,22 +59,41 @@ struct _OBJTriangle
 };
 typedef struct _OBJTriangle OBJTriangle;
 
+struct _OBJEvent
+{
+    guint           type;
+    gchar*          name;
+    guint           triangle;
+};
+typedef struct _OBJEvent OBJEvent;
+
 struct _OBJCompiler
 {
     guint           line;
     guint           pos;
-    gchar*          token;
-    gchar**         buffer;
+    const gchar*    token;
+    guint           token_length;
+    const gchar*    cursor;
+    const gchar*    line_end;
+    const gchar*    next_line;
+    const gchar*    end;
+    GString*        string;
+    gboolean        failed;
+    guint           error_line;
+    guint           error_pos;
+    guint           error_symbol;
     
     GArray*         points;
     GArray*         texcoords;
     GArray*         normals;
     GArray*         parts;
     GArray*         triangles;
+    GArray*         events;
     
     GHashTable*     objects;
     gchar*          current_object_name;
     gboolean        output;
+    gboolean        weld;
 };
 typedef struct _OBJCompiler OBJCompiler;
 
@@ -83,19 +108,159 @@ const gchar* symbol_string[] =
     "end of file"
 };
 
+static const gdouble power_of_ten[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static gboolean
+_parse_int(
+    const gchar*    token,
+    guint           length,
+    gint*           value
+    )
+{
+    const gchar* end;
+    gboolean negative;
+    gint64 result;
+    
+    end = token + length;
+    negative = (token < end && *token == '-');
+    if(token < end && (*token == '-' || *token == '+'))
+    {
+        token++;
+    }
+    if(token == end)
+    {
+        return FALSE;
+    }
+    
+    for(result = 0; token < end; token++)
+    {
+        if(*token < '0' || *token > '9')
+        {
+            return FALSE;
+        }
+        result = result * 10 + (*token - '0');
+        if(result > G_MAXINT)
+        {
+            return FALSE;
+        }
+    }
+    
+    *value = (gint) (negative ? -result : result);
+    return TRUE;
+}
+
+static gboolean
+_parse_float(
+    const gchar*    token,
+    guint           length,
+    gfloat*         value
+    )
+{
+    const gchar* end;
+    gboolean negative;
+    gboolean digits;
+    guint64 mantissa;
+    gint exponent;
+    gint scale;
+    gint sign;
+    gdouble result;
+    
+    end = token + length;
+    negative = (token < end && *token == '-');
+    if(token < end && (*token == '-' || *token == '+'))
+    {
+        token++;
+    }
+    
+    mantissa = 0;
+    exponent = 0;
+    digits = FALSE;
+    for(; token < end && *token >= '0' && *token <= '9'; token++, digits = TRUE)
+    {
+        if(mantissa < G_GUINT64_CONSTANT(1000000000000000000))
+        {
+            mantissa = mantissa * 10 + (*token - '0');
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if(token < end && *token == '.')
+    {
+        for(token++; token < end && *token >= '0' && *token <= '9'; token++, digits = TRUE)
+        {
+            if(mantissa < G_GUINT64_CONSTANT(1000000000000000000))
+            {
+                mantissa = mantissa * 10 + (*token - '0');
+                exponent--;
+            }
+        }
+    }
+    if(!digits)
+    {
+        return FALSE;
+    }
+    
+    if(token < end && (*token == 'e' || *token == 'E'))
+    {
+        token++;
+        sign = 1;
+        if(token < end && (*token == '-' || *token == '+'))
+        {
+            sign = (*token++ == '-') ? -1 : 1;
+        }
+        if(token == end)
+        {
+            return FALSE;
+        }
+        for(scale = 0; token < end && *token >= '0' && *token <= '9'; token++)
+        {
+            scale = MIN(scale * 10 + (*token - '0'), 1000);
+        }
+        exponent += sign * scale;
+    }
+    if(token != end)
+    {
+        return FALSE;
+    }
+    
+    result = (gdouble) mantissa;
+    for(; exponent > 22; exponent -= 22)
+    {
+        result *= power_of_ten[22];
+    }
+    for(; exponent < -22; exponent += 22)
+    {
+        result /= power_of_ten[22];
+    }
+    result = (exponent >= 0) ? result * power_of_ten[exponent] : result / power_of_ten[-exponent];
+    
+    *value = (gfloat) (negative ? -result : result);
+    return TRUE;
+}
+
 static gboolean
 _is_symbol_equals(
-    gchar*          token,
+    OBJCompiler*    compiler,
     guint           symbol,
     gpointer        value
     )
 {
+    const gchar* token = compiler->token;
+    guint length = compiler->token_length;
+    
     switch(symbol)
     {
         case R_SYMBOL_NONE:
             if(token != NULL)
             {
-                if(token[0] == '\0')
+                if(length == 0)
                 {
                     return TRUE;
                 }
@@ -103,9 +268,9 @@ _is_symbol_equals(
             break;
             
         case R_SYMBOL_IDENT:
-            if(token != NULL && token[0] != '\0')
+            if(token != NULL && length != 0)
             {
-                if(!g_strcmp0(token, (gchar*) value))
+                if(length == strlen((gchar*) value) && !memcmp(token, value, length))
                 {
                     return TRUE;
                 }
@@ -113,21 +278,20 @@ _is_symbol_equals(
             break;
             
         case R_SYMBOL_INT:
-            if(token != NULL && token[0] != '\0')
+            if(token != NULL && length != 0)
             {
-                *((gint*) value) = g_ascii_strtoll(token, NULL, 10) - 1;
-                if(errno != ERANGE)
+                if(_parse_int(token, length, (gint*) value))
                 {
+                    *((gint*) value) -= 1;
                     return TRUE;
                 }
             }
             break;
             
         case R_SYMBOL_FLOAT:
-            if(token != NULL && token[0] != '\0')
+            if(token != NULL && length != 0)
             {
-                *((gfloat*) value) = g_ascii_strtod(token, NULL);
-                if(errno != ERANGE)
+                if(_parse_float(token, length, (gfloat*) value))
                 {
                     return TRUE;
                 }
@@ -135,9 +299,11 @@ _is_symbol_equals(
             break;
             
         case R_SYMBOL_STRING:
-            if(token != NULL && token[0] != '\0')
+            if(token != NULL && length != 0)
             {
-                *((gchar**) value) = token;
+                g_string_truncate(compiler->string, 0);
+                g_string_append_len(compiler->string, token, length);
+                *((gchar**) value) = compiler->string->str;
                 return TRUE;
             }
             break;
@@ -159,39 +325,72 @@ _is_symbol_equals(
     return FALSE;
 }
 
+static void
+_next_token(
+    OBJCompiler*    compiler
+    )
+{
+    const gchar* p;
+    
+    if(compiler->cursor > compiler->line_end)
+    {
+        compiler->token = NULL;
+        return;
+    }
+    
+    for(p = compiler->cursor; p < compiler->line_end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '/'; p++);
+    compiler->token = compiler->cursor;
+    compiler->token_length = p - compiler->cursor;
+    compiler->cursor = p + 1;
+    compiler->pos++;
+}
+
+/*
+ * Tokens are slices of the mapped file: a line is split on blanks and '/'
+ * and a NULL token marks the end of the line, exactly as the former
+ * g_strsplit_set based reader did, but without copying anything.
+ */
 static gboolean
 _get_symbol(
     OBJCompiler*    compiler,
-    FILE*           stream
+    gboolean        next_line
     )
 {
-    gchar buffer[256];
+    const gchar* line;
+    const gchar* p;
     
-    if(stream != NULL)
+    if(next_line)
     {
         do
         {
-            g_strfreev(compiler->buffer);
-            compiler->buffer = NULL;
-            
-            if(!fgets(buffer, sizeof(buffer), stream))
+            if(compiler->next_line >= compiler->end)
             {
                 compiler->token = NULL;
                 return FALSE;
             }
             
-            compiler->buffer = g_strsplit_set(g_strchomp(g_strdelimit(buffer, "\t\r\n", ' ')), "/ ", -1);
+            line = compiler->next_line;
+            p = memchr(line, '\n', compiler->end - line);
+            compiler->next_line = (p != NULL) ? p + 1 : compiler->end;
+            for(p = compiler->next_line; p > line && (p[-1] == '\n' || p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\r'); p--);
+            
             compiler->line++;
             compiler->pos = 0;
-            compiler->token = compiler->buffer[compiler->pos++];
+            compiler->token = NULL;
+            if(p > line)
+            {
+                compiler->cursor = line;
+                compiler->line_end = p;
+                _next_token(compiler);
+            }
         }
-        while(compiler->token == NULL || compiler->token[0] == '#');
+        while(compiler->token == NULL || (compiler->token_length > 0 && compiler->token[0] == '#'));
     }
     else
     {
         if(compiler->token != NULL)
         {
-            compiler->token = compiler->buffer[compiler->pos++];
+            _next_token(compiler);
         }
     }
     return TRUE;
@@ -204,9 +403,9 @@ _accept(
     gpointer        value
     )
 {
-    if(_is_symbol_equals(compiler->token, symbol, value))
+    if(_is_symbol_equals(compiler, symbol, value))
     {
-        _get_symbol(compiler, NULL);
+        _get_symbol(compiler, FALSE);
         return TRUE;
     }
     return FALSE;
@@ -219,9 +418,12 @@ _expect(
     gpointer        value
     )
 {
-    if(!_accept(compiler, symbol, value))
+    if(!_accept(compiler, symbol, value) && !compiler->failed)
     {
-        g_error("line %d: %s expected at pos %d", compiler->line, symbol_string[symbol], compiler->pos);
+        compiler->failed = TRUE;
+        compiler->error_line = compiler->line;
+        compiler->error_pos = compiler->pos;
+        compiler->error_symbol = symbol;
     }
 }
 
@@ -231,18 +433,20 @@ _output_mesh(
     )
 {
     RMesh* mesh;
+    RMeshWelder* welder;
     guint i;
     gint k;
     RMeshElement element;
     
     mesh = r_mesh_new(1, compiler->triangles->len * 3, compiler->parts->len, compiler->triangles->len);
     mesh->vertice_count = 0;
+    welder = compiler->weld ? r_mesh_welder_new(mesh->frames[0], compiler->triangles->len * 3, R_MESH_WELD_EPSILON) : NULL;
     
     for(i = 0; i < compiler->parts->len; i++)
     {
-        mesh->parts[i].skin = g_array_index(compiler->parts, OBJPart, i).material;
         mesh->parts[i].offset = g_array_index(compiler->parts, OBJPart, i).offset;
         mesh->parts[i].count = g_array_index(compiler->parts, OBJPart, i).count;
+        mesh->parts[i].skin_name = g_array_index(compiler->parts, OBJPart, i).material_name;
     }
     
     for(i = 0; i < compiler->triangles->len * 3; i++)
@@ -269,11 +473,22 @@ _output_mesh(
             element.texcoord.y = 0.0f;
         }
 
-        if(r_mesh_element_insert(mesh->frames[0], mesh->vertice_count, &element, &mesh->triangles[i]))
+        if(welder == NULL)
+        {
+            /* a keyframe keeps its corners, they are welded as the first frame */
+            mesh->frames[0][i] = element;
+            mesh->triangles[i] = mesh->vertice_count++;
+        }
+        else if(r_mesh_welder_insert(welder, mesh->vertice_count, &element, &mesh->triangles[i]))
         {
             mesh->vertice_count++;
         }
     }
+    if(welder != NULL)
+    {
+        r_mesh_welder_free(welder);
+        r_mesh_shrink(mesh);
+    }
     
     if(compiler->current_object_name != NULL)
     {
@@ -305,34 +520,22 @@ _output_meshgroup(
 }
 
 static void
-_object(
-    OBJCompiler*    compiler
+_event(
+    OBJCompiler*    compiler,
+    guint           type
     )
 {
-    gchar* object_name = NULL;
+    OBJEvent event;
+    gchar* name = NULL;
     
-    _expect(compiler, R_SYMBOL_STRING, &object_name);
-    if(compiler->output)
+    _expect(compiler, R_SYMBOL_STRING, &name);
+    if(name != NULL)
     {
-        _output_mesh(compiler);
+        event.type = type;
+        event.name = g_strdup(name);
+        event.triangle = compiler->triangles->len;
+        g_array_append_val(compiler->events, event);
     }
-    compiler->current_object_name = g_strdup(object_name);
-    compiler->output = TRUE;
-}
-
-static void
-_part(
-    OBJCompiler*    compiler
-    )
-{
-    OBJPart part;
-    gchar* material_name = NULL;
-    
-    _expect(compiler, R_SYMBOL_STRING, &material_name);
-    part.material = r_resource_ref(material_name);
-    part.offset = compiler->triangles->len * 3;
-    part.count = 0;
-    g_array_append_val(compiler->parts, part);
 }
 
 static void
@@ -395,8 +598,6 @@ _face(
         _expect(compiler, R_SYMBOL_INT, &triangle.index_normal[i]);
     }
     g_array_append_val(compiler->triangles, triangle);
-    g_array_index(compiler->parts, OBJPart, compiler->parts->len - 1).count += 3;
-    
 }
 
 static void
@@ -406,12 +607,12 @@ _block(
 {
     if(_accept(compiler, R_SYMBOL_IDENT, "o"))
     {
-        _object(compiler);
+        _event(compiler, OBJ_EVENT_OBJECT);
         _expect(compiler, R_SYMBOL_EOL, NULL);
     }
     else if(_accept(compiler, R_SYMBOL_IDENT, "g"))
     {
-        _part(compiler);
+        _event(compiler, OBJ_EVENT_PART);
         _expect(compiler, R_SYMBOL_EOL, NULL);
     }
     else if(_accept(compiler, R_SYMBOL_IDENT, "v"))
@@ -436,40 +637,202 @@ _block(
     }
 }
 
+static void
+_compiler_init(
+    OBJCompiler*    compiler,
+    const gchar*    begin,
+    const gchar*    end
+    )
+{
+    memset(compiler, 0, sizeof(OBJCompiler));
+    compiler->next_line = begin;
+    compiler->end = end;
+    compiler->string = g_string_sized_new(64);
+    compiler->points = g_array_new(FALSE, FALSE, sizeof(float3));
+    compiler->texcoords = g_array_new(FALSE, FALSE, sizeof(float2));
+    compiler->normals = g_array_new(FALSE, FALSE, sizeof(float3));
+    compiler->parts = g_array_new(FALSE, FALSE, sizeof(OBJPart));
+    compiler->triangles = g_array_new(FALSE, FALSE, sizeof(OBJTriangle));
+    compiler->events = g_array_new(FALSE, FALSE, sizeof(OBJEvent));
+}
+
+static void
+_compiler_destroy(
+    OBJCompiler*    compiler
+    )
+{
+    guint i;
+    
+    for(i = 0; i < compiler->events->len; i++)
+    {
+        g_free(g_array_index(compiler->events, OBJEvent, i).name);
+    }
+    g_array_free(compiler->events, TRUE);
+    g_array_free(compiler->triangles, TRUE);
+    g_array_free(compiler->parts, TRUE);
+    g_array_free(compiler->texcoords, TRUE);
+    g_array_free(compiler->normals, TRUE);
+    g_array_free(compiler->points, TRUE);
+    g_string_free(compiler->string, TRUE);
+}
+
+/*
+ * Parses one line aligned chunk of the file. Only geometry records are
+ * handled here; "o" and "g" are recorded as events together with their
+ * triangle position so that _link can replay them in file order.
+ */
 static gpointer
-_load_from_file(
-    const gchar*      file_name
+_compile_chunk(
+    gpointer        user_data
+    )
+{
+    OBJCompiler* compiler = (OBJCompiler*) user_data;
+    
+    while(!compiler->failed && _get_symbol(compiler, TRUE))
+    {
+        _block(compiler);
+    }
+    return NULL;
+}
+
+static void
+_link_triangles(
+    OBJCompiler*    compiler,
+    OBJCompiler*    chunk,
+    guint           first,
+    guint           last
+    )
+{
+    if(first == last)
+    {
+        return;
+    }
+    if(compiler->parts->len == 0)
+    {
+        g_error("face declared outside of any group");
+    }
+    g_array_append_vals(compiler->triangles, &g_array_index(chunk->triangles, OBJTriangle, first), last - first);
+    g_array_index(compiler->parts, OBJPart, compiler->parts->len - 1).count += (last - first) * 3;
+}
+
+/*
+ * Merges the chunks in file order. Face indices are absolute in OBJ, so
+ * concatenating the vertex arrays keeps them valid; objects and parts are
+ * rebuilt by replaying the recorded events between triangle runs.
+ */
+static void
+_link(
+    OBJCompiler*    compiler,
+    OBJCompiler*    chunks,
+    guint           chunks_count
+    )
+{
+    OBJCompiler* chunk;
+    OBJEvent* event;
+    OBJPart part;
+    guint first;
+    guint line;
+    guint i, j;
+    
+    for(i = 0, line = 0; i < chunks_count; line += chunks[i].line, i++)
+    {
+        chunk = &chunks[i];
+        if(chunk->failed)
+        {
+            g_error("line %d: %s expected at pos %d", line + chunk->error_line, symbol_string[chunk->error_symbol], chunk->error_pos);
+        }
+        g_array_append_vals(compiler->points, chunk->points->data, chunk->points->len);
+        g_array_append_vals(compiler->texcoords, chunk->texcoords->data, chunk->texcoords->len);
+        g_array_append_vals(compiler->normals, chunk->normals->data, chunk->normals->len);
+    }
+    
+    for(i = 0; i < chunks_count; i++)
+    {
+        chunk = &chunks[i];
+        for(j = 0, first = 0; j < chunk->events->len; j++)
+        {
+            event = &g_array_index(chunk->events, OBJEvent, j);
+            _link_triangles(compiler, chunk, first, event->triangle);
+            first = event->triangle;
+            
+            switch(event->type)
+            {
+                case OBJ_EVENT_OBJECT:
+                    if(compiler->output)
+                    {
+                        _output_mesh(compiler);
+                    }
+                    compiler->current_object_name = event->name;
+                    compiler->output = TRUE;
+                    event->name = NULL;
+                    break;
+                
+                case OBJ_EVENT_PART:
+                    part.material_name = event->name;
+                    part.offset = compiler->triangles->len * 3;
+                    part.count = 0;
+                    g_array_append_val(compiler->parts, part);
+                    event->name = NULL;
+                    break;
+            }
+        }
+        _link_triangles(compiler, chunk, first, chunk->triangles->len);
+    }
+}
+
+static gpointer
+_load(
+    const gchar*      file_name,
+    gconstpointer     data,
+    gsize             length,
+    gboolean          weld
     )
 {
-    FILE* stream;
     OBJCompiler compiler;
+    OBJCompiler* chunks;
+    GThread** threads;
+    const gchar* begin;
+    const gchar* end;
+    const gchar* p;
+    guint chunks_count;
+    guint i;
     gpointer result;
     
-    stream = fopen (file_name, "rb");
-    if(stream == NULL)
+    begin = data;
+    end = begin + length;
+    
+    chunks_count = CLAMP(length / OBJ_CHUNK_MIN_SIZE, 1, (guint) MAX(r_thread_get_cpu_count(), 1));
+    chunks = g_new(OBJCompiler, chunks_count);
+    threads = g_new0(GThread*, chunks_count);
+    
+    for(i = 0; i < chunks_count; i++, begin = p)
     {
-        return NULL;
+        p = end;
+        if(i < chunks_count - 1 && begin + length / chunks_count < end)
+        {
+            p = memchr(begin + length / chunks_count, '\n', end - (begin + length / chunks_count));
+            p = (p != NULL) ? p + 1 : end;
+        }
+        _compiler_init(&chunks[i], begin, p);
     }
     
-    compiler.line = 0;
-    compiler.pos = 0;
-    compiler.token = NULL;
-    compiler.buffer = NULL;
-    compiler.points = g_array_new(FALSE, FALSE, sizeof(float3));
-    compiler.texcoords = g_array_new(FALSE, FALSE, sizeof(float2));
-    compiler.normals = g_array_new(FALSE, FALSE, sizeof(float3));
-    compiler.parts = g_array_new(FALSE, FALSE, sizeof(OBJPart));
-    compiler.triangles = g_array_new(FALSE, FALSE, sizeof(OBJTriangle));
+    for(i = 1; i < chunks_count; i++)
+    {
+        threads[i] = g_thread_new("obj_chunk", _compile_chunk, &chunks[i]);
+    }
+    _compile_chunk(&chunks[0]);
+    for(i = 1; i < chunks_count; i++)
+    {
+        g_thread_join(threads[i]);
+    }
+    
+    _compiler_init(&compiler, NULL, NULL);
     compiler.objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
     compiler.output = FALSE;
-     
     compiler.current_object_name = NULL;
+    compiler.weld = weld;
     
-    while(_get_symbol(&compiler, stream))
-    {
-        _block(&compiler);
-    }
-    _expect(&compiler, R_SYMBOL_EOF, NULL);
+    _link(&compiler, chunks, chunks_count);
     
     result = _output_mesh(&compiler);
     if(g_hash_table_size(compiler.objects) >= 2)
@@ -477,21 +840,62 @@ _load_from_file(
         result = _output_meshgroup(&compiler);
     }
      
+    for(i = 0; i < chunks_count; i++)
+    {
+        _compiler_destroy(&chunks[i]);
+    }
+    g_free(threads);
+    g_free(chunks);
     g_hash_table_destroy(compiler.objects);
-    g_array_free(compiler.triangles, TRUE);
-    g_array_free(compiler.parts, TRUE);
-    g_array_free(compiler.texcoords, TRUE);
-    g_array_free(compiler.normals, TRUE);
-    g_array_free(compiler.points, TRUE);
-    g_strfreev(compiler.buffer);
-    fclose(stream);
+    _compiler_destroy(&compiler);
+    
+    return result;
+}
+
+static gpointer
+_load_from_data(
+    const gchar*      file_name,
+    gconstpointer     data,
+    gsize             length
+    )
+{
+    return _load(file_name, data, length, TRUE);
+}
+
+static gpointer
+_load_frame_from_data(
+    const gchar*      file_name,
+    gconstpointer     data,
+    gsize             length
+    )
+{
+    return _load(file_name, data, length, FALSE);
+}
+
+static gpointer
+_load_from_file(
+    const gchar*      file_name
+    )
+{
+    GMappedFile* file;
+    gpointer result;
+    
+    file = g_mapped_file_new(file_name, FALSE, NULL);
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    result = _load_from_data(file_name, g_mapped_file_get_contents(file), g_mapped_file_get_length(file));
+    g_mapped_file_unref(file);
     
     return result;
 }
 
 static RModule singleton =
 {
-    _load_from_file
+    _load_from_file,
+    _load_from_data,
+    _load_frame_from_data
 };
 
 static RModule*
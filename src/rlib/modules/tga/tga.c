@@ -21,8 +21,10 @@
  */
 
 #include <rlib.h>
-#include <stdio.h>
 #include <string.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 struct _TGAHeader
 {
@@ -42,132 +44,201 @@ struct _TGAHeader
 typedef struct _TGAHeader TGAHeader;
 
 static void
-_fread_flat(
-    RImage*         image,
-    FILE*           stream
+_copy_pixels(
+    guint8*         dst,
+    gint            dst_step,
+    const guint8*   src,
+    guint           count,
+    guint           bytes_per_pixel
 )
 {
-    fread(image->pixel_data, image->width * image->height * image->bytes_per_pixel, 1, stream);
-}
+#if defined(__SSSE3__)
+    const __m128i bgra = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i bgr = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
 
-static void
-_fread_rle(
-    RImage*         image,
-    FILE*           stream
-)
-{
-    gint i;
-    guint8 b;
-    guint8* p;
-    
-    p = &image->pixel_data[0];
-    while(p < &image->pixel_data[image->width * image->height * image->bytes_per_pixel])
+    if(dst_step > 0 && bytes_per_pixel == 4)
     {
-        fread(&b, 1, 1, stream);
-        if(b & 0x80)
+        for(; count >= 4; count -= 4)
         {
-            fread(p, image->bytes_per_pixel, 1, stream);
-            p += image->bytes_per_pixel;
-            for(i = b & 0x7F; i > 0; i--)
-            {
-                memcpy(p, p - image->bytes_per_pixel, image->bytes_per_pixel);
-                p += image->bytes_per_pixel;
-            }
+            _mm_storeu_si128((__m128i*) dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) src), bgra));
+            dst += 16;
+            src += 16;
         }
-        else
+    }
+    else if(dst_step > 0 && bytes_per_pixel == 3)
+    {
+        /* 16 bytes are loaded and stored for 4 pixels, the next store overwrites the last 4 */
+        for(; count >= 6; count -= 4)
         {
-            for(i = b + 1; i > 0; i--)
-            {
-                fread(p, image->bytes_per_pixel, 1, stream);
-                p += image->bytes_per_pixel;
-            }
+            _mm_storeu_si128((__m128i*) dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) src), bgr));
+            dst += 12;
+            src += 12;
+        }
+    }
+#endif
+    for(; count > 0; count--)
+    {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if(bytes_per_pixel == 4)
+        {
+            dst[3] = src[3];
         }
+        dst += dst_step;
+        src += bytes_per_pixel;
     }
 }
 
 static void
-_mirror_horizontal(
-    RImage*         image
+_fill_pixels(
+    guint8*         dst,
+    gint            dst_step,
+    const guint8*   pixel,
+    guint           count,
+    guint           bytes_per_pixel
 )
 {
-    guint i, j;
-    guint8 swap[4];
-    guint8* row1;
-    guint8* row2;
-    
-    for(i = 0; i < image->height; i++)
+    for(; count > 0; count--)
     {
-        row1 = &image->pixel_data[image->bytes_per_pixel * image->width * i];
-        row2 = &image->pixel_data[image->bytes_per_pixel * (image->width * (i + 1) - 1)];
-        for(j = 0; j < image->width / 2; j++)
-        {
-            memcpy(swap, row1, image->bytes_per_pixel);
-            memcpy(row1, row2, image->bytes_per_pixel);
-            memcpy(row2, swap, image->bytes_per_pixel);
-            row1 += image->bytes_per_pixel;
-            row2 -= image->bytes_per_pixel;
-        }
+        memcpy(dst, pixel, bytes_per_pixel);
+        dst += dst_step;
     }
 }
 
-static void
-_mirror_vertical(
-    RImage*         image
+static guint8*
+_get_row(
+    RImage*         image,
+    guint           row,
+    gboolean        flip_x,
+    gboolean        flip_y
 )
 {
-    guint i, j;
-    guint8 swap[4];
-    guint8* row1;
-    guint8* row2;
-    
-    for(i = 0; i < image->height / 2; i++)
+    if(flip_y)
     {
-        row1 = &image->pixel_data[image->bytes_per_pixel * image->width * i];
-        row2 = &image->pixel_data[image->bytes_per_pixel * image->width * (image->height - 1 - i)];
-        for(j = 0; j < image->width; j++)
-        {
-            memcpy(swap, row1, image->bytes_per_pixel);
-            memcpy(row1, row2, image->bytes_per_pixel);
-            memcpy(row2, swap, image->bytes_per_pixel);
-            row1 += image->bytes_per_pixel;
-            row2 += image->bytes_per_pixel;
-        }
+        row = image->height - 1 - row;
     }
+    return &image->pixel_data[image->bytes_per_pixel * (image->width * row + (flip_x ? image->width - 1 : 0))];
 }
 
-static void
-_convert_rgba(
-    RImage*         image
+static gboolean
+_read_flat(
+    RImage*         image,
+    const guint8*   data,
+    const guint8*   end,
+    gboolean        flip_x,
+    gboolean        flip_y
 )
 {
+    guint i;
+    gsize pitch;
+    gint step;
+
+    pitch = image->width * image->bytes_per_pixel;
+    if(pitch * image->height > (gsize) (end - data))
+    {
+        return FALSE;
+    }
+    step = flip_x ? -(gint) image->bytes_per_pixel : (gint) image->bytes_per_pixel;
+    for(i = 0; i < image->height; i++)
+    {
+        _copy_pixels(_get_row(image, i, flip_x, flip_y), step, data, image->width, image->bytes_per_pixel);
+        data += pitch;
+    }
+    return TRUE;
+}
+
+static gboolean
+_read_rle(
+    RImage*         image,
+    const guint8*   data,
+    const guint8*   end,
+    gboolean        flip_x,
+    gboolean        flip_y
+)
+{
+    guint8 pixel[4];
     guint8* p;
-    
-    p = &image->pixel_data[0];
-    while(p < &image->pixel_data[image->width * image->height * image->bytes_per_pixel])
+    guint row, column;
+    guint count, n;
+    gsize remaining;
+    gboolean repeat;
+    gint step;
+
+    step = flip_x ? -(gint) image->bytes_per_pixel : (gint) image->bytes_per_pixel;
+    remaining = (gsize) image->width * image->height;
+    row = 0;
+    column = 0;
+    p = _get_row(image, 0, flip_x, flip_y);
+    while(remaining > 0)
     {
-        p[0] ^= p[2];
-        p[2] ^= p[0];
-        p[0] ^= p[2];
-        p += image->bytes_per_pixel;
+        if(data >= end)
+        {
+            return FALSE;
+        }
+        repeat = (*data & 0x80) != 0;
+        count = (*data++ & 0x7F) + 1;
+        if(count > remaining || (gsize) (end - data) < (repeat ? 1 : count) * image->bytes_per_pixel)
+        {
+            return FALSE;
+        }
+        if(repeat)
+        {
+            _copy_pixels(pixel, image->bytes_per_pixel, data, 1, image->bytes_per_pixel);
+            data += image->bytes_per_pixel;
+        }
+        remaining -= count;
+
+        /* packets may span several rows */
+        while(count > 0)
+        {
+            n = MIN(count, image->width - column);
+            if(repeat)
+            {
+                _fill_pixels(p, step, pixel, n, image->bytes_per_pixel);
+            }
+            else
+            {
+                _copy_pixels(p, step, data, n, image->bytes_per_pixel);
+                data += n * image->bytes_per_pixel;
+            }
+            p += (gint) n * step;
+            column += n;
+            count -= n;
+            if(column == image->width && ++row < image->height)
+            {
+                column = 0;
+                p = _get_row(image, row, flip_x, flip_y);
+            }
+        }
     }
+    return TRUE;
 }
 
 static gpointer
-_load_from_file(
-    const gchar*      file_name
+_load_from_data(
+    const gchar*      file_name,
+    gconstpointer     data,
+    gsize             length
     )
 {
     RImage* image;
-    FILE* stream;
     TGAHeader header;
+    const guint8* p;
+    const guint8* end;
+    gboolean result;
     
-    stream = fopen(file_name, "rb");
-    if(stream == NULL)
+    if(length < sizeof(TGAHeader))
+    {
+        return NULL;
+    }
+    memcpy(&header, data, sizeof(TGAHeader));
+    p = (const guint8*) data + sizeof(TGAHeader) + (guint8) header.idlength;
+    end = (const guint8*) data + length;
+    if(p > end)
     {
         return NULL;
     }
-    fread(&header, sizeof(TGAHeader), 1, stream);
-    fseek(stream, header.idlength, SEEK_CUR);
     
     g_assert(
         (header.colourmaptype == 0 && header.bitsperpixel == 24) ||
@@ -175,32 +246,47 @@ _load_from_file(
     
     image = r_image_new(header.width, header.height, header.bitsperpixel / 8);
     
+    /* pixels are written once, already mirrored and in RGB(A) order */
     if(header.datatypecode == 2)
     {
-        _fread_flat(image, stream);
+        result = _read_flat(image, p, end, header.imagedescriptor & 16, !(header.imagedescriptor & 32));
     }
     else
     {
-        _fread_rle(image, stream);
+        result = _read_rle(image, p, end, header.imagedescriptor & 16, !(header.imagedescriptor & 32));
     }
-    if(header.imagedescriptor & 16)
+    if(!result)
     {
-        _mirror_horizontal(image);
+        g_warning("%s: truncated image", file_name);
     }
-    if(!(header.imagedescriptor & 32))
+
+    return (gpointer) image;
+}
+
+static gpointer
+_load_from_file(
+    const gchar*      file_name
+    )
+{
+    GMappedFile* file;
+    gpointer result;
+
+    file = g_mapped_file_new(file_name, FALSE, NULL);
+    if(file == NULL)
     {
-        _mirror_vertical(image);
+        return NULL;
     }
-    _convert_rgba(image);
-    
-    fclose(stream);
+    result = _load_from_data(file_name, g_mapped_file_get_contents(file), g_mapped_file_get_length(file));
+    g_mapped_file_unref(file);
 
-    return (gpointer) image;
+    return result;
 }
 
 static RModule singleton =
 {
-    _load_from_file
+    _load_from_file,
+    _load_from_data,
+    NULL
 };
 
 static RModule*
@@ -0,0 +1,424 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ *      pak.c
+ *
+ *      Copyright 2009 Romuald Rousseau <romualdrousseau@gmail.com>
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#include <rlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define R_PAK_MAGIC         0x4B415052
+#define R_PAK_VERSION       1
+#define R_PAK_ALIGN         16
+
+/* --- types --- */
+typedef struct __Pak            _Pak;
+
+typedef struct __PakHeader      _PakHeader;
+
+typedef struct __PakEntry       _PakEntry;
+
+typedef struct __PakManager     _PakManager;
+
+/* --- structures --- */
+struct __PakHeader
+{
+    guint32         magic;
+    guint32         version;
+    guint32         entries_count;
+    guint32         buckets_count;
+};
+
+struct __PakEntry
+{
+    guint32         hash;
+    guint32         name_offset;
+    guint32         name_length;
+    guint32         reserved;
+    guint64         data_offset;
+    guint64         data_length;
+};
+
+struct __Pak
+{
+    GMappedFile*    mapping;
+    gchar*          root;
+    guint           root_length;
+    const guint8*   data;
+    gsize           length;
+    const _PakHeader* header;
+    const guint32*  buckets;
+    const _PakEntry* entries;
+    const gchar*    names;
+    gsize           names_length;
+};
+
+struct __PakManager
+{
+/* private */
+    GList*          paks;
+};
+
+/* --- variables --- */
+static _PakManager self = {NULL};
+
+/* --- functions --- */
+/*
+ * _pak_hash:
+ *
+ */
+static guint32
+_pak_hash(
+    const gchar*    name
+    )
+{
+    guint32 hash;
+
+    for(hash = 2166136261U; *name != '\0'; name++)
+    {
+        hash = (hash ^ (guint8) *name) * 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * _pak_find:
+ *
+ */
+static const _PakEntry*
+_pak_find(
+    _Pak*           pak,
+    const gchar*    name
+    )
+{
+    const _PakEntry* entry;
+    guint32 hash;
+    guint32 mask;
+    guint32 i;
+    guint32 n;
+
+    hash = _pak_hash(name);
+    mask = pak->header->buckets_count - 1;
+    for(i = hash & mask, n = 0; n <= mask && pak->buckets[i] != 0; i = (i + 1) & mask, n++)
+    {
+        if(pak->buckets[i] > pak->header->entries_count)
+        {
+            break;
+        }
+        entry = &pak->entries[pak->buckets[i] - 1];
+        if(entry->hash == hash &&
+            (gsize) entry->name_offset + entry->name_length < pak->names_length &&
+            strcmp(&pak->names[entry->name_offset], name) == 0)
+        {
+            if(entry->data_offset > pak->length || entry->data_length > pak->length - entry->data_offset)
+            {
+                break;
+            }
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * _pak_free:
+ *
+ */
+static void
+_pak_free(
+    _Pak*           pak
+    )
+{
+    g_mapped_file_unref(pak->mapping);
+    g_free(pak->root);
+    g_slice_free(_Pak, pak);
+}
+
+/**
+ * r_pak_mount:
+ *
+ * Maps the archive @file_name once and adds it to the searched paks. Its
+ * entries are named relatively to the directory holding the archive.
+ * Returns FALSE if the file is missing or is not a valid archive.
+ **/
+gboolean
+r_pak_mount(
+    const gchar*            file_name
+    )
+{
+    _Pak* pak;
+    gsize toc_length;
+    GMappedFile* mapping;
+
+    g_assert(file_name != NULL);
+
+    mapping = g_mapped_file_new(file_name, FALSE, NULL);
+    if(mapping == NULL)
+    {
+        return FALSE;
+    }
+
+    pak = g_slice_new0(_Pak);
+    pak->mapping = mapping;
+    pak->data = (const guint8*) g_mapped_file_get_contents(mapping);
+    pak->length = g_mapped_file_get_length(mapping);
+    pak->header = (const _PakHeader*) pak->data;
+    if(pak->length < sizeof(_PakHeader) ||
+        pak->header->magic != R_PAK_MAGIC ||
+        pak->header->version != R_PAK_VERSION ||
+        pak->header->buckets_count == 0 ||
+        (pak->header->buckets_count & (pak->header->buckets_count - 1)) != 0)
+    {
+        g_warning("%s is not a valid pak", file_name);
+        _pak_free(pak);
+        return FALSE;
+    }
+
+    toc_length = sizeof(_PakHeader) + pak->header->buckets_count * sizeof(guint32) + pak->header->entries_count * sizeof(_PakEntry);
+    if(toc_length > pak->length)
+    {
+        g_warning("%s is truncated", file_name);
+        _pak_free(pak);
+        return FALSE;
+    }
+    pak->buckets = (const guint32*) (pak->data + sizeof(_PakHeader));
+    pak->entries = (const _PakEntry*) (pak->buckets + pak->header->buckets_count);
+    pak->names = (const gchar*) (pak->entries + pak->header->entries_count);
+    pak->names_length = pak->length - toc_length;
+    pak->root = g_path_get_dirname(file_name);
+    pak->root_length = strlen(pak->root);
+
+    self.paks = g_list_append(self.paks, pak);
+    g_message("Mount %s: %d files", file_name, pak->header->entries_count);
+    return TRUE;
+}
+
+/**
+ * r_pak_unmount_all:
+ *
+ **/
+void
+r_pak_unmount_all()
+{
+    GList* iter;
+
+    for(iter = self.paks; iter != NULL; iter = iter->next)
+    {
+        _pak_free(iter->data);
+    }
+    g_list_free(self.paks);
+    self.paks = NULL;
+}
+
+/**
+ * r_pak_lookup:
+ *
+ * Looks @file_name up in the mounted paks. On success @data and @length
+ * describe the file inside the mapping, which stays valid as long as the
+ * pak is mounted, or as long as a reference to @mapping is held.
+ **/
+gboolean
+r_pak_lookup(
+    const gchar*            file_name,
+    gconstpointer*          data,
+    gsize*                  length,
+    GMappedFile**           mapping
+    )
+{
+    const _PakEntry* entry;
+    const gchar* name;
+    GList* iter;
+    _Pak* pak;
+
+    g_assert(file_name != NULL);
+
+    for(iter = self.paks; iter != NULL; iter = iter->next)
+    {
+        pak = iter->data;
+        name = file_name;
+        if(strncmp(name, pak->root, pak->root_length) == 0 && name[pak->root_length] == G_DIR_SEPARATOR)
+        {
+            name += pak->root_length + 1;
+        }
+        else if(g_path_is_absolute(name))
+        {
+            continue;
+        }
+
+        entry = _pak_find(pak, name);
+        if(entry != NULL)
+        {
+            *data = pak->data + entry->data_offset;
+            *length = entry->data_length;
+            if(mapping != NULL)
+            {
+                *mapping = pak->mapping;
+            }
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * r_pak_checksum:
+ *
+ * Feeds the contents of @file_name to @checksum, from the mounted paks
+ * when it is packed there, from the file system otherwise. Returns FALSE
+ * if it cannot be read.
+ **/
+gboolean
+r_pak_checksum(
+    const gchar*            file_name,
+    GChecksum*              checksum
+    )
+{
+    GMappedFile* file;
+    gconstpointer data;
+    gsize length;
+
+    g_assert(file_name != NULL);
+    g_assert(checksum != NULL);
+
+    if(r_pak_lookup(file_name, &data, &length, NULL))
+    {
+        g_checksum_update(checksum, data, length);
+        return TRUE;
+    }
+    file = g_mapped_file_new(file_name, FALSE, NULL);
+    if(file == NULL)
+    {
+        return FALSE;
+    }
+    g_checksum_update(checksum, (const guchar*) g_mapped_file_get_contents(file), g_mapped_file_get_length(file));
+    g_mapped_file_unref(file);
+    return TRUE;
+}
+
+/**
+ * r_pak_build:
+ *
+ * Packs the files @names, relative to @root_dir, into the archive
+ * @file_name. Every file is aligned on 16 bytes so that the loaders can
+ * map their structures straight from it.
+ **/
+gboolean
+r_pak_build(
+    const gchar*            file_name,
+    const gchar*            root_dir,
+    const gchar**           names
+    )
+{
+    static const guint8 padding[R_PAK_ALIGN] = {0};
+    _PakHeader header;
+    _PakEntry* entries;
+    guint32* buckets;
+    GString* string_table;
+    FILE* stream;
+    struct stat st;
+    gchar* path;
+    gchar* temp_name;
+    gchar* contents;
+    gsize contents_length;
+    guint64 offset;
+    gboolean result;
+    guint i, j;
+
+    g_assert(file_name != NULL);
+    g_assert(root_dir != NULL);
+    g_assert(names != NULL);
+
+    header.magic = R_PAK_MAGIC;
+    header.version = R_PAK_VERSION;
+    header.entries_count = g_strv_length((gchar**) names);
+    for(header.buckets_count = 16; header.buckets_count < header.entries_count * 2; header.buckets_count <<= 1);
+
+    entries = g_new0(_PakEntry, header.entries_count);
+    buckets = g_new0(guint32, header.buckets_count);
+    string_table = g_string_new(NULL);
+    for(i = 0; i < header.entries_count; i++)
+    {
+        path = g_build_filename(root_dir, names[i], NULL);
+        if(g_stat(path, &st) != 0)
+        {
+            g_warning("%s not found", path);
+            g_free(path);
+            g_string_free(string_table, TRUE);
+            g_free(buckets);
+            g_free(entries);
+            return FALSE;
+        }
+        g_free(path);
+
+        entries[i].hash = _pak_hash(names[i]);
+        entries[i].name_offset = string_table->len;
+        entries[i].name_length = strlen(names[i]);
+        entries[i].data_length = st.st_size;
+        g_string_append_len(string_table, names[i], entries[i].name_length + 1);
+
+        for(j = entries[i].hash & (header.buckets_count - 1); buckets[j] != 0; j = (j + 1) & (header.buckets_count - 1));
+        buckets[j] = i + 1;
+    }
+
+    offset = sizeof(header) + header.buckets_count * sizeof(guint32) + header.entries_count * sizeof(_PakEntry) + string_table->len;
+    for(i = 0; i < header.entries_count; i++)
+    {
+        offset = (offset + R_PAK_ALIGN - 1) & ~(guint64) (R_PAK_ALIGN - 1);
+        entries[i].data_offset = offset;
+        offset += entries[i].data_length;
+    }
+
+    temp_name = g_strconcat(file_name, ".tmp", NULL);
+    stream = fopen(temp_name, "wb");
+    result = (stream != NULL);
+    if(result)
+    {
+        fwrite(&header, sizeof(header), 1, stream);
+        fwrite(buckets, sizeof(guint32), header.buckets_count, stream);
+        fwrite(entries, sizeof(_PakEntry), header.entries_count, stream);
+        fwrite(string_table->str, 1, string_table->len, stream);
+        for(i = 0; i < header.entries_count && result; i++)
+        {
+            fwrite(padding, 1, entries[i].data_offset - ftell(stream), stream);
+            path = g_build_filename(root_dir, names[i], NULL);
+            result = g_file_get_contents(path, &contents, &contents_length, NULL);
+            if(result)
+            {
+                result = (contents_length == entries[i].data_length) &&
+                    (fwrite(contents, 1, contents_length, stream) == contents_length);
+                g_free(contents);
+            }
+            g_free(path);
+        }
+        result = (fclose(stream) == 0) && result;
+        result = result && (g_rename(temp_name, file_name) == 0);
+        if(!result)
+        {
+            g_unlink(temp_name);
+        }
+    }
+    g_free(temp_name);
+    g_string_free(string_table, TRUE);
+    g_free(buckets);
+    g_free(entries);
+    return result;
+}
@@ -33,15 +33,17 @@ struct __RRenderer
     void                        (*pause)();
     void                        (*resume)();
     void                        (*resize)(guint width, guint height);
-    gpointer                    (*wait)(gpointer handle);
-    gpointer                    (*execute)(GThreadFunc func, gpointer data, gpointer* return_handle);
+    gpointer                    (*execute)(GThreadFunc func, gpointer data, GSourceFunc completed_function);
+    void                        (*flush)();
 /* private */
     gint                        draw_buffer;
     gboolean                    swap_vsync;
+    float4x4                    projection;
+    GMutex                      projection_lock;
 };
 
 /* --- variables --- */
-static struct __RRenderer       self = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, GL_BACK, FALSE};
+static struct __RRenderer       self = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, GL_BACK, FALSE, {0.0f}};
 const RRenderer                 renderer = (RRenderer) &self;
 static RRendererFactory*        renderer_factories[] =
 {
@@ -241,7 +243,9 @@ r_renderer_resize_viewport(
     x = aspect * y;
     
     r_matrix_frustum_set(&projection, -x, x, -y, y, 0.1f, 100.0f);
-    r_frustum_update_projection(&projection);
+    g_mutex_lock(&self.projection_lock);
+    self.projection = projection;
+    g_mutex_unlock(&self.projection_lock);
     
     glViewport(0, 0, width, height);
     glMatrixMode(GL_PROJECTION);
@@ -251,6 +255,25 @@ r_renderer_resize_viewport(
     glFlush();
 }
 
+/**
+ * r_renderer_get_projection:
+ *
+ * Copies the current projection to @projection. It may be called from any
+ * thread, the render thread rewriting it under a lock on resize.
+ **/
+float4x4*
+r_renderer_get_projection(
+    float4x4*   projection
+    )
+{
+    g_assert(projection != NULL);
+
+    g_mutex_lock(&self.projection_lock);
+    *projection = self.projection;
+    g_mutex_unlock(&self.projection_lock);
+    return projection;
+}
+
 /**
  * r_renderer_render_scene:
  *
@@ -302,6 +325,7 @@ r_renderer_swap_buffers()
     __t1 = (__t1 == 0) ? r_game_current_time() : __t1;
     __t2 = r_game_current_time();
     game->frame_time = __t2 - __t1;
+    game->frame_number++;
     __t1 = __t2;
 }
 
@@ -22,7 +22,58 @@
 
 #include <rlib.h>
 
+/* --- types --- */
+typedef struct __RendererDefault _RendererDefault;
+
+typedef struct __RendererDefaultExecuteContext _RendererDefaultExecuteContext;
+
+/* --- structures --- */
+struct __RendererDefault
+{
+    GThread*        thread;
+    GAsyncQueue*    command_queue;
+    GMutex          wait_mutex;
+    GCond           wait_cond;
+};
+
+struct __RendererDefaultExecuteContext
+{
+    GThreadFunc     function;
+    gpointer        user_data;
+    gpointer        return_value;
+    gboolean        terminated;
+};
+
+/* --- variables --- */
+static _RendererDefault self = {NULL, NULL, {0}, {0}};
+
 /* --- functions --- */
+/*
+ * _renderer_default_flush:
+ *
+ * Runs the GL commands queued by the other threads, the GL context being
+ * only current in the thread of the main loop.
+ */
+static void
+_renderer_default_flush()
+{
+    _RendererDefaultExecuteContext* context;
+
+    if(g_thread_self() != self.thread)
+    {
+        return;
+    }
+
+    while((context = g_async_queue_try_pop(self.command_queue)) != NULL)
+    {
+        context->return_value = context->function(context->user_data);
+        g_mutex_lock(&self.wait_mutex);
+        context->terminated = TRUE;
+        g_cond_broadcast(&self.wait_cond);
+        g_mutex_unlock(&self.wait_mutex);
+    }
+}
+
 /*
  * _renderer_default_init:
  *
@@ -30,6 +81,10 @@
 static void
 _renderer_default_init()
 {
+    g_mutex_init(&self.wait_mutex);
+    g_cond_init(&self.wait_cond);
+    self.command_queue = g_async_queue_new();
+    self.thread = g_thread_self();
 }
 
 /*
@@ -39,6 +94,11 @@ _renderer_default_init()
 static void
 _renderer_default_destroy()
 {
+    _renderer_default_flush();
+    self.thread = NULL;
+    g_async_queue_unref(self.command_queue);
+    g_cond_clear(&self.wait_cond);
+    g_mutex_clear(&self.wait_mutex);
 }
 
 /*
@@ -48,6 +108,7 @@ _renderer_default_destroy()
 static void
 _renderer_default_update()
 {
+    _renderer_default_flush();
     r_renderer_render_scene();
     r_renderer_swap_buffers();
 }
@@ -94,11 +155,32 @@ _renderer_default_execute(
     GSourceFunc     completed_function
     )
 {
+    _RendererDefaultExecuteContext context;
     gpointer return_value;
 
     g_assert(function != NULL);
 
-    return_value = function(user_data);
+    if(self.thread == NULL || g_thread_self() == self.thread)
+    {
+        return_value = function(user_data);
+    }
+    else
+    {
+        /* a loader thread, wait for the main loop to run it */
+        context.function = function;
+        context.user_data = user_data;
+        context.return_value = NULL;
+        context.terminated = FALSE;
+        g_async_queue_push(self.command_queue, &context);
+
+        g_mutex_lock(&self.wait_mutex);
+        while(!context.terminated)
+        {
+            g_cond_wait(&self.wait_cond, &self.wait_mutex);
+        }
+        g_mutex_unlock(&self.wait_mutex);
+        return_value = context.return_value;
+    }
     if(completed_function != NULL)
     {
         g_idle_add(completed_function, user_data);
@@ -121,6 +203,7 @@ _create_instance()
     singleton->resume = _renderer_default_resume;
     singleton->resize = _renderer_default_resize;
     singleton->execute = _renderer_default_execute;
+    singleton->flush = _renderer_default_flush;
     return singleton;
 }
 
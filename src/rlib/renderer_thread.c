@@ -21,49 +21,72 @@
  */
 
 #include <rlib.h>
+#include <linux/futex.h>
+
+#define R_RENDERER_RING_SIZE    256
+#define R_RENDERER_RING_MASK    (R_RENDERER_RING_SIZE - 1)
 
 /* --- enums --- */
 enum
 {
-    R_SLEEPING          = 0,
-    R_RUNNING           = 1,
-    R_TERMINATED        = 2
+    R_COMMAND_PENDING   = 0,
+    R_COMMAND_DONE      = 1,
+    R_COMMAND_WAITED    = 2
 };
 
 enum
 {
     R_PRIORITY_HIGH     = 0,
-    R_PRIORITY_NORMAL   = 1
+    R_PRIORITY_NORMAL   = 1,
+    R_PRIORITY_COUNT    = 2
 };
 
 /* --- types --- */
 typedef struct __RendererThread _RendererThread;
 
-typedef struct __RendererThreadExecuteContext _RendererThreadExecuteContext;
+typedef struct __RendererCommand _RendererCommand;
+
+typedef struct __RendererRing _RendererRing;
 
 typedef struct __ResizeParams _ResizeParams;
 
 /* --- structures --- */
-struct __RendererThread
-{
-    GThread*        thread;
-    GAsyncQueue*    command_queue;
-    GMutex          wait_mutex;
-    GCond           wait_cond;
-    gboolean        terminated;
-    gboolean        paused;
-};
-
-struct __RendererThreadExecuteContext
+/*
+ * A command slot is free for the position equal to its sequence, holds the
+ * command of that position once its sequence is one ahead, and is given
+ * back a lap later by whoever reads the command last.
+ */
+struct __RendererCommand
 {
-    gint            priority;
-    gint            status;
+    volatile gint   sequence;
+    volatile gint   status;
+    guint           position;
     GThreadFunc     function;
     gpointer        user_data;
     gpointer        return_value;
     GSourceFunc     completed_function;
 };
 
+/*
+ * A bounded ring written by any thread and read by the render thread only.
+ */
+struct __RendererRing
+{
+    _RendererCommand commands[R_RENDERER_RING_SIZE];
+    volatile gint   head;
+    guint           tail;
+};
+
+struct __RendererThread
+{
+    GThread*        thread;
+    _RendererRing   lanes[R_PRIORITY_COUNT];
+    volatile gint   pending;
+    volatile gint   sleeping;
+    volatile gint   terminated;
+    gboolean        paused;
+};
+
 struct __ResizeParams
 {
     guint           width;
@@ -71,23 +94,162 @@ struct __ResizeParams
 };
 
 /* --- variables --- */
-static _RendererThread self = {NULL, NULL, {0}, {0}, FALSE, TRUE};
+static _RendererThread self = {NULL, {{{{0}}}}, 0, 0, FALSE, TRUE};
 
 /* --- functions --- */
 /*
- * _renderer_thread_compare_priority:
+ * _renderer_thread_futex_wait:
+ *
+ * Sleeps while *@address is @value, or until woken up.
+ */
+static void
+_renderer_thread_futex_wait(
+    volatile gint*  address,
+    gint            value
+    )
+{
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+/*
+ * _renderer_thread_futex_wake:
  *
  */
-static gint
-_renderer_thread_compare_priority(
-    gconstpointer   a,
-    gconstpointer   b,
-    gpointer        user_data
+static void
+_renderer_thread_futex_wake(
+    volatile gint*  address
     )
 {
-    _RendererThreadExecuteContext* c1 = (_RendererThreadExecuteContext*)a;
-    _RendererThreadExecuteContext* c2 = (_RendererThreadExecuteContext*)b;
-    return (c1->priority > c2->priority) ? +1 : ((c1->priority == c2->priority) ? 0 : -1);
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, G_MAXINT, NULL, NULL, 0);
+}
+
+/*
+ * _renderer_ring_init:
+ *
+ */
+static void
+_renderer_ring_init(
+    _RendererRing*  ring
+    )
+{
+    guint i;
+
+    for(i = 0; i < R_RENDERER_RING_SIZE; i++)
+    {
+        ring->commands[i].sequence = i;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/*
+ * _renderer_ring_push:
+ *
+ * Claims the next slot of @ring and publishes a command in it. Only waits
+ * when the ring is full.
+ */
+static _RendererCommand*
+_renderer_ring_push(
+    _RendererRing*  ring,
+    GThreadFunc     function,
+    gpointer        user_data,
+    GSourceFunc     completed_function
+    )
+{
+    _RendererCommand* command;
+    guint position;
+    gint distance;
+
+    position = (guint) g_atomic_int_get(&ring->head);
+    for(;;)
+    {
+        command = &ring->commands[position & R_RENDERER_RING_MASK];
+        distance = (gint) ((guint) g_atomic_int_get(&command->sequence) - position);
+        if(distance == 0)
+        {
+            if(g_atomic_int_compare_and_exchange(&ring->head, (gint) position, (gint) (position + 1)))
+            {
+                break;
+            }
+        }
+        else if(distance < 0)
+        {
+            /* full, the slot of the previous lap is not given back yet */
+            g_thread_yield();
+        }
+        position = (guint) g_atomic_int_get(&ring->head);
+    }
+
+    command->position = position;
+    command->function = function;
+    command->user_data = user_data;
+    command->return_value = NULL;
+    command->completed_function = completed_function;
+    g_atomic_int_set(&command->status, R_COMMAND_PENDING);
+    g_atomic_int_set(&command->sequence, (gint) (position + 1));
+    return command;
+}
+
+/*
+ * _renderer_ring_pop:
+ *
+ * Returns the next command of @ring, NULL if none is published yet.
+ */
+static _RendererCommand*
+_renderer_ring_pop(
+    _RendererRing*  ring
+    )
+{
+    _RendererCommand* command;
+
+    command = &ring->commands[ring->tail & R_RENDERER_RING_MASK];
+    if((guint) g_atomic_int_get(&command->sequence) != ring->tail + 1)
+    {
+        return NULL;
+    }
+    ring->tail++;
+    return command;
+}
+
+/*
+ * _renderer_ring_release:
+ *
+ */
+static void
+_renderer_ring_release(
+    _RendererCommand* command
+    )
+{
+    g_atomic_int_set(&command->sequence, (gint) (command->position + R_RENDERER_RING_SIZE));
+}
+
+/*
+ * _renderer_thread_run:
+ *
+ */
+static void
+_renderer_thread_run(
+    _RendererCommand* command
+    )
+{
+    if(command->function != NULL)
+    {
+        command->return_value = command->function(command->user_data);
+    }
+    if(command->completed_function == NULL)
+    {
+        /* the caller gives the slot back once it has read the result */
+        if(!g_atomic_int_compare_and_exchange(&command->status, R_COMMAND_PENDING, R_COMMAND_DONE))
+        {
+            g_atomic_int_set(&command->status, R_COMMAND_DONE);
+            _renderer_thread_futex_wake(&command->status);
+        }
+    }
+    else
+    {
+        g_idle_add(command->completed_function, command->return_value);
+        _renderer_ring_release(command);
+    }
 }
 
 /*
@@ -99,7 +261,8 @@ _renderer_thread_worker(
     gpointer        data
     )
 {
-    _RendererThreadExecuteContext* context;
+    _RendererCommand* command;
+    gint pending;
 
     r_thread_set_cpu_affinity(R_CPU1);
 
@@ -107,42 +270,30 @@ _renderer_thread_worker(
     glXMakeCurrent(game->display, window->window, renderer->context);
     XUnlockDisplay(game->display);
 
-    while(!self.terminated)
+    while(!g_atomic_int_get(&self.terminated))
     {
-        if(self.paused)
-        {
-            context = (_RendererThreadExecuteContext*)g_async_queue_pop(self.command_queue);
-        }
-        else
+        pending = g_atomic_int_get(&self.pending);
+        command = _renderer_ring_pop(&self.lanes[R_PRIORITY_HIGH]);
+        if(command == NULL)
         {
-            context = (_RendererThreadExecuteContext*)g_async_queue_try_pop(self.command_queue);
+            command = _renderer_ring_pop(&self.lanes[R_PRIORITY_NORMAL]);
         }
-        if(context != NULL)
+        if(command != NULL)
         {
-            if(context->function != NULL)
-            {
-                context->status = R_RUNNING;
-                context->return_value = context->function(context->user_data);
-            }
-            if(context->completed_function == NULL)
-            {
-                g_mutex_lock(&self.wait_mutex);
-                context->status = R_TERMINATED;
-                g_cond_broadcast(&self.wait_cond);
-                g_mutex_unlock(&self.wait_mutex);
-            }
-            else
-            {
-                context->status = R_TERMINATED;
-                g_idle_add(context->completed_function, context->return_value);
-                g_slice_free(_RendererThreadExecuteContext, context);
-            }
+            _renderer_thread_run(command);
         }
         else if(!self.paused)
         {
             r_renderer_render_scene();
             r_renderer_swap_buffers();
         }
+        else
+        {
+            /* returns at once if a command was pushed since pending was read */
+            g_atomic_int_set(&self.sleeping, TRUE);
+            _renderer_thread_futex_wait(&self.pending, pending);
+            g_atomic_int_set(&self.sleeping, FALSE);
+        }
     }
 
     XLockDisplay(game->display);
@@ -152,6 +303,21 @@ _renderer_thread_worker(
     return NULL;
 }
 
+/*
+ * _renderer_thread_notify:
+ *
+ * Wakes the render thread up if it sleeps.
+ */
+static void
+_renderer_thread_notify()
+{
+    g_atomic_int_inc(&self.pending);
+    if(g_atomic_int_get(&self.sleeping))
+    {
+        _renderer_thread_futex_wake(&self.pending);
+    }
+}
+
 /*
  * _renderer_thread_push_full:
  *
@@ -159,7 +325,7 @@ _renderer_thread_worker(
 static gpointer
 _renderer_thread_push_full(GThreadFunc function, gpointer user_data, gint priority, GSourceFunc completed_function)
 {
-    _RendererThreadExecuteContext* context;
+    _RendererCommand* command;
     gpointer result = NULL;
     
     if(g_thread_self() == self.thread)
@@ -173,25 +339,20 @@ _renderer_thread_push_full(GThreadFunc function, gpointer user_data, gint priori
     }
     else
     {
-        context = g_slice_new0(_RendererThreadExecuteContext);
-        context->priority = priority;
-        context->status = R_SLEEPING;
-        context->function = function;
-        context->user_data = user_data;
-        context->completed_function = completed_function;
-
-        g_async_queue_push_sorted(self.command_queue, context, _renderer_thread_compare_priority, NULL);
+        command = _renderer_ring_push(&self.lanes[priority], function, user_data, completed_function);
+        _renderer_thread_notify();
 
         if(completed_function == NULL)
         {
-            g_mutex_lock(&self.wait_mutex);
-            while(context->status != R_TERMINATED)
+            if(g_atomic_int_compare_and_exchange(&command->status, R_COMMAND_PENDING, R_COMMAND_WAITED))
             {
-                g_cond_wait(&self.wait_cond, &self.wait_mutex);
+                while(g_atomic_int_get(&command->status) == R_COMMAND_WAITED)
+                {
+                    _renderer_thread_futex_wait(&command->status, R_COMMAND_WAITED);
+                }
             }
-            g_mutex_unlock(&self.wait_mutex);
-            result = context->return_value;
-            g_slice_free(_RendererThreadExecuteContext, context);
+            result = command->return_value;
+            _renderer_ring_release(command);
         }
 
         return result;
@@ -225,9 +386,8 @@ _renderer_thread_init()
 
     glXMakeCurrent(game->display, None, NULL);
 
-    g_mutex_init(&self.wait_mutex);
-    g_cond_init(&self.wait_cond);
-    self.command_queue = g_async_queue_new();
+    _renderer_ring_init(&self.lanes[R_PRIORITY_HIGH]);
+    _renderer_ring_init(&self.lanes[R_PRIORITY_NORMAL]);
     self.thread = g_thread_new("rlib_thread", _renderer_thread_worker, NULL);
 }
 
@@ -238,11 +398,9 @@ _renderer_thread_init()
 static void
 _renderer_thread_destroy()
 {
-    self.terminated = TRUE;
+    g_atomic_int_set(&self.terminated, TRUE);
+    _renderer_thread_notify();
     g_thread_join(self.thread);
-    g_async_queue_unref(self.command_queue);
-    g_cond_clear(&self.wait_cond);
-    g_mutex_clear(&self.wait_mutex);
 
     glXMakeCurrent(game->display, window->window, renderer->context);
 }
@@ -339,6 +497,7 @@ _create_instance()
     singleton->resume = _renderer_thread_resume;
     singleton->resize = _renderer_thread_resize;
     singleton->execute = _renderer_thread_execute;
+    singleton->flush = NULL;
     return singleton;
 }
 
@@ -21,21 +21,138 @@
  */
 
 #include <rlib.h>
+#include <string.h>
+
+#define R_RESOURCE_WAIT_SLICE   (G_USEC_PER_SEC / 1000)
+#define R_RESOURCE_CPU_BUDGET   (64 << 20)
+#define R_RESOURCE_GPU_BUDGET   (128 << 20)
+#define R_RESOURCE_HANDLE_BITS  20
+#define R_RESOURCE_HANDLE_MASK  ((1 << R_RESOURCE_HANDLE_BITS) - 1)
+#define R_RESOURCE_SHARDS       16
+
+/* --- enums --- */
+enum
+{
+    R_RESOURCE_REQUEST_PENDING      = 0,
+    R_RESOURCE_REQUEST_READY        = 1,
+    R_RESOURCE_REQUEST_CANCELLED    = 2,
+    R_RESOURCE_REQUEST_FAILED       = 3
+};
 
 /* --- types --- */
 typedef struct __ResourceManager    _ResourceManager;
 
+typedef struct __ResourceShard      _ResourceShard;
+
+typedef struct __ResourcePrefetch   _ResourcePrefetch;
+
+typedef struct __ResourceSlot       _ResourceSlot;
+
 /* --- structures --- */
+struct __ResourceShard
+{
+    GMutex          lock;
+    GHashTable*     values;
+};
+
+/*
+ * The values are found through the shards, each with its own lock, so
+ * that lookups and waits on different resources do not contend. The
+ * graph lock guards everything else: edges, idle queue, sizes and slots.
+ * It is always taken before a shard lock, and never held while a resource
+ * loads or unloads.
+ */
 struct __ResourceManager
 {
 /* private */
-    GHashTable*     cache;
+    _ResourceShard  shards[R_RESOURCE_SHARDS];
+    GRecMutex       lock;
+    GList*          trash;
+    GThreadPool*    loader;
+    volatile gint   requests_count;
+    volatile gint   completed_count;
+    volatile gint   sequence;
+    volatile gint   jobs_count;
+    volatile gint   stopping;
+    GHashTable*     prefetches;
+    GQueue          idle;
+    gsize           cpu_size;
+    gsize           gpu_size;
+    gsize           cpu_budget;
+    gsize           gpu_budget;
+    volatile gint   hits;
+    volatile gint   misses;
+    guint           evictions;
+    GHashTable*     orphans;
+    GHashTable*     dependencies;
+    GHashTable*     ids;
+    GArray*         slots;
+    GHashTable*     shared;
+};
+
+struct __ResourceSlot
+{
+    gchar*          name;
+    RResourceManagerValue* value;
+    guint           generation;
+};
+
+struct __ResourcePrefetch
+{
+    RResourceRequest*   request;
+    gboolean            marked;
+};
+
+struct _RResourceRequest
+{
+    gchar*                      key;
+    volatile gint               ref;
+    volatile gint               status;
+    gpointer                    data;
+    RResourceRequestCallback    callback;
+    gpointer                    user_data;
+    gfloat                      priority;
+    guint                       depth;
+    gint                        sequence;
+    gboolean                    tracked;
 };
 
 /* --- variables --- */
-static _ResourceManager self = {NULL};
+static _ResourceManager self = {{{{0}}}};
 
 /* --- functions --- */
+/*
+ * _resource_manager_shard:
+ *
+ */
+static _ResourceShard*
+_resource_manager_shard(
+    const gchar*            key
+    )
+{
+    return &self.shards[g_str_hash(key) & (R_RESOURCE_SHARDS - 1)];
+}
+
+/*
+ * _resource_manager_lookup:
+ *
+ * The value returned stays valid as long as the graph lock is held.
+ */
+static RResourceManagerValue*
+_resource_manager_lookup(
+    const gchar*            key
+    )
+{
+    _ResourceShard* shard;
+    RResourceManagerValue* value;
+
+    shard = _resource_manager_shard(key);
+    g_mutex_lock(&shard->lock);
+    value = g_hash_table_lookup(shard->values, key);
+    g_mutex_unlock(&shard->lock);
+    return value;
+}
+
 /*
  * _resource_manager_cache_value_new:
  *
@@ -54,13 +171,24 @@ _resource_manager_cache_value_new(
     value->link = NULL;
     value->data = NULL;
     value->custom_free_func = NULL;
-    r_game_signal_emit2("resource_manager_load", value);
+    value->state = R_RESOURCE_STATE_LOADING;
+    value->cpu_size = 0;
+    value->gpu_size = 0;
+    value->lru = NULL;
+    value->parent = NULL;
+    value->children = NULL;
+    value->waiters = 0;
+    value->load_time = 0;
+    value->hits = 0;
+    value->last_access = game->frame_number;
+    g_cond_init(&value->ready);
     return value;
 }
 
 /*
  * _resource_manager_cache_value_destroy:
  *
+ * Unloads a value taken out of the cache, without any lock held.
  */
 static void
 _resource_manager_cache_value_destroy(
@@ -68,133 +196,1540 @@ _resource_manager_cache_value_destroy(
     )
 {
     RResourceManagerValue* value = data;
-    
-    r_game_signal_emit2_with_default(
-        "resource_manager_unload", 
-        value, 
-        (RGameCallback2) r_resource_default_unload
-        );
+
+    if(value->state == R_RESOURCE_STATE_READY)
+    {
+        r_game_signal_emit2_with_default(
+            "resource_manager_unload", 
+            value, 
+            (RGameCallback2) r_resource_default_unload
+            );
+    }
+    g_cond_clear(&value->ready);
     g_free(value->link);
     g_free(value->name);
     g_slice_free(RResourceManagerValue, value);
 }
 
 /*
- * _resource_remove_links:
+ * _resource_manager_shared_unref:
+ *
+ */
+static void
+_resource_manager_shared_unref(
+    gpointer                data
+    )
+{
+    guint count;
+
+    count = GPOINTER_TO_UINT(g_hash_table_lookup(self.shared, data));
+    if(count > 1)
+    {
+        g_hash_table_insert(self.shared, data, GUINT_TO_POINTER(count - 1));
+    }
+    else
+    {
+        g_hash_table_remove(self.shared, data);
+    }
+}
+
+/*
+ * _resource_manager_cache_value_forget:
+ *
+ * Takes the accounting of a value out of the cache and throws it away, it
+ * is unloaded by _resource_manager_empty_trash().
+ */
+static void
+_resource_manager_cache_value_forget(
+    RResourceManagerValue*  value
+    )
+{
+    _ResourceSlot* slot;
+
+    /* the handles to this value go stale */
+    slot = &g_array_index(self.slots, _ResourceSlot, value->id);
+    slot->value = NULL;
+    slot->generation = (slot->generation + 1) & (G_MAXUINT32 >> R_RESOURCE_HANDLE_BITS);
+
+    if(value->lru != NULL)
+    {
+        g_queue_delete_link(&self.idle, value->lru);
+        value->lru = NULL;
+    }
+    self.cpu_size -= value->cpu_size;
+    self.gpu_size -= value->gpu_size;
+    if(value->state == R_RESOURCE_STATE_READY && value->data != NULL)
+    {
+        _resource_manager_shared_unref(value->data);
+    }
+    self.trash = g_list_prepend(self.trash, value);
+}
+
+/*
+ * _resource_manager_empty_trash:
+ *
+ * Unloads the values removed from the cache, in the order they were
+ * removed. Must be called without the graph lock: an unload may wait for
+ * the render thread, which may be waiting for the lock.
+ */
+static void
+_resource_manager_empty_trash()
+{
+    GList* trash;
+    GList* p;
+
+    g_rec_mutex_lock(&self.lock);
+    trash = g_list_reverse(self.trash);
+    self.trash = NULL;
+    g_rec_mutex_unlock(&self.lock);
+
+    for(p = trash; p != NULL; p = p->next)
+    {
+        _resource_manager_cache_value_destroy(p->data);
+    }
+    g_list_free(trash);
+}
+
+/*
+ * _resource_manager_cache_value_steal:
+ *
+ * Takes @value out of its shard, unless it is loading or in use.
+ */
+static gboolean
+_resource_manager_cache_value_steal(
+    RResourceManagerValue*  value
+    )
+{
+    _ResourceShard* shard;
+    gboolean result;
+
+    shard = _resource_manager_shard(value->name);
+    g_mutex_lock(&shard->lock);
+    result = (value->state != R_RESOURCE_STATE_LOADING) && (value->user_ref == 0) && (value->waiters == 0);
+    if(result)
+    {
+        g_hash_table_steal(shard->values, value->name);
+    }
+    g_mutex_unlock(&shard->lock);
+    return result;
+}
+
+/*
+ * _resource_manager_cache_value_detach:
+ *
+ * Removes @value from the children of its parent, or from the orphans
+ * waiting for it.
+ */
+static void
+_resource_manager_cache_value_detach(
+    RResourceManagerValue*  value
+    )
+{
+    GList* orphans;
+    gchar* key;
+
+    if(value->parent != NULL)
+    {
+        value->parent->children = g_list_remove(value->parent->children, value);
+        value->parent = NULL;
+    }
+    else if(value->link != NULL &&
+        g_hash_table_lookup_extended(self.orphans, value->link, (gpointer*)&key, (gpointer*)&orphans))
+    {
+        g_hash_table_steal(self.orphans, key);
+        orphans = g_list_remove(orphans, value);
+        if(orphans != NULL)
+        {
+            g_hash_table_insert(self.orphans, key, orphans);
+        }
+        else
+        {
+            g_free(key);
+        }
+    }
+}
+
+/*
+ * _resource_manager_cache_value_remove:
+ *
+ * Throws away @value, already stolen from its shard, then the values
+ * linked to it: the dependents before what they depend on. Only the edges
+ * of @value are walked.
+ */
+static void
+_resource_manager_cache_value_remove(
+    RResourceManagerValue*  value
+    )
+{
+    RResourceManagerValue* child;
+    GList* children;
+    GList* p;
+
+    children = value->children;
+    value->children = NULL;
+    _resource_manager_cache_value_detach(value);
+    _resource_manager_cache_value_forget(value);
+
+    for(p = children; p != NULL; p = p->next)
+    {
+        child = p->data;
+        child->parent = NULL;
+        if(_resource_manager_cache_value_steal(child))
+        {
+            _resource_manager_cache_value_remove(child);
+        }
+    }
+    g_list_free(children);
+}
+
+/*
+ * _resource_manager_cache_value_adopt:
+ *
+ * Attaches to a new value the values linked to it before it was loaded.
+ */
+static void
+_resource_manager_cache_value_adopt(
+    RResourceManagerValue*  value
+    )
+{
+    RResourceManagerValue* child;
+    GList* orphans;
+    GList* p;
+    gchar* key;
+
+    if(!g_hash_table_lookup_extended(self.orphans, value->name, (gpointer*)&key, (gpointer*)&orphans))
+    {
+        return;
+    }
+    g_hash_table_steal(self.orphans, key);
+    g_free(key);
+    for(p = orphans; p != NULL; p = p->next)
+    {
+        child = p->data;
+        child->parent = value;
+    }
+    value->children = g_list_concat(orphans, value->children);
+}
+
+/*
+ * _resource_manager_cache_value_unlink:
+ *
+ * Drops the edges of a value before the whole cache is freed.
+ */
+static void
+_resource_manager_cache_value_unlink(
+    gpointer                key,
+    gpointer                data,
+    gpointer                user_data
+    )
+{
+    RResourceManagerValue* value = data;
+
+    g_list_free(value->children);
+    value->children = NULL;
+    value->parent = NULL;
+}
+
+/*
+ * _resource_manager_cache_value_is_loaded:
  *
  */
 static gboolean
-_resource_remove_links(
-    gpointer key,
-    gpointer data,
-    gpointer user_data
+_resource_manager_cache_value_is_loaded(
+    gpointer                key,
+    gpointer                data,
+    gpointer                user_data
     )
 {
     RResourceManagerValue* value = data;
-    
-    return (value->link != NULL) && g_str_equal(value->link, (gchar*) user_data);
+
+    if(value->state == R_RESOURCE_STATE_LOADING || value->waiters > 0)
+    {
+        return FALSE;
+    }
+    *(GList**) user_data = g_list_prepend(*(GList**) user_data, value);
+    return TRUE;
 }
 
-/**
- * r_resource_manager_init:
+/*
+ * _resource_manager_cache_value_info:
  *
- **/
-void
-r_resource_manager_init()
+ */
+static void
+_resource_manager_cache_value_info(
+    gpointer                key,
+    gpointer                data,
+    gpointer                user_data
+    )
 {
-    self.cache = g_hash_table_new_full(
-        g_str_hash,
-        g_str_equal,
-        g_free,
-        _resource_manager_cache_value_destroy
-        );
+    RResourceManagerValue* value = data;
+    RResourceManagerInfo info;
+
+    info.name = g_strdup(value->name);
+    info.type = value->type;
+    info.state = value->state;
+    info.user_ref = value->user_ref;
+    info.cpu_size = value->cpu_size;
+    info.gpu_size = value->gpu_size;
+    info.load_time = value->load_time;
+    info.hits = value->hits;
+    info.last_access = value->last_access;
+    g_array_append_val((GArray*) user_data, info);
 }
 
-/**
- * r_resource_manager_destroy:
+/*
+ * _resource_manager_info_compare_name:
  *
  */
-void
-r_resource_manager_destroy()
+static gint
+_resource_manager_info_compare_name(
+    gconstpointer           a,
+    gconstpointer           b
+    )
 {
-    g_hash_table_destroy(self.cache);
+    return strcmp(((RResourceManagerInfo*) a)->name, ((RResourceManagerInfo*) b)->name);
 }
 
-/**
- * r_resource_manager_cleanup:
+/*
+ * _resource_manager_info_compare_size:
  *
- **/
-void
-r_resource_manager_cleanup()
+ * The largest first.
+ */
+static gint
+_resource_manager_info_compare_size(
+    gconstpointer           a,
+    gconstpointer           b
+    )
+{
+    const RResourceManagerInfo* info_a = a;
+    const RResourceManagerInfo* info_b = b;
+    gsize size_a = info_a->cpu_size + info_a->gpu_size;
+    gsize size_b = info_b->cpu_size + info_b->gpu_size;
+
+    if(size_a != size_b)
+    {
+        return (size_a < size_b) ? 1 : -1;
+    }
+    return _resource_manager_info_compare_name(a, b);
+}
+
+/*
+ * _resource_manager_info_compare_load_time:
+ *
+ * The slowest first.
+ */
+static gint
+_resource_manager_info_compare_load_time(
+    gconstpointer           a,
+    gconstpointer           b
+    )
 {
-    g_hash_table_remove_all(self.cache);
+    const RResourceManagerInfo* info_a = a;
+    const RResourceManagerInfo* info_b = b;
+
+    if(info_a->load_time != info_b->load_time)
+    {
+        return (info_a->load_time < info_b->load_time) ? 1 : -1;
+    }
+    return _resource_manager_info_compare_name(a, b);
 }
 
-/**
- * r_resource_ref:
+/*
+ * _resource_manager_dependencies_free:
  *
- **/
-gpointer
-r_resource_ref(
-    const gchar*      key
+ */
+static void
+_resource_manager_dependencies_free(
+    gpointer                data
     )
 {
-    RResourceManagerValue* value;
+    g_list_free_full(data, g_free);
+}
 
-    g_assert(key != NULL);
+/*
+ * _resource_manager_dependencies_add:
+ *
+ */
+static void
+_resource_manager_dependencies_add(
+    const gchar*            key,
+    const gchar*            name
+    )
+{
+    GList* dependencies;
 
-    value = (RResourceManagerValue*)g_hash_table_lookup(self.cache, key);
-    if(value == NULL)
+    dependencies = g_hash_table_lookup(self.dependencies, key);
+    if(dependencies == NULL)
     {
-        value = _resource_manager_cache_value_new((gpointer)g_strdup(key));
-        g_hash_table_insert(self.cache, (gpointer)g_strdup(key), value);
+        g_hash_table_insert(self.dependencies, g_strdup(key), g_list_prepend(NULL, g_strdup(name)));
     }
-    if(value->link == NULL)
+    else if(g_list_find_custom(dependencies, name, (GCompareFunc) strcmp) == NULL)
     {
-        value->user_ref++;
+        g_list_append(dependencies, g_strdup(name));
     }
-    return value->data;
 }
 
-/**
- * r_resource_unref:
+/*
+ * _resource_manager_cache_value_measure:
  *
- **/
-void
-r_resource_unref(
-    const gchar*      key
+ * Accounts the memory of a loaded value, unless its loader already did.
+ * An object shared by several values, as the meshes loaded from identical
+ * files, is accounted to the first one only.
+ */
+static void
+_resource_manager_cache_value_measure(
+    RResourceManagerValue*  value
     )
 {
-    RResourceManagerValue* value;
-    
-    g_assert(key != NULL);
+    guint count;
 
-    value = (RResourceManagerValue*)g_hash_table_lookup(self.cache, key);
-    if((value != NULL) && (value->link == NULL))
+    if(value->data != NULL)
     {
-        value->user_ref--;
-        if(value->user_ref == 0)
+        count = GPOINTER_TO_UINT(g_hash_table_lookup(self.shared, value->data));
+        g_hash_table_insert(self.shared, value->data, GUINT_TO_POINTER(count + 1));
+        if(count > 0)
         {
-            g_hash_table_remove(self.cache, key);
-            g_hash_table_foreach_remove(self.cache, _resource_remove_links, (gpointer)key);
+            value->cpu_size = 0;
+            value->gpu_size = 0;
+            return;
         }
     }
+    if(value->cpu_size == 0 && value->gpu_size == 0)
+    {
+        switch(value->type)
+        {
+            case R_RESOURCE_MATERIAL:
+                value->cpu_size = sizeof(RMaterial);
+                value->gpu_size = ((RMaterial*) value->data)->texture_size;
+                break;
+            case R_RESOURCE_MESH:
+                r_mesh_get_size(value->data, &value->cpu_size, &value->gpu_size);
+                break;
+            case R_RESOURCE_MESHGROUP:
+                r_meshgroup_get_size(value->data, &value->cpu_size, &value->gpu_size);
+                break;
+            case R_RESOURCE_SURFACE:
+                value->cpu_size = sizeof(RSurface);
+                value->gpu_size = ((RSurface*) value->data)->texture_size;
+                break;
+            case R_RESOURCE_FONT:
+                value->cpu_size = sizeof(RFont);
+                value->gpu_size = ((RFont*) value->data)->texture_size;
+                break;
+        }
+    }
+    self.cpu_size += value->cpu_size;
+    self.gpu_size += value->gpu_size;
 }
 
-/**
- * r_resource_default_unload:
+/*
+ * _resource_manager_evict:
  *
- **/
-void
-r_resource_link(
-    RResourceManagerValue*  value,
-    const gchar*            key
-    )
+ * Throws away the least recently used idle values until the cache fits in
+ * its budget. Must be called with the graph lock held.
+ */
+static void
+_resource_manager_evict()
 {
-    g_assert(value != NULL);
+    RResourceManagerValue* value;
+
+    while((self.cpu_size > self.cpu_budget || self.gpu_size > self.gpu_budget) &&
+        (value = g_queue_peek_tail(&self.idle)) != NULL)
+    {
+        if(_resource_manager_cache_value_steal(value))
+        {
+            _resource_manager_cache_value_remove(value);
+            self.evictions++;
+        }
+        else
+        {
+            /* referenced again since it went idle */
+            g_queue_delete_link(&self.idle, value->lru);
+            value->lru = NULL;
+        }
+    }
+}
+
+/*
+ * _resource_manager_cache_value_unref:
+ *
+ * Must be called with the graph lock held.
+ */
+static void
+_resource_manager_cache_value_unref(
+    RResourceManagerValue*  value
+    )
+{
+    _ResourceShard* shard;
+    gboolean idle = FALSE;
+
+    shard = _resource_manager_shard(value->name);
+    g_mutex_lock(&shard->lock);
+    if(value->state == R_RESOURCE_STATE_READY && value->link == NULL && value->user_ref > 0)
+    {
+        value->user_ref--;
+        idle = (value->user_ref == 0);
+    }
+    g_mutex_unlock(&shard->lock);
+
+    if(idle)
+    {
+        if(value->lru != NULL)
+        {
+            g_queue_delete_link(&self.idle, value->lru);
+        }
+        g_queue_push_head(&self.idle, value);
+        value->lru = g_queue_peek_head_link(&self.idle);
+        _resource_manager_evict();
+    }
+}
+
+/*
+ * _resource_manager_intern:
+ *
+ * Returns the id of @key, the index of its slot. Ids are never reused.
+ */
+static guint
+_resource_manager_intern(
+    const gchar*            key
+    )
+{
+    _ResourceSlot slot;
+    gpointer id;
+
+    if(g_hash_table_lookup_extended(self.ids, key, NULL, &id))
+    {
+        return GPOINTER_TO_UINT(id);
+    }
+    g_assert(self.slots->len <= R_RESOURCE_HANDLE_MASK);
+
+    slot.name = g_strdup(key);
+    slot.value = NULL;
+    slot.generation = 0;
+    g_array_append_val(self.slots, slot);
+    g_hash_table_insert(self.ids, slot.name, GUINT_TO_POINTER(self.slots->len - 1));
+    return self.slots->len - 1;
+}
+
+/*
+ * _resource_manager_handle_lookup:
+ *
+ * Returns the value of @handle, or NULL if it was freed since.
+ */
+static RResourceManagerValue*
+_resource_manager_handle_lookup(
+    RResourceHandle         handle
+    )
+{
+    _ResourceSlot* slot;
+    guint id;
+
+    id = handle & R_RESOURCE_HANDLE_MASK;
+    if(id == 0 || id >= self.slots->len)
+    {
+        return NULL;
+    }
+    slot = &g_array_index(self.slots, _ResourceSlot, id);
+    if(slot->value == NULL || slot->generation != (handle >> R_RESOURCE_HANDLE_BITS))
+    {
+        return NULL;
+    }
+    return slot->value;
+}
+
+/*
+ * _resource_manager_cache_value_load:
+ *
+ * Loads a value just added to @shard and wakes up its waiters. Returns a
+ * new reference, or NULL if the loader failed.
+ */
+static gpointer
+_resource_manager_cache_value_load(
+    _ResourceShard*         shard,
+    RResourceManagerValue*  value
+    )
+{
+    gboolean failed;
+    gpointer data;
+    gint64 start_time;
+
+    g_rec_mutex_lock(&self.lock);
+    value->id = _resource_manager_intern(value->name);
+    g_array_index(self.slots, _ResourceSlot, value->id).value = value;
+    _resource_manager_cache_value_adopt(value);
+    g_rec_mutex_unlock(&self.lock);
+
+    start_time = g_get_monotonic_time();
+    r_game_signal_emit2("resource_manager_load", value);
+    value->load_time = g_get_monotonic_time() - start_time;
+    failed = (value->data == NULL && value->type == R_RESOURCE_NONE);
+    if(failed)
+    {
+        g_warning("%s: unable to load", value->name);
+    }
+
+    g_rec_mutex_lock(&self.lock);
+    if(!failed)
+    {
+        _resource_manager_cache_value_measure(value);
+    }
+    g_mutex_lock(&shard->lock);
+    value->state = failed ? R_RESOURCE_STATE_FAILED : R_RESOURCE_STATE_READY;
+    if(!failed && value->link == NULL)
+    {
+        value->user_ref++;
+    }
+    data = value->data;
+    g_cond_broadcast(&value->ready);
+    g_mutex_unlock(&shard->lock);
+    _resource_manager_evict();
+    g_rec_mutex_unlock(&self.lock);
+
+    _resource_manager_empty_trash();
+    return data;
+}
+
+/*
+ * _resource_manager_cache_value_wait:
+ *
+ * Waits for a value loaded by another thread, with the lock of @shard
+ * held. The GL commands queued for the calling thread are run meanwhile,
+ * the loader may be waiting on them. Returns a new reference, or NULL if
+ * the loader failed.
+ */
+static gpointer
+_resource_manager_cache_value_wait(
+    _ResourceShard*         shard,
+    RResourceManagerValue*  value
+    )
+{
+    value->waiters++;
+    while(value->state == R_RESOURCE_STATE_LOADING)
+    {
+        g_mutex_unlock(&shard->lock);
+        r_renderer_flush();
+        g_mutex_lock(&shard->lock);
+        if(value->state == R_RESOURCE_STATE_LOADING)
+        {
+            g_cond_wait_until(&value->ready, &shard->lock, g_get_monotonic_time() + R_RESOURCE_WAIT_SLICE);
+        }
+    }
+    value->waiters--;
+
+    if(value->state != R_RESOURCE_STATE_READY)
+    {
+        return NULL;
+    }
+    value->hits++;
+    value->last_access = game->frame_number;
+    if(value->link == NULL)
+    {
+        value->user_ref++;
+    }
+    return value->data;
+}
+
+/*
+ * _resource_request_unref:
+ *
+ */
+static void
+_resource_request_unref(
+    RResourceRequest*       request
+    )
+{
+    if(g_atomic_int_dec_and_test(&request->ref))
+    {
+        g_free(request->key);
+        g_slice_free(RResourceRequest, request);
+    }
+}
+
+/*
+ * _resource_request_new:
+ *
+ * Creates a request and queues it on the loader pool. Only the tracked
+ * requests count in the progress.
+ */
+static RResourceRequest*
+_resource_request_new(
+    const gchar*            key,
+    RResourceRequestCallback callback,
+    gpointer                user_data,
+    gfloat                  priority,
+    guint                   depth,
+    gboolean                tracked
+    )
+{
+    RResourceRequest* request;
+
+    request = g_slice_new0(RResourceRequest);
+    request->key = g_strdup(key);
+    request->ref = 2;
+    request->status = R_RESOURCE_REQUEST_PENDING;
+    request->callback = callback;
+    request->user_data = user_data;
+    request->priority = priority;
+    request->depth = depth;
+    request->sequence = g_atomic_int_add(&self.sequence, 1);
+    request->tracked = tracked;
+
+    if(tracked)
+    {
+        g_atomic_int_inc(&self.requests_count);
+    }
+    g_atomic_int_inc(&self.jobs_count);
+    g_thread_pool_push(self.loader, request, NULL);
+    return request;
+}
+
+/*
+ * _resource_request_release:
+ *
+ * Frees a request owned by the manager, dropping its reference if loaded.
+ */
+static void
+_resource_request_release(
+    RResourceRequest*       request
+    )
+{
+    if(!g_atomic_int_compare_and_exchange(&request->status, R_RESOURCE_REQUEST_PENDING, R_RESOURCE_REQUEST_CANCELLED) &&
+        g_atomic_int_get(&request->status) == R_RESOURCE_REQUEST_READY)
+    {
+        r_resource_unref(request->key);
+    }
+    _resource_request_unref(request);
+}
+
+/*
+ * _resource_request_compare:
+ *
+ * Orders the loader queue: highest priority first, then the dependencies
+ * of the resources being loaded, then first come.
+ */
+static gint
+_resource_request_compare(
+    gconstpointer           a,
+    gconstpointer           b,
+    gpointer                user_data
+    )
+{
+    const RResourceRequest* request1 = a;
+    const RResourceRequest* request2 = b;
+
+    if(request1->priority != request2->priority)
+    {
+        return (request1->priority > request2->priority) ? -1 : +1;
+    }
+    if(request1->depth != request2->depth)
+    {
+        return (request1->depth > request2->depth) ? -1 : +1;
+    }
+    return request1->sequence - request2->sequence;
+}
+
+/*
+ * _resource_prefetch_destroy:
+ *
+ */
+static void
+_resource_prefetch_destroy(
+    gpointer                data
+    )
+{
+    _ResourcePrefetch* prefetch = data;
+
+    _resource_request_release(prefetch->request);
+    g_slice_free(_ResourcePrefetch, prefetch);
+}
+
+/*
+ * _resource_prefetch_unmark:
+ *
+ */
+static void
+_resource_prefetch_unmark(
+    gpointer                key,
+    gpointer                data,
+    gpointer                user_data
+    )
+{
+    ((_ResourcePrefetch*) data)->marked = FALSE;
+}
+
+/*
+ * _resource_prefetch_is_unmarked:
+ *
+ */
+static gboolean
+_resource_prefetch_is_unmarked(
+    gpointer                key,
+    gpointer                data,
+    gpointer                user_data
+    )
+{
+    return !((_ResourcePrefetch*) data)->marked;
+}
+
+/*
+ * _resource_request_completed:
+ *
+ * Runs the callback of a request in the main loop, unless the request was
+ * freed since it was loaded or failed.
+ */
+static gboolean
+_resource_request_completed(
+    gpointer                data
+    )
+{
+    RResourceRequest* request = data;
+
+    if(g_atomic_int_get(&request->status) != R_RESOURCE_REQUEST_CANCELLED)
+    {
+        request->callback(request, request->user_data);
+    }
+    _resource_request_unref(request);
+    return FALSE;
+}
+
+/*
+ * _resource_manager_dependencies_request:
+ *
+ * Queues the dependencies seen the last time @request was loaded, ahead of
+ * the queue, so that other loader threads take them meanwhile. They count
+ * in the progress when @request does.
+ */
+static GList*
+_resource_manager_dependencies_request(
+    RResourceRequest*       request
+    )
+{
+    GList* requests = NULL;
+    GList* p;
+
+    g_rec_mutex_lock(&self.lock);
+    if(_resource_manager_lookup(request->key) == NULL)
+    {
+        for(p = g_hash_table_lookup(self.dependencies, request->key); p != NULL; p = p->next)
+        {
+            if(_resource_manager_lookup(p->data) == NULL)
+            {
+                requests = g_list_prepend(
+                    requests,
+                    _resource_request_new(p->data, NULL, NULL, request->priority, request->depth + 1, request->tracked)
+                    );
+            }
+        }
+    }
+    g_rec_mutex_unlock(&self.lock);
+    return requests;
+}
+
+/*
+ * _resource_manager_load_job:
+ *
+ * Runs on the loader pool.
+ */
+static void
+_resource_manager_load_job(
+    gpointer                data,
+    gpointer                user_data
+    )
+{
+    RResourceRequest* request = data;
+    GList* dependencies;
+    GList* p;
+    gint status;
+
+    if(g_atomic_int_get(&self.stopping))
+    {
+        /* the manager is being destroyed, the queued jobs are dropped */
+        _resource_request_unref(request);
+        g_atomic_int_add(&self.jobs_count, -1);
+        return;
+    }
+
+    dependencies = _resource_manager_dependencies_request(request);
+    request->data = r_resource_ref(request->key);
+    for(p = dependencies; p != NULL; p = p->next)
+    {
+        _resource_request_release(p->data);
+    }
+    g_list_free(dependencies);
+
+    /* a failed load holds no reference */
+    status = (request->data != NULL) ? R_RESOURCE_REQUEST_READY : R_RESOURCE_REQUEST_FAILED;
+    if(!g_atomic_int_compare_and_exchange(&request->status, R_RESOURCE_REQUEST_PENDING, status))
+    {
+        /* the request was freed by its owner in the meantime */
+        if(request->data != NULL)
+        {
+            r_resource_unref(request->key);
+        }
+    }
+    else if(request->callback != NULL)
+    {
+        g_atomic_int_inc(&request->ref);
+        g_idle_add(_resource_request_completed, request);
+    }
+    if(request->tracked)
+    {
+        g_atomic_int_inc(&self.completed_count);
+    }
+    _resource_request_unref(request);
+    g_atomic_int_add(&self.jobs_count, -1);
+}
+
+
+/**
+ * r_resource_manager_init:
+ *
+ **/
+void
+r_resource_manager_init()
+{
+    guint i;
+
+    /* the keys are the names of the values */
+    for(i = 0; i < R_RESOURCE_SHARDS; i++)
+    {
+        g_mutex_init(&self.shards[i].lock);
+        self.shards[i].values = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    self.orphans = g_hash_table_new_full(
+        g_str_hash,
+        g_str_equal,
+        g_free,
+        (GDestroyNotify) g_list_free
+        );
+    self.dependencies = g_hash_table_new_full(
+        g_str_hash,
+        g_str_equal,
+        g_free,
+        _resource_manager_dependencies_free
+        );
+    /* the slot 0 is never used, a null handle is always invalid */
+    self.ids = g_hash_table_new(g_str_hash, g_str_equal);
+    self.slots = g_array_new(FALSE, TRUE, sizeof(_ResourceSlot));
+    g_array_set_size(self.slots, 1);
+    self.shared = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_queue_init(&self.idle);
+    self.trash = NULL;
+    self.cpu_size = 0;
+    self.gpu_size = 0;
+    self.cpu_budget = R_RESOURCE_CPU_BUDGET;
+    self.gpu_budget = R_RESOURCE_GPU_BUDGET;
+    self.hits = 0;
+    self.misses = 0;
+    self.evictions = 0;
+    g_rec_mutex_init(&self.lock);
+    self.loader = g_thread_pool_new(
+        _resource_manager_load_job,
+        NULL,
+        MAX(r_thread_get_cpu_count(), 1),
+        FALSE,
+        NULL
+        );
+    g_thread_pool_set_sort_function(self.loader, _resource_request_compare, NULL);
+    self.requests_count = 0;
+    self.completed_count = 0;
+    self.sequence = 0;
+    self.jobs_count = 0;
+    self.stopping = FALSE;
+    self.prefetches = g_hash_table_new_full(
+        g_str_hash,
+        g_str_equal,
+        g_free,
+        _resource_prefetch_destroy
+        );
+    r_pak_mount(PACKAGE_DATADIR "/" R_PAK_DEFAULT_NAME);
+}
+
+/**
+ * r_resource_manager_destroy:
+ *
+ */
+void
+r_resource_manager_destroy()
+{
+    guint i;
+
+    /*
+     * A running load may wait for this thread to execute its GL commands,
+     * so the renderer is flushed until the loaders are done.
+     */
+    g_atomic_int_set(&self.stopping, TRUE);
+    while(g_atomic_int_get(&self.jobs_count) > 0)
+    {
+        r_renderer_flush();
+        g_usleep(1000);
+    }
+    g_thread_pool_free(self.loader, FALSE, TRUE);
+    g_hash_table_destroy(self.prefetches);
+    r_resource_manager_cleanup();
+    for(i = 0; i < R_RESOURCE_SHARDS; i++)
+    {
+        g_hash_table_destroy(self.shards[i].values);
+        g_mutex_clear(&self.shards[i].lock);
+    }
+    g_hash_table_destroy(self.orphans);
+    g_hash_table_destroy(self.dependencies);
+    g_hash_table_destroy(self.ids);
+    for(i = 1; i < self.slots->len; i++)
+    {
+        g_free(g_array_index(self.slots, _ResourceSlot, i).name);
+    }
+    g_array_free(self.slots, TRUE);
+    g_hash_table_destroy(self.shared);
+    g_rec_mutex_clear(&self.lock);
+    r_pak_unmount_all();
+}
+
+/**
+ * r_resource_manager_cleanup:
+ *
+ * Frees every resource, except the ones being loaded or waited for.
+ **/
+void
+r_resource_manager_cleanup()
+{
+    GList* values = NULL;
+    GList* p;
+    guint i;
+
+    g_rec_mutex_lock(&self.lock);
+    for(i = 0; i < R_RESOURCE_SHARDS; i++)
+    {
+        g_mutex_lock(&self.shards[i].lock);
+        g_hash_table_foreach(self.shards[i].values, _resource_manager_cache_value_unlink, NULL);
+        g_hash_table_foreach_steal(self.shards[i].values, _resource_manager_cache_value_is_loaded, &values);
+        g_mutex_unlock(&self.shards[i].lock);
+    }
+    for(p = values; p != NULL; p = p->next)
+    {
+        _resource_manager_cache_value_forget(p->data);
+    }
+    g_list_free(values);
+    g_hash_table_remove_all(self.orphans);
+    g_rec_mutex_unlock(&self.lock);
+
+    _resource_manager_empty_trash();
+}
+
+/**
+ * r_resource_manager_get_progress:
+ *
+ * Returns the completed fraction of the asynchronous requests made since
+ * the loader was last idle, 1.0 when nothing is pending.
+ **/
+gfloat
+r_resource_manager_get_progress()
+{
+    gint requests_count;
+
+    requests_count = g_atomic_int_get(&self.requests_count);
+    if(requests_count == 0)
+    {
+        return 1.0f;
+    }
+    return (gfloat) g_atomic_int_get(&self.completed_count) / (gfloat) requests_count;
+}
+
+/**
+ * r_resource_manager_set_budget:
+ *
+ * Sets the bytes of system and video memory the cache may hold. Resources
+ * no longer referenced are kept until the budget is exceeded, then freed
+ * the least recently used first.
+ **/
+void
+r_resource_manager_set_budget(
+    gsize                   cpu_budget,
+    gsize                   gpu_budget
+    )
+{
+    g_rec_mutex_lock(&self.lock);
+    self.cpu_budget = cpu_budget;
+    self.gpu_budget = gpu_budget;
+    _resource_manager_evict();
+    g_rec_mutex_unlock(&self.lock);
+
+    _resource_manager_empty_trash();
+}
+
+/**
+ * r_resource_manager_get_stats:
+ *
+ * The idle count may include resources referenced again since they were
+ * released: they leave the LRU list lazily.
+ **/
+void
+r_resource_manager_get_stats(
+    RResourceManagerStats*  stats
+    )
+{
+    g_assert(stats != NULL);
+
+    g_rec_mutex_lock(&self.lock);
+    stats->hits = g_atomic_int_get(&self.hits);
+    stats->misses = g_atomic_int_get(&self.misses);
+    stats->evictions = self.evictions;
+    stats->idle_count = g_queue_get_length(&self.idle);
+    stats->cpu_size = self.cpu_size;
+    stats->gpu_size = self.gpu_size;
+    stats->cpu_budget = self.cpu_budget;
+    stats->gpu_budget = self.gpu_budget;
+    g_rec_mutex_unlock(&self.lock);
+}
+
+/**
+ * r_resource_manager_get_infos:
+ *
+ * Returns a snapshot of the cache, one #RResourceManagerInfo per resource
+ * sorted by @sort. The load time is the wall time in microseconds,
+ * including the dependencies loaded meanwhile, and the last access is the
+ * frame number of the last reference. Free it with
+ * r_resource_manager_free_infos().
+ **/
+GArray*
+r_resource_manager_get_infos(
+    guint                   sort
+    )
+{
+    GArray* infos;
+    guint i;
+
+    infos = g_array_new(FALSE, FALSE, sizeof(RResourceManagerInfo));
+    g_rec_mutex_lock(&self.lock);
+    for(i = 0; i < R_RESOURCE_SHARDS; i++)
+    {
+        g_mutex_lock(&self.shards[i].lock);
+        g_hash_table_foreach(self.shards[i].values, _resource_manager_cache_value_info, infos);
+        g_mutex_unlock(&self.shards[i].lock);
+    }
+    g_rec_mutex_unlock(&self.lock);
+
+    switch(sort)
+    {
+        case R_RESOURCE_SORT_SIZE:
+            g_array_sort(infos, _resource_manager_info_compare_size);
+            break;
+        case R_RESOURCE_SORT_LOAD_TIME:
+            g_array_sort(infos, _resource_manager_info_compare_load_time);
+            break;
+        default:
+            g_array_sort(infos, _resource_manager_info_compare_name);
+            break;
+    }
+    return infos;
+}
+
+/**
+ * r_resource_manager_free_infos:
+ *
+ **/
+void
+r_resource_manager_free_infos(
+    GArray*                 infos
+    )
+{
+    guint i;
+
+    g_assert(infos != NULL);
+
+    for(i = 0; i < infos->len; i++)
+    {
+        g_free(g_array_index(infos, RResourceManagerInfo, i).name);
+    }
+    g_array_free(infos, TRUE);
+}
+
+/**
+ * r_resource_ref:
+ *
+ * Returns the resource @key, loading it if needed, or NULL if it failed to
+ * load. It may be called from any thread: only the shard of @key is locked
+ * for a lookup, and a resource being loaded by another thread is waited
+ * for on its own.
+ **/
+gpointer
+r_resource_ref(
+    const gchar*      key
+    )
+{
+    _ResourceShard* shard;
+    RResourceManagerValue* value;
+    gpointer data;
+
+    g_assert(key != NULL);
+
+    shard = _resource_manager_shard(key);
+    g_mutex_lock(&shard->lock);
+    value = (RResourceManagerValue*)g_hash_table_lookup(shard->values, key);
+    if(value == NULL)
+    {
+        value = _resource_manager_cache_value_new((gpointer)g_strdup(key));
+        g_hash_table_insert(shard->values, value->name, value);
+        g_mutex_unlock(&shard->lock);
+        g_atomic_int_inc(&self.misses);
+        return _resource_manager_cache_value_load(shard, value);
+    }
+
+    /* an idle value leaves the LRU list when it is released again */
+    g_atomic_int_inc(&self.hits);
+    data = _resource_manager_cache_value_wait(shard, value);
+    g_mutex_unlock(&shard->lock);
+    return data;
+}
+
+/**
+ * r_resource_unref:
+ *
+ * Releases @key. A resource no longer referenced stays in the cache until
+ * the memory budget runs out, see r_resource_manager_set_budget().
+ **/
+void
+r_resource_unref(
+    const gchar*      key
+    )
+{
+    RResourceManagerValue* value;
     
+    g_assert(key != NULL);
+
+    g_rec_mutex_lock(&self.lock);
+    value = _resource_manager_lookup(key);
+    if(value != NULL)
+    {
+        _resource_manager_cache_value_unref(value);
+    }
+    g_rec_mutex_unlock(&self.lock);
+
+    _resource_manager_empty_trash();
+}
+
+/**
+ * r_resource_ref_handle:
+ *
+ * Like r_resource_ref(), but returns a handle to the resource: the name is
+ * looked up once, then the handle gives an indexed access. The handle goes
+ * stale once the resource is freed.
+ **/
+RResourceHandle
+r_resource_ref_handle(
+    const gchar*            key
+    )
+{
+    RResourceManagerValue* value;
+    RResourceHandle handle = R_RESOURCE_HANDLE_NONE;
+
+    g_assert(key != NULL);
+
+    r_resource_ref(key);
+    g_rec_mutex_lock(&self.lock);
+    value = _resource_manager_lookup(key);
+    if(value != NULL && value->state == R_RESOURCE_STATE_READY)
+    {
+        handle = value->id | (g_array_index(self.slots, _ResourceSlot, value->id).generation << R_RESOURCE_HANDLE_BITS);
+    }
+    g_rec_mutex_unlock(&self.lock);
+    return handle;
+}
+
+/**
+ * r_resource_handle_ref:
+ *
+ * Adds a reference through @handle. Returns NULL if it is stale.
+ **/
+gpointer
+r_resource_handle_ref(
+    RResourceHandle         handle
+    )
+{
+    _ResourceShard* shard;
+    RResourceManagerValue* value;
+    gpointer data = NULL;
+
+    g_rec_mutex_lock(&self.lock);
+    value = _resource_manager_handle_lookup(handle);
+    if(value != NULL)
+    {
+        shard = _resource_manager_shard(value->name);
+        g_mutex_lock(&shard->lock);
+        if(value->state == R_RESOURCE_STATE_READY)
+        {
+            if(value->link == NULL)
+            {
+                value->user_ref++;
+            }
+            value->hits++;
+            value->last_access = game->frame_number;
+            g_atomic_int_inc(&self.hits);
+            data = value->data;
+        }
+        g_mutex_unlock(&shard->lock);
+    }
+    g_rec_mutex_unlock(&self.lock);
+    return data;
+}
+
+/**
+ * r_resource_handle_get:
+ *
+ * Returns the resource of @handle without taking a reference, or NULL if
+ * @handle is stale.
+ **/
+gpointer
+r_resource_handle_get(
+    RResourceHandle         handle
+    )
+{
+    RResourceManagerValue* value;
+    gpointer data = NULL;
+
+    g_rec_mutex_lock(&self.lock);
+    value = _resource_manager_handle_lookup(handle);
+    if(value != NULL)
+    {
+        data = value->data;
+    }
+    g_rec_mutex_unlock(&self.lock);
+    return data;
+}
+
+/**
+ * r_resource_handle_unref:
+ *
+ **/
+void
+r_resource_handle_unref(
+    RResourceHandle         handle
+    )
+{
+    RResourceManagerValue* value;
+
+    g_rec_mutex_lock(&self.lock);
+    value = _resource_manager_handle_lookup(handle);
+    if(value != NULL)
+    {
+        _resource_manager_cache_value_unref(value);
+    }
+    g_rec_mutex_unlock(&self.lock);
+
+    _resource_manager_empty_trash();
+}
+
+/**
+ * r_resource_ref_async:
+ *
+ * Queues the loading of @key on the loader threads and returns at once.
+ * The request can be polled with r_resource_request_is_ready() and
+ * r_resource_request_has_failed(), and @callback, if any, runs in the main
+ * loop once it is done either way. Like r_resource_ref(), a loaded request
+ * holds a reference on @key.
+ **/
+RResourceRequest*
+r_resource_ref_async(
+    const gchar*            key,
+    RResourceRequestCallback callback,
+    gpointer                user_data
+    )
+{
+    g_assert(key != NULL);
+
+    if(g_atomic_int_get(&self.completed_count) == g_atomic_int_get(&self.requests_count))
+    {
+        /* the loader is idle, start a new progress batch */
+        g_atomic_int_set(&self.requests_count, 0);
+        g_atomic_int_set(&self.completed_count, 0);
+    }
+
+    /* explicit requests are served before the prefetches */
+    return _resource_request_new(key, callback, user_data, G_MAXFLOAT, 0, TRUE);
+}
+
+/**
+ * r_resource_request_is_ready:
+ *
+ **/
+gboolean
+r_resource_request_is_ready(
+    RResourceRequest*       request
+    )
+{
+    g_assert(request != NULL);
+
+    return g_atomic_int_get(&request->status) == R_RESOURCE_REQUEST_READY;
+}
+
+/**
+ * r_resource_request_has_failed:
+ *
+ * Returns TRUE once @request is done and its resource could not be
+ * loaded. A failed request holds no reference on its key.
+ **/
+gboolean
+r_resource_request_has_failed(
+    RResourceRequest*       request
+    )
+{
+    g_assert(request != NULL);
+
+    return g_atomic_int_get(&request->status) == R_RESOURCE_REQUEST_FAILED;
+}
+
+/**
+ * r_resource_request_get_data:
+ *
+ * Returns the loaded resource, NULL while the request is pending.
+ **/
+gpointer
+r_resource_request_get_data(
+    RResourceRequest*       request
+    )
+{
+    g_assert(request != NULL);
+
+    return r_resource_request_is_ready(request) ? request->data : NULL;
+}
+
+/**
+ * r_resource_request_free:
+ *
+ * Releases @request. The reference of a loaded request stays with the
+ * caller, to be released with r_resource_unref(); a pending request is
+ * cancelled and its reference released once loaded. The callback is never
+ * run after this call.
+ **/
+void
+r_resource_request_free(
+    RResourceRequest*       request
+    )
+{
+    g_assert(request != NULL);
+
+    /* a loaded request is cancelled too, its callback may still be queued */
+    g_atomic_int_set(&request->status, R_RESOURCE_REQUEST_CANCELLED);
+    _resource_request_unref(request);
+}
+
+/**
+ * r_resource_prefetch_begin:
+ *
+ * Starts a new prefetch set, see r_resource_prefetch_end().
+ **/
+void
+r_resource_prefetch_begin()
+{
+    g_hash_table_foreach(self.prefetches, _resource_prefetch_unmark, NULL);
+}
+
+/**
+ * r_resource_prefetch:
+ *
+ * Adds @key to the prefetch set: it is loaded in the background, the
+ * highest @priority first, and kept loaded while it stays in the set.
+ * Explicit requests always go before prefetches.
+ **/
+void
+r_resource_prefetch(
+    const gchar*            key,
+    gfloat                  priority
+    )
+{
+    _ResourcePrefetch* prefetch;
+
+    g_assert(key != NULL);
+
+    prefetch = g_hash_table_lookup(self.prefetches, key);
+    if(prefetch == NULL)
+    {
+        prefetch = g_slice_new(_ResourcePrefetch);
+        prefetch->request = _resource_request_new(key, NULL, NULL, priority, 0, FALSE);
+        g_hash_table_insert(self.prefetches, g_strdup(key), prefetch);
+    }
+    prefetch->marked = TRUE;
+}
+
+/**
+ * r_resource_prefetch_end:
+ *
+ * Demotes the keys of the previous set that were not prefetched again
+ * since r_resource_prefetch_begin(): a pending load is cancelled and a
+ * loaded resource released.
+ **/
+void
+r_resource_prefetch_end()
+{
+    g_hash_table_foreach_remove(self.prefetches, _resource_prefetch_is_unmarked, NULL);
+}
+
+/**
+ * r_resource_link:
+ *
+ * Makes @value a dependency of @key: it is not reference counted anymore
+ * and is freed right after @key. The link is remembered so that the next
+ * asynchronous load of @key queues @value first.
+ **/
+void
+r_resource_link(
+    RResourceManagerValue*  value,
+    const gchar*            key
+    )
+{
+    RResourceManagerValue* parent;
+    GList* orphans;
+
+    g_assert(value != NULL);
+    g_assert(key != NULL);
+
+    g_rec_mutex_lock(&self.lock);
+    _resource_manager_cache_value_detach(value);
     g_free(value->link);
     value->link = g_strdup(key);
+
+    parent = _resource_manager_lookup(key);
+    if(parent != NULL)
+    {
+        value->parent = parent;
+        parent->children = g_list_prepend(parent->children, value);
+    }
+    else
+    {
+        orphans = g_hash_table_lookup(self.orphans, key);
+        if(orphans == NULL)
+        {
+            g_hash_table_insert(self.orphans, g_strdup(key), g_list_prepend(NULL, value));
+        }
+        else
+        {
+            g_list_append(orphans, value);
+        }
+    }
+
+    _resource_manager_dependencies_add(key, value->name);
+    g_rec_mutex_unlock(&self.lock);
+}
+
+/**
+ * r_resource_depend:
+ *
+ * Declares that loading @key needs @dependency, before @key was ever
+ * loaded: asynchronous loads of @key queue @dependency first, as for the
+ * links seen by r_resource_link().
+ **/
+void
+r_resource_depend(
+    const gchar*            key,
+    const gchar*            dependency
+    )
+{
+    g_assert(key != NULL);
+    g_assert(dependency != NULL);
+
+    g_rec_mutex_lock(&self.lock);
+    _resource_manager_dependencies_add(key, dependency);
+    g_rec_mutex_unlock(&self.lock);
 }
 
 /**
@@ -59,11 +59,22 @@ r_thread_set_cpu_affinity(
     gint            cpu
     );
 
+#define R_DIGEST_LENGTH 20
+
+extern void
+r_digest_data(
+    gconstpointer   data,
+    gsize           length,
+    guint8*         digest
+    );
+
 /* Modules */
 
 struct _RModule
 {
     gpointer        (*load_from_file)(const gchar* file_name);
+    gpointer        (*load_from_data)(const gchar* file_name, gconstpointer data, gsize length);
+    gpointer        (*load_frame_from_data)(const gchar* file_name, gconstpointer data, gsize length);
 };
 typedef struct _RModule RModule;
 
@@ -86,6 +97,49 @@ extern RModule*
 r_modules_lookup(
     const gchar*      file_name
     );
+
+extern gpointer
+r_modules_load(
+    const gchar*      file_name
+    );
+
+extern gpointer
+r_modules_load_frame(
+    const gchar*      file_name
+    );
+
+/* Pak */
+
+#define R_PAK_DEFAULT_NAME  "data.rpak"
+
+extern gboolean
+r_pak_mount(
+    const gchar*            file_name
+    );
+
+extern void
+r_pak_unmount_all();
+
+extern gboolean
+r_pak_lookup(
+    const gchar*            file_name,
+    gconstpointer*          data,
+    gsize*                  length,
+    GMappedFile**           mapping
+    );
+
+extern gboolean
+r_pak_checksum(
+    const gchar*            file_name,
+    GChecksum*              checksum
+    );
+
+extern gboolean
+r_pak_build(
+    const gchar*            file_name,
+    const gchar*            root_dir,
+    const gchar**           names
+    );
     
 /* RDesktop */
 
@@ -183,6 +237,7 @@ struct _RGame
     Display*                display;
     XVisualInfo*            visual;
     guint                   frame_time;
+    guint                   frame_number;
 };
 typedef struct _RGame*      RGame;
 extern const RGame          game;
@@ -304,6 +359,7 @@ struct _RRenderer
     void                    (*resume)();
     void                    (*resize)(guint width, guint height);
     gpointer                (*execute)(GThreadFunc func, gpointer data, GSourceFunc completed_function);
+    void                    (*flush)();
 };
 typedef struct _RRenderer*  RRenderer;
 
@@ -331,6 +387,11 @@ r_renderer_resize_viewport(
     guint               height
     );
 
+extern float4x4*
+r_renderer_get_projection(
+    float4x4*           projection
+    );
+
 extern void
 r_renderer_render_scene();
 
@@ -373,6 +434,12 @@ r_renderer_execute_full(GThreadFunc function, gpointer data, GSourceFunc complet
     return (renderer->execute != NULL) ? renderer->execute(function, data, completed_function) : NULL;
 }
 
+static inline void
+r_renderer_flush()
+{
+    if(renderer->flush != NULL) renderer->flush();
+}
+
 extern void
 r_renderer_begin_2D();
 
@@ -386,6 +453,7 @@ struct _RImage
     guint           width;
     guint           height;
     guint           bytes_per_pixel;
+    guint           levels_count;
     guint8*         pixel_data;
 };
 typedef struct _RImage RImage;
@@ -407,6 +475,28 @@ r_image_free(
     RImage*         image
     );
 
+extern gboolean
+r_image_fingerprint(
+    const gchar*    file_name,
+    GChecksum*      checksum
+    );
+
+extern gsize
+r_image_get_level_size(
+    RImage*         image,
+    guint           level
+    );
+
+extern gboolean
+r_image_bake(
+    const gchar*    file_name
+    );
+
+extern gboolean
+r_image_bake_is_fresh(
+    const gchar*    file_name
+    );
+
 /* RTexture */
 
 enum
@@ -423,6 +513,15 @@ r_texture_new(
     gboolean        free_image
     );
 
+extern GLuint
+r_texture_new_from_file(
+    const gchar*    file_name,
+    gint            min_filter,
+    gint            mag_filter,
+    gboolean        wrap,
+    gsize*          texture_size
+    );
+
 extern GLuint
 r_texture_new_mipmap(
     RImage*         image,
@@ -450,6 +549,7 @@ struct _RMaterial
 {
     guint                   ref;
     GLuint                  texture;
+    gsize                   texture_size;
     float4                  color;
 };
 typedef struct _RMaterial   RMaterial;
@@ -482,6 +582,7 @@ struct _RMeshPart
     RMaterial*              skin;
     guint                   offset;
     guint                   count;
+    gchar*                  skin_name;
 };
 typedef struct _RMeshPart RMeshPart;
 
@@ -499,25 +600,28 @@ struct _RMesh
 };
 typedef struct _RMesh       RMesh;
 
-extern gboolean
-r_mesh_element_equals(
-    RMeshElement*           e1,
-    RMeshElement*           e2
+typedef struct _RMeshWelder RMeshWelder;
+
+#define R_MESH_WELD_EPSILON     0.00001f
+
+extern RMeshWelder*
+r_mesh_welder_new(
+    RMeshElement*           elements,
+    guint                   capacity,
+    gfloat                  epsilon
     );
 
 extern gboolean
-r_mesh_element_insert(
-    RMeshElement*           elements,
+r_mesh_welder_insert(
+    RMeshWelder*            welder,
     guint                   index,
     RMeshElement*           element,
     guint*                  result_index
     );
-    
+
 extern void
-r_mesh_element_replace(
-    RMeshElement*           elements,
-    guint                   index,
-    RMeshElement*           element
+r_mesh_welder_free(
+    RMeshWelder*            welder
     );
 
 extern RMesh*
@@ -540,11 +644,23 @@ r_mesh_new_from_files(
     RMaterial*              default_skin
     );
     
+extern void
+r_mesh_shrink(
+    RMesh*                  mesh
+    );
+
 extern void
 r_mesh_free(
     RMesh*                  mesh
     );
 
+extern void
+r_mesh_get_size(
+    RMesh*                  mesh,
+    gsize*                  cpu_size,
+    gsize*                  gpu_size
+    );
+
 extern void
 r_mesh_compute_bbox(
     RMesh*                  mesh,
@@ -576,6 +692,27 @@ r_mesh_draw_full(
     gboolean                repeat_mode
     );
 
+extern void
+r_mesh_draw_frame(
+    float4x4*               view,
+    RMesh*                  mesh,
+    guint                   frame_first,
+    guint                   frame_last,
+    gfloat                  frame
+    );
+
+extern gboolean
+r_mesh_bake(
+    const gchar*            file_name,
+    gboolean                meshgroup
+    );
+
+extern gboolean
+r_mesh_bake_is_fresh(
+    const gchar*            file_name,
+    gboolean                meshgroup
+    );
+
 /* RMeshGroup */
 
 struct _RMeshGroup
@@ -598,6 +735,13 @@ extern void
 r_meshgroup_free(
     RMeshGroup*             meshgroup
     );
+
+extern void
+r_meshgroup_get_size(
+    RMeshGroup*             meshgroup,
+    gsize*                  cpu_size,
+    gsize*                  gpu_size
+    );
     
 extern RMesh*
 r_meshgroup_get(
@@ -605,11 +749,22 @@ r_meshgroup_get(
     const gchar*            group_name
     );
 
+extern RMeshGroup*
+r_meshgroup_bake_load(
+    const gchar*            file_name
+    );
+
+extern void
+r_meshgroup_bake_free(
+    RMeshGroup*             meshgroup
+    );
+
 /* RSurface */
 
 struct _RSurface
 {
     GLuint                  texture;
+    gsize                   texture_size;
     gboolean                alpha;
     gfloat                  x;
     gfloat                  y;
@@ -645,6 +800,7 @@ r_surface_draw(
 struct _RFont
 {
     GLuint                  texture;
+    gsize                   texture_size;
     gboolean                alpha;
     guint                   char_width;
     guint                   char_height;
@@ -736,6 +892,20 @@ enum
     R_RESOURCE_CUSTOM    = 10
 };
 
+enum
+{
+    R_RESOURCE_STATE_LOADING = 0,
+    R_RESOURCE_STATE_READY   = 1,
+    R_RESOURCE_STATE_FAILED  = 2
+};
+
+enum
+{
+    R_RESOURCE_SORT_NAME      = 0,
+    R_RESOURCE_SORT_SIZE      = 1,
+    R_RESOURCE_SORT_LOAD_TIME = 2
+};
+
 struct _RResourceManagerValue
 {
     guint           user_ref;
@@ -744,11 +914,58 @@ struct _RResourceManagerValue
     gchar*          link;
     gpointer        data;
     GDestroyNotify  custom_free_func;
+    guint           state;
+    gsize           cpu_size;
+    gsize           gpu_size;
+    GList*          lru;
+    struct _RResourceManagerValue* parent;
+    GList*          children;
+    guint           id;
+    GCond           ready;
+    guint           waiters;
+    gint64          load_time;
+    guint           hits;
+    guint           last_access;
 };
 typedef struct _RResourceManagerValue RResourceManagerValue;
 
+struct _RResourceManagerStats
+{
+    guint           hits;
+    guint           misses;
+    guint           evictions;
+    guint           idle_count;
+    gsize           cpu_size;
+    gsize           gpu_size;
+    gsize           cpu_budget;
+    gsize           gpu_budget;
+};
+typedef struct _RResourceManagerStats RResourceManagerStats;
+
+struct _RResourceManagerInfo
+{
+    gchar*          name;
+    guint           type;
+    guint           state;
+    guint           user_ref;
+    gsize           cpu_size;
+    gsize           gpu_size;
+    gint64          load_time;
+    guint           hits;
+    guint           last_access;
+};
+typedef struct _RResourceManagerInfo RResourceManagerInfo;
+
+typedef struct _RResourceRequest RResourceRequest;
+
+typedef guint32 RResourceHandle;
+
+#define R_RESOURCE_HANDLE_NONE  0
+
 typedef void (*RResourceCallback)(RResourceManagerValue* value);
 
+typedef void (*RResourceRequestCallback)(RResourceRequest* request, gpointer user_data);
+
 extern void
 r_resource_manager_init();
 
@@ -763,11 +980,94 @@ r_resource_ref(
     const gchar*            key
     );
 
+extern RResourceHandle
+r_resource_ref_handle(
+    const gchar*            key
+    );
+
+extern gpointer
+r_resource_handle_ref(
+    RResourceHandle         handle
+    );
+
+extern gpointer
+r_resource_handle_get(
+    RResourceHandle         handle
+    );
+
+extern void
+r_resource_handle_unref(
+    RResourceHandle         handle
+    );
+
 extern void
 r_resource_unref(
     
     const gchar*            key
     );
+
+extern RResourceRequest*
+r_resource_ref_async(
+    const gchar*            key,
+    RResourceRequestCallback callback,
+    gpointer                user_data
+    );
+
+extern gboolean
+r_resource_request_is_ready(
+    RResourceRequest*       request
+    );
+
+extern gboolean
+r_resource_request_has_failed(
+    RResourceRequest*       request
+    );
+
+extern gpointer
+r_resource_request_get_data(
+    RResourceRequest*       request
+    );
+
+extern void
+r_resource_request_free(
+    RResourceRequest*       request
+    );
+
+extern gfloat
+r_resource_manager_get_progress();
+
+extern void
+r_resource_manager_set_budget(
+    gsize                   cpu_budget,
+    gsize                   gpu_budget
+    );
+
+extern void
+r_resource_manager_get_stats(
+    RResourceManagerStats*  stats
+    );
+
+extern GArray*
+r_resource_manager_get_infos(
+    guint                   sort
+    );
+
+extern void
+r_resource_manager_free_infos(
+    GArray*                 infos
+    );
+
+extern void
+r_resource_prefetch_begin();
+
+extern void
+r_resource_prefetch(
+    const gchar*            key,
+    gfloat                  priority
+    );
+
+extern void
+r_resource_prefetch_end();
     
 extern void
 r_resource_link(
@@ -775,6 +1075,12 @@ r_resource_link(
     const gchar*            key
     );
 
+extern void
+r_resource_depend(
+    const gchar*            key,
+    const gchar*            dependency
+    );
+
 extern void
 r_resource_default_unload(
     RResourceManagerValue*  value
@@ -49,18 +49,20 @@ r_surface_new_from_file(
     const gchar*            file_name
     )
 {
-    RImage* image;
     RSurface* surface;
+    GLuint texture;
+    gsize texture_size;
     
     g_assert(file_name != NULL);
     
-    image = r_image_new_from_file(file_name);
-    if(image == NULL)
+    texture = r_texture_new_from_file(file_name, GL_LINEAR, GL_LINEAR, FALSE, &texture_size);
+    if(texture == R_TEXTURE_NONE)
     {
         return NULL;
     }
     surface = r_surface_new();
-    surface->texture = r_texture_new(image, GL_LINEAR, GL_LINEAR, FALSE, TRUE);
+    surface->texture_size = texture_size;
+    surface->texture = texture;
     return surface;
 }
 
@@ -27,6 +27,10 @@ typedef struct __GenerateTextureParams _GenerateTextureParams;
 
 typedef struct __ReplaceTextureParams _ReplaceTextureParams;
 
+typedef struct __SharedTexture _SharedTexture;
+
+typedef struct __TextureCache _TextureCache;
+
 /* --- structures --- */
 struct __GenerateTextureParams
 {
@@ -44,7 +48,96 @@ struct __ReplaceTextureParams
     gboolean    free_image;
 };
 
+struct __SharedTexture
+{
+    GLuint      texture;
+    guint       ref;
+    gchar*      digest;
+};
+
+/*
+ * The textures created from files, found by the digest of the file and of
+ * the texture parameters, or by their name to release them.
+ */
+struct __TextureCache
+{
+/* private */
+    GMutex      lock;
+    GHashTable* digests;
+    GHashTable* textures;
+};
+
+/* --- variables --- */
+static _TextureCache self = {{0}, NULL, NULL};
+
 /* --- functions --- */
+/*
+ * _texture_is_mipmapped:
+ *
+ */
+static gboolean
+_texture_is_mipmapped(
+    gint        min_filter
+    )
+{
+    return min_filter != GL_NEAREST && min_filter != GL_LINEAR;
+}
+
+/*
+ * _texture_get_size:
+ *
+ * Returns the video memory taken by @image, with its whole mipmap chain
+ * when @mipmap.
+ */
+static gsize
+_texture_get_size(
+    RImage*     image,
+    gboolean    mipmap
+    )
+{
+    gsize size;
+    guint level;
+
+    size = r_image_get_level_size(image, 0);
+    for(level = 1; mipmap && ((image->width | image->height) >> level) > 0; level++)
+    {
+        size += r_image_get_level_size(image, level);
+    }
+    return size;
+}
+
+/*
+ * _texture_upload:
+ *
+ * Uploads the first @levels_count levels of @image to the bound texture.
+ */
+static void
+_texture_upload(
+    RImage*     image,
+    guint       levels_count
+    )
+{
+    const guint8* pixels;
+    guint width, height;
+    guint level;
+
+    pixels = image->pixel_data;
+    for(level = 0; level < levels_count; level++)
+    {
+        width = MAX(image->width >> level, 1);
+        height = MAX(image->height >> level, 1);
+        if(image->bytes_per_pixel == 3)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        }
+        else if(image->bytes_per_pixel == 4)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+        pixels += r_image_get_level_size(image, level);
+    }
+}
+
 /*
  * _texture_free_delegate:
  *
@@ -68,6 +161,7 @@ _texture_generate_delegate(
     )
 {
     GLuint texture = R_TEXTURE_NONE;
+    guint levels_count;
 
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
@@ -79,16 +173,18 @@ _texture_generate_delegate(
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, params->mag_filter);
     
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 
-    if(params->image->bytes_per_pixel == 3)
+    /* the mipmaps baked with the image are uploaded, else built by GL */
+    levels_count = _texture_is_mipmapped(params->min_filter) ? params->image->levels_count : 1;
+    if(_texture_is_mipmapped(params->min_filter) && levels_count == 1)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, params->image->width, params->image->height, 0, GL_RGB, GL_UNSIGNED_BYTE, params->image->pixel_data);
+        glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
     }
-    else if(params->image->bytes_per_pixel == 4)
+    else
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, params->image->width, params->image->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, params->image->pixel_data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_count - 1);
     }
+    _texture_upload(params->image, levels_count);
     
     if(params->free_image)
     {
@@ -195,6 +291,96 @@ r_texture_new(
     return GPOINTER_TO_UINT(r_renderer_execute((GThreadFunc) _texture_generate_delegate, params));
 }
 
+/**
+ * r_texture_new_from_file:
+ *
+ * Returns a texture of the image @file_name, shared by every texture
+ * created from the same image, as told by r_image_fingerprint(), with the
+ * same parameters, or R_TEXTURE_NONE if it cannot be read. @texture_size is set to the bytes
+ * of video memory taken, 0 when the texture was already there. The texture
+ * is released with r_texture_free() once per call.
+ **/
+GLuint
+r_texture_new_from_file(
+    const gchar*    file_name,
+    gint            min_filter,
+    gint            mag_filter,
+    gboolean        wrap,
+    gsize*          texture_size
+    )
+{
+    _SharedTexture* shared;
+    GChecksum* checksum;
+    RImage* image;
+    gchar* digest;
+    gsize size;
+    GLuint texture;
+
+    g_assert(file_name != NULL);
+    g_assert(texture_size != NULL);
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, (const guchar*) &min_filter, sizeof(min_filter));
+    g_checksum_update(checksum, (const guchar*) &mag_filter, sizeof(mag_filter));
+    g_checksum_update(checksum, (const guchar*) &wrap, sizeof(wrap));
+    if(!r_image_fingerprint(file_name, checksum))
+    {
+        g_checksum_free(checksum);
+        return R_TEXTURE_NONE;
+    }
+    digest = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+
+    g_mutex_lock(&self.lock);
+    if(self.digests == NULL)
+    {
+        self.digests = g_hash_table_new(g_str_hash, g_str_equal);
+        self.textures = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    shared = g_hash_table_lookup(self.digests, digest);
+    if(shared != NULL)
+    {
+        shared->ref++;
+        g_mutex_unlock(&self.lock);
+        g_free(digest);
+        *texture_size = 0;
+        return shared->texture;
+    }
+    g_mutex_unlock(&self.lock);
+
+    image = r_image_new_from_file(file_name);
+    if(image == NULL)
+    {
+        g_free(digest);
+        return R_TEXTURE_NONE;
+    }
+    size = _texture_get_size(image, _texture_is_mipmapped(min_filter));
+    texture = r_texture_new(image, min_filter, mag_filter, wrap, TRUE);
+
+    g_mutex_lock(&self.lock);
+    shared = g_hash_table_lookup(self.digests, digest);
+    if(shared != NULL)
+    {
+        /* created meanwhile by another thread */
+        shared->ref++;
+        g_mutex_unlock(&self.lock);
+        g_free(digest);
+        r_texture_free(texture);
+        *texture_size = 0;
+        return shared->texture;
+    }
+    shared = g_slice_new(_SharedTexture);
+    shared->texture = texture;
+    shared->ref = 1;
+    shared->digest = digest;
+    g_hash_table_insert(self.digests, shared->digest, shared);
+    g_hash_table_insert(self.textures, GUINT_TO_POINTER(texture), shared);
+    g_mutex_unlock(&self.lock);
+
+    *texture_size = size;
+    return texture;
+}
+
 /**
  * r_texture_new_mipmap:
  *
@@ -226,17 +412,41 @@ r_texture_new_mipmap(
 /**
  * r_texture_free:
  *
- *
+ * A texture shared by r_texture_new_from_file() is deleted with its last
+ * reference.
  **/
 void
 r_texture_free(
     GLuint      texture
     )
 {
-    if(texture != R_TEXTURE_NONE)
+    _SharedTexture* shared = NULL;
+
+    if(texture == R_TEXTURE_NONE)
     {
-        r_renderer_execute((GThreadFunc) _texture_free_delegate, &texture);
+        return;
     }
+
+    g_mutex_lock(&self.lock);
+    if(self.textures != NULL)
+    {
+        shared = g_hash_table_lookup(self.textures, GUINT_TO_POINTER(texture));
+    }
+    if(shared != NULL)
+    {
+        if(--shared->ref > 0)
+        {
+            g_mutex_unlock(&self.lock);
+            return;
+        }
+        g_hash_table_remove(self.textures, GUINT_TO_POINTER(texture));
+        g_hash_table_remove(self.digests, shared->digest);
+        g_free(shared->digest);
+        g_slice_free(_SharedTexture, shared);
+    }
+    g_mutex_unlock(&self.lock);
+
+    r_renderer_execute((GThreadFunc) _texture_free_delegate, &texture);
 }
 
 /**
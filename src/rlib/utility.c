@@ -52,4 +52,24 @@ r_thread_set_cpu_affinity(
     sched_setaffinity(syscall(SYS_gettid), sizeof(cpu_set_t), &mask);
 }
 
+/**
+ * r_digest_data:
+ *
+ * Writes to @digest the SHA-1 of the @length bytes of @data, strong enough
+ * to tell two payloads apart by their digests alone.
+ **/
+void
+r_digest_data(
+    gconstpointer   data,
+    gsize           length,
+    guint8*         digest
+    )
+{
+    GChecksum* checksum;
+    gsize digest_length = R_DIGEST_LENGTH;
 
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, data, length);
+    g_checksum_get_digest(checksum, digest, &digest_length);
+    g_checksum_free(checksum);
+}
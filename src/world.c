@@ -23,6 +23,40 @@
  */
 
 #include <globals.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define WORLD_CACHE_MAGIC       0x444C5752
+#define WORLD_CACHE_VERSION     1
+#define WORLD_CACHE_SUFFIX      ".rworld"
+
+/* --- types --- */
+typedef struct _WorldCacheHeader _WorldCacheHeader;
+
+typedef struct _WorldCacheNode _WorldCacheNode;
+
+/* --- structures --- */
+struct _WorldCacheHeader
+{
+    guint32                 magic;
+    guint32                 version;
+    guint32                 nodes_count;
+    guint32                 reserved;
+    guint64                 source_mtime;
+    guint64                 source_size;
+};
+
+/* followed by the name of the mesh group, padded to 4 bytes */
+struct _WorldCacheNode
+{
+    guint32                 id;
+    guint32                 type;
+    guint32                 links[2];
+    float3                  bbox[2];
+    guint32                 name_length;
+};
 
 /* --- variables --- */
 World* manor;
@@ -67,19 +101,22 @@ _world_node_reset(
 }
 
 /*
- * _world_node_draw:
+ * _world_node_collect:
  *
  */
 static void
-_world_node_draw(
-    float4x4*       view,
+_world_node_collect(
+    RFrustum*       frustum,
     WorldNode*      node,
-    gint            depth
+    gint            depth,
+    GPtrArray*      meshes
     )
 {
     GList* p;
     WorldNode* portal;
     WorldNode* sculture;
+    guint plane_mask;
+    guint i;
 
     if(depth <= 0)
     {
@@ -93,46 +130,153 @@ _world_node_draw(
 
     node->any.visited = TRUE;
 
-    if(!r_frustum_test_bbox(view, node->any.bbox))
-        return;
+    plane_mask = R_FRUSTUM_ALL_PLANES;
+    if(!r_frustum_test_bbox_masked(frustum, node->any.bbox, &plane_mask))
     {
+        return;
     }
 
-    r_mesh_draw(NULL, node->any.mesh);
+    g_ptr_array_add(meshes, node->any.mesh);
 
     if(node->any.type == WORLD_ROOM)
     {
         for(p = g_list_first(node->room.portals); p != NULL; p = g_list_next(p))
         {
             portal = p->data;
-            _world_node_draw(view, portal, depth);
+            _world_node_collect(frustum, portal, depth, meshes);
         }
-        for(p = g_list_first(node->room.scultures); p != NULL; p = g_list_next(p))
+
+        /* scultures are inside the room, only test the planes it straddles */
+        if(plane_mask == 0)
         {
-            sculture = p->data;
-            if(r_frustum_test_bbox(view, sculture->sculture.bbox))
+            for(p = g_list_first(node->room.scultures); p != NULL; p = g_list_next(p))
+            {
+                sculture = p->data;
+                g_ptr_array_add(meshes, sculture->sculture.mesh);
+            }
+        }
+        else if(r_frustum_cull_bboxes(
+                    frustum,
+                    node->room.scultures_bbox,
+                    node->room.scultures_count,
+                    plane_mask,
+                    node->room.scultures_visibility) > 0)
+        {
+            for(p = g_list_first(node->room.scultures), i = 0; p != NULL; p = g_list_next(p), i++)
             {
-                r_mesh_draw(NULL, sculture->sculture.mesh);
+                sculture = p->data;
+                if(node->room.scultures_visibility[i])
+                {
+                    g_ptr_array_add(meshes, sculture->sculture.mesh);
+                }
             }
         }
     }
     else if(node->any.type == WORLD_PORTAL)
     {
-        _world_node_draw(view, node->portal.back, depth - 1);
-        _world_node_draw(view, node->portal.front, depth - 1);
+        _world_node_collect(frustum, node->portal.back, depth - 1, meshes);
+        _world_node_collect(frustum, node->portal.front, depth - 1, meshes);
     }
 }
 
-/**
- * world_new:
+/*
+ * _world_node_pack_scultures:
  *
- **/
-World*
-world_new(
-    RMeshGroup*             groups
+ * Copies the sculture bboxes of a room in one array for batched culling.
+ */
+static void
+_world_node_pack_scultures(
+    WorldNode*              node
+    )
+{
+    GList* p;
+    WorldNode* sculture;
+    guint i;
+
+    node->room.scultures_count = g_list_length(node->room.scultures);
+    node->room.scultures_bbox = g_new(float3, node->room.scultures_count * 2);
+    node->room.scultures_visibility = g_new0(gboolean, node->room.scultures_count);
+
+    for(p = g_list_first(node->room.scultures), i = 0; p != NULL; p = g_list_next(p), i++)
+    {
+        sculture = p->data;
+        node->room.scultures_bbox[i * 2 + 0] = sculture->sculture.bbox[0];
+        node->room.scultures_bbox[i * 2 + 1] = sculture->sculture.bbox[1];
+    }
+}
+
+/*
+ * _world_node_prefetch_mesh:
+ *
+ */
+static void
+_world_node_prefetch_mesh(
+    RMesh*                  mesh,
+    gfloat                  priority
+    )
+{
+    guint i;
+
+    for(i = 0; i < mesh->parts_count; i++)
+    {
+        if(mesh->parts[i].skin_name != NULL)
+        {
+            r_resource_prefetch(mesh->parts[i].skin_name, priority);
+        }
+    }
+}
+
+/*
+ * _world_node_prefetch:
+ *
+ * The rooms ahead of the motion go first, the nearer the sooner.
+ */
+static void
+_world_node_prefetch(
+    WorldNode*              room,
+    guint                   hops,
+    float3*                 position,
+    float3*                 velocity
+    )
+{
+    float3 direction;
+    gfloat speed, distance;
+    gfloat alignment;
+    gfloat priority;
+    GList* p;
+
+    alignment = 0.0f;
+    speed = length3(velocity);
+    direction.x = room->any.bbox[0].x - position->x;
+    direction.y = room->any.bbox[0].y - position->y;
+    direction.z = room->any.bbox[0].z - position->z;
+    distance = length3(&direction);
+    if(hops > 0 && speed > EPSILON && distance > EPSILON)
+    {
+        alignment = dot3(velocity, &direction) / (speed * distance);
+    }
+
+    priority = (hops == 0) ? 1.0f : (1.0f + alignment) / (2.0f * (1.0f + hops));
+
+    _world_node_prefetch_mesh(room->room.mesh, priority);
+    for(p = g_list_first(room->room.scultures); p != NULL; p = g_list_next(p))
+    {
+        _world_node_prefetch_mesh(((WorldNode*) p->data)->any.mesh, priority);
+    }
+}
+
+/*
+ * _world_build:
+ *
+ * Builds the nodes of @world from the names of its mesh groups: R_<room>,
+ * P_<front room>_<back room> for the portals and S_<room> for the
+ * scultures.
+ */
+static void
+_world_build(
+    World*                  world
     )
 {
-    World* world;
     WorldNode node;
     gchar* group_name;
     RMesh* group;
@@ -140,13 +284,11 @@ world_new(
     gchar** tokens;
     guint id, id1, id2;
 
-    world = g_slice_new0(World);
     world->nodes = g_array_sized_new(
         FALSE,
         TRUE,
         sizeof(WorldNode),
-        g_hash_table_size(groups->groups));
-    world->groups = groups;
+        g_hash_table_size(world->groups->groups));
 
     id = 0;
 
@@ -168,6 +310,9 @@ world_new(
         r_mesh_compute_bbox(node.room.mesh, 0, node.room.bbox);
         node.room.portals = NULL;
         node.room.scultures = NULL;
+        node.room.scultures_count = 0;
+        node.room.scultures_bbox = NULL;
+        node.room.scultures_visibility = NULL;
         g_array_append_val(world->nodes, node);
 
         id++;
@@ -233,10 +378,339 @@ world_new(
 
         id++;
     }
+}
+
+/*
+ * _world_save:
+ *
+ * Writes the nodes of @world, built from the mesh groups of @file_name,
+ * to "<file_name>.rworld": per node its type, its bbox, the nodes it links
+ * and the name of its mesh group.
+ */
+static gboolean
+_world_save(
+    World*                  world,
+    const gchar*            file_name
+    )
+{
+    static const guint8 padding[4] = {0, 0, 0, 0};
+    _WorldCacheHeader header;
+    _WorldCacheNode record;
+    GHashTable* names;
+    GHashTableIter iter;
+    GByteArray* buffer;
+    WorldNode* base;
+    WorldNode* node;
+    struct stat st;
+    gchar* cache_name;
+    gchar* name;
+    RMesh* mesh;
+    gboolean result;
+    guint i;
+
+    if(g_stat(file_name, &st) != 0)
+    {
+        return FALSE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = WORLD_CACHE_MAGIC;
+    header.version = WORLD_CACHE_VERSION;
+    header.nodes_count = world->nodes->len;
+    header.source_mtime = st.st_mtime;
+    header.source_size = st.st_size;
+
+    names = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_iter_init(&iter, world->groups->groups);
+    while(g_hash_table_iter_next(&iter, (gpointer) &name, (gpointer) &mesh))
+    {
+        g_hash_table_insert(names, mesh, name);
+    }
+
+    buffer = g_byte_array_new();
+    g_byte_array_append(buffer, (guint8*) &header, sizeof(header));
+    base = &g_array_index(world->nodes, WorldNode, 0);
+    for(i = 0; i < world->nodes->len; i++)
+    {
+        node = &g_array_index(world->nodes, WorldNode, i);
+        name = g_hash_table_lookup(names, node->any.mesh);
+
+        memset(&record, 0, sizeof(record));
+        record.id = node->any.id;
+        record.type = node->any.type;
+        record.links[0] = G_MAXUINT32;
+        record.links[1] = G_MAXUINT32;
+        if(node->any.type == WORLD_PORTAL)
+        {
+            record.links[0] = node->portal.front - base;
+            record.links[1] = node->portal.back - base;
+        }
+        else if(node->any.type == WORLD_SCULTURE)
+        {
+            record.links[0] = node->sculture.owner - base;
+        }
+        record.bbox[0] = node->any.bbox[0];
+        record.bbox[1] = node->any.bbox[1];
+        record.name_length = strlen(name);
+        g_byte_array_append(buffer, (guint8*) &record, sizeof(record));
+        g_byte_array_append(buffer, (guint8*) name, record.name_length);
+        g_byte_array_append(buffer, padding, (4 - record.name_length % 4) % 4);
+    }
+    g_hash_table_destroy(names);
+
+    cache_name = g_strconcat(file_name, WORLD_CACHE_SUFFIX, NULL);
+    result = g_file_set_contents(cache_name, (gchar*) buffer->data, buffer->len, NULL);
+    g_free(cache_name);
+    g_byte_array_free(buffer, TRUE);
+    return result;
+}
+
+/*
+ * _world_load:
+ *
+ * Reads the nodes of @world from "<file_name>.rworld", from the mounted
+ * paks or the file system. Returns FALSE, leaving @world untouched, when
+ * the cache is missing, from another version, older than its source or
+ * naming a mesh group that @world does not have.
+ */
+static gboolean
+_world_load(
+    World*                  world,
+    const gchar*            file_name
+    )
+{
+    const _WorldCacheHeader* header;
+    const _WorldCacheNode* record;
+    GMappedFile* mapping;
+    const guint8* cursor;
+    const guint8* end;
+    gconstpointer data;
+    gsize length;
+    struct stat st;
+    gchar* cache_name;
+    gchar* name;
+    WorldNode* base;
+    WorldNode* node;
+    RMesh* mesh;
+    guint32* links;
+    gboolean result;
+    guint i;
+
+    cache_name = g_strconcat(file_name, WORLD_CACHE_SUFFIX, NULL);
+    if(r_pak_lookup(cache_name, &data, &length, &mapping))
+    {
+        g_mapped_file_ref(mapping);
+    }
+    else
+    {
+        mapping = g_mapped_file_new(cache_name, FALSE, NULL);
+        if(mapping != NULL)
+        {
+            data = g_mapped_file_get_contents(mapping);
+            length = g_mapped_file_get_length(mapping);
+        }
+    }
+    g_free(cache_name);
+    if(mapping == NULL)
+    {
+        return FALSE;
+    }
+
+    cursor = (const guint8*) data;
+    end = cursor + length;
+    header = (const _WorldCacheHeader*) cursor;
+    if(length < sizeof(_WorldCacheHeader) ||
+        header->magic != WORLD_CACHE_MAGIC ||
+        header->version != WORLD_CACHE_VERSION ||
+        header->nodes_count == 0 ||
+        (g_stat(file_name, &st) == 0 && (header->source_mtime != (guint64) st.st_mtime || header->source_size != (guint64) st.st_size)))
+    {
+        g_mapped_file_unref(mapping);
+        return FALSE;
+    }
+    cursor += sizeof(_WorldCacheHeader);
+
+    world->nodes = g_array_sized_new(FALSE, TRUE, sizeof(WorldNode), header->nodes_count);
+    g_array_set_size(world->nodes, header->nodes_count);
+    base = &g_array_index(world->nodes, WorldNode, 0);
+    links = g_new(guint32, header->nodes_count * 2);
+
+    result = TRUE;
+    for(i = 0; result && i < header->nodes_count; i++)
+    {
+        record = (const _WorldCacheNode*) cursor;
+        if((gsize) (end - cursor) < sizeof(_WorldCacheNode) ||
+            (gsize) (end - cursor) - sizeof(_WorldCacheNode) < record->name_length)
+        {
+            result = FALSE;
+            break;
+        }
+        name = g_strndup((const gchar*) (record + 1), record->name_length);
+        mesh = g_hash_table_lookup(world->groups->groups, name);
+        g_free(name);
+
+        node = &base[i];
+        node->any.id = record->id;
+        node->any.type = record->type;
+        node->any.mesh = mesh;
+        node->any.bbox[0] = record->bbox[0];
+        node->any.bbox[1] = record->bbox[1];
+        links[i * 2 + 0] = record->links[0];
+        links[i * 2 + 1] = record->links[1];
+        result = (mesh != NULL) && (record->type == WORLD_ROOM || record->type == WORLD_PORTAL || record->type == WORLD_SCULTURE);
+
+        cursor += sizeof(_WorldCacheNode) + record->name_length + (4 - record->name_length % 4) % 4;
+        cursor = MIN(cursor, end);
+    }
+
+    /* the links must point to rooms before any list is built */
+    for(i = 0; result && i < header->nodes_count; i++)
+    {
+        if(base[i].any.type == WORLD_PORTAL)
+        {
+            result = links[i * 2 + 1] < header->nodes_count && base[links[i * 2 + 1]].any.type == WORLD_ROOM;
+        }
+        if(base[i].any.type != WORLD_ROOM)
+        {
+            result = result && links[i * 2 + 0] < header->nodes_count && base[links[i * 2 + 0]].any.type == WORLD_ROOM;
+        }
+    }
+
+    for(i = 0; result && i < header->nodes_count; i++)
+    {
+        node = &base[i];
+        if(node->any.type == WORLD_PORTAL)
+        {
+            node->portal.front = &base[links[i * 2 + 0]];
+            node->portal.back = &base[links[i * 2 + 1]];
+            node->portal.front->room.portals = g_list_prepend(node->portal.front->room.portals, node);
+            node->portal.back->room.portals = g_list_prepend(node->portal.back->room.portals, node);
+        }
+        else if(node->any.type == WORLD_SCULTURE)
+        {
+            node->sculture.owner = &base[links[i * 2 + 0]];
+            node->sculture.owner->room.scultures = g_list_prepend(node->sculture.owner->room.scultures, node);
+        }
+    }
+
+    g_free(links);
+    g_mapped_file_unref(mapping);
+    if(!result)
+    {
+        g_array_free(world->nodes, TRUE);
+        world->nodes = NULL;
+    }
+    return result;
+}
+
+/**
+ * world_new:
+ *
+ * Builds the world of the mesh groups @groups, loaded from @file_name.
+ * The graph baked by world_bake() is read when it is up to date, @file_name
+ * may be NULL to always build it from the group names.
+ **/
+World*
+world_new(
+    RMeshGroup*             groups,
+    const gchar*            file_name
+    )
+{
+    World* world;
+    WorldNode* node;
+    guint i;
+
+    world = g_slice_new0(World);
+    world->groups = groups;
+    if(file_name == NULL || !_world_load(world, file_name))
+    {
+        _world_build(world);
+    }
+
+    for(i = 0; i < world->nodes->len; i++)
+    {
+        node = &g_array_index(world->nodes, WorldNode, i);
+        if(node->any.type == WORLD_ROOM)
+        {
+            _world_node_pack_scultures(node);
+        }
+    }
 
     return world;
 }
 
+/**
+ * world_bake:
+ *
+ * Builds the world of the mesh group @file_name and writes its .rworld
+ * graph, so that world_new() skips the parsing of the group names and the
+ * bbox of every mesh. Runs headless, from the .rmesh cache when it is up
+ * to date.
+ **/
+gboolean
+world_bake(
+    const gchar*            file_name
+    )
+{
+    RMeshGroup* groups;
+    World* world;
+    gboolean result;
+
+    g_assert(file_name != NULL);
+
+    groups = r_meshgroup_bake_load(file_name);
+    if(groups == NULL)
+    {
+        return FALSE;
+    }
+    world = g_slice_new0(World);
+    world->groups = groups;
+    _world_build(world);
+    result = _world_save(world, file_name);
+    world_free(world);
+    r_meshgroup_bake_free(groups);
+    return result;
+}
+
+/**
+ * world_bake_is_fresh:
+ *
+ * Returns TRUE when the .rworld graph of @file_name is up to date.
+ **/
+gboolean
+world_bake_is_fresh(
+    const gchar*            file_name
+    )
+{
+    _WorldCacheHeader header;
+    struct stat st;
+    gchar* cache_name;
+    FILE* stream;
+    gboolean result;
+
+    g_assert(file_name != NULL);
+
+    if(g_stat(file_name, &st) != 0)
+    {
+        return FALSE;
+    }
+
+    cache_name = g_strconcat(file_name, WORLD_CACHE_SUFFIX, NULL);
+    stream = fopen(cache_name, "rb");
+    g_free(cache_name);
+    if(stream == NULL)
+    {
+        return FALSE;
+    }
+    result = fread(&header, sizeof(header), 1, stream) == 1 &&
+        header.magic == WORLD_CACHE_MAGIC &&
+        header.version == WORLD_CACHE_VERSION &&
+        header.source_mtime == (guint64) st.st_mtime &&
+        header.source_size == (guint64) st.st_size;
+    fclose(stream);
+    return result;
+}
+
 /**
  * world_free:
  *
@@ -246,6 +720,20 @@ world_free(
     World*                  world
     )
 {
+    WorldNode* node;
+    guint i;
+
+    for(i = 0; i < world->nodes->len; i++)
+    {
+        node = &g_array_index(world->nodes, WorldNode, i);
+        if(node->any.type == WORLD_ROOM)
+        {
+            g_list_free(node->room.portals);
+            g_list_free(node->room.scultures);
+            g_free(node->room.scultures_visibility);
+            g_free(node->room.scultures_bbox);
+        }
+    }
     g_array_free(world->nodes, TRUE);
     g_slice_free(World, world);
 }
@@ -328,23 +816,101 @@ world_node_collide(
 }
 
 /**
- * world_node_draw:
+ * world_node_collect:
+ *
+ * Appends to @meshes the meshes of the nodes seen through @frustum from
+ * @node_to_collect, walking at most two portals away.
+ **/
+void
+world_node_collect(
+    RFrustum*               frustum,
+    World*                  world,
+    WorldNode*              node_to_collect,
+    GPtrArray*              meshes
+    )
+{
+    g_assert(frustum != NULL);
+    g_assert(world != NULL);
+    g_assert(node_to_collect != NULL);
+    g_assert(meshes != NULL);
+
+    _world_node_reset(world);
+    _world_node_collect(frustum, node_to_collect, 2, meshes);
+}
+
+/**
+ * world_prefetch:
  *
+ * Prefetches the resources of the rooms up to WORLD_PREFETCH_HOPS portals
+ * away from @node, ranked by distance and by @velocity. Nothing is done
+ * while @node does not change.
  **/
 void
-world_node_draw(
-    float4x4*               view,
+world_prefetch(
     World*                  world,
-    WorldNode*              node_to_draw
+    WorldNode*              node,
+    float3*                 position,
+    float3*                 velocity
     )
 {
+    WorldNode* room;
+    WorldNode* portal;
+    WorldNode* next;
+    GQueue queue = G_QUEUE_INIT;
+    guint* hops;
+    guint i;
+    GList* p;
+
     g_assert(world != NULL);
-    g_assert(node_to_draw != NULL);
+    g_assert(position != NULL);
+    g_assert(velocity != NULL);
 
-    if(view != NULL)
+    if(node == NULL || node == world->prefetch_node)
     {
-        glLoadMatrixf((GLfloat*) view);
+        return;
     }
-    _world_node_reset(world);
-    _world_node_draw(view, node_to_draw, 2);
+    world->prefetch_node = node;
+
+    /* breadth first walk, the culling owns the visited flags */
+    hops = g_new(guint, world->nodes->len);
+    for(i = 0; i < world->nodes->len; i++)
+    {
+        hops[i] = G_MAXUINT;
+    }
+    if(node->any.type == WORLD_PORTAL)
+    {
+        hops[node->portal.front - &g_array_index(world->nodes, WorldNode, 0)] = 0;
+        hops[node->portal.back - &g_array_index(world->nodes, WorldNode, 0)] = 0;
+        g_queue_push_tail(&queue, node->portal.front);
+        g_queue_push_tail(&queue, node->portal.back);
+    }
+    else if(node->any.type == WORLD_ROOM)
+    {
+        hops[node - &g_array_index(world->nodes, WorldNode, 0)] = 0;
+        g_queue_push_tail(&queue, node);
+    }
+
+    r_resource_prefetch_begin();
+    while((room = g_queue_pop_head(&queue)) != NULL)
+    {
+        i = hops[room - &g_array_index(world->nodes, WorldNode, 0)];
+        _world_node_prefetch(room, i, position, velocity);
+        if(i == WORLD_PREFETCH_HOPS)
+        {
+            continue;
+        }
+        for(p = g_list_first(room->room.portals); p != NULL; p = g_list_next(p))
+        {
+            portal = p->data;
+            next = (portal->portal.front == room) ? portal->portal.back : portal->portal.front;
+            if(hops[next - &g_array_index(world->nodes, WorldNode, 0)] == G_MAXUINT)
+            {
+                hops[next - &g_array_index(world->nodes, WorldNode, 0)] = i + 1;
+                g_queue_push_tail(&queue, next);
+            }
+        }
+    }
+    r_resource_prefetch_end();
+
+    g_free(hops);
 }